@@ -11,14 +11,30 @@
 #include <QGridLayout>
 #include <QLabel>
 #include <QLineEdit>
+#include <QComboBox>
+#include <QSpinBox>
+#include <QCheckBox>
 #include <QFileDialog>
 #include <QFile>
 #include <QTextStream>
 #include <QVector>
-#include <QMediaPlayer>
-#include <QAudioOutput>
+#include <QAudioDecoder>
+#include <QAudioBuffer>
+#include <QAudioFormat>
+#include <QAudioSink>
+#include <QAudioSource>
+#include <QAudioDevice>
+#include <QMediaDevices>
+#include <QEventLoop>
+#include <QTimer>
+#include <QThread>
+#include <QScreen>
 #include <QPainter>
 #include <QPainterPath>
+#include <QPixmap>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
 #include <QGroupBox>
 #include <QSlider>
 #include <QStyle>
@@ -30,277 +46,3069 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QKeyEvent>
+#include <QAction>
 #include <QSet>
+#include <QHash>
 #include <QUrl>
+#include <QSharedPointer>
+#include <QImage>
+#include <QCache>
+#include <QMutex>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QDateTime>
 
 #include <cmath>
 #include <algorithm>
+#include <functional>
+#include <atomic>
+#include <array>
+#include <memory>
+#include <limits>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+#include "shadowing_core.h"
+
+//===================== Cloze (Hide mode) =====================
+
+// Kiểu ẩn từ khi luyện nghe–điền: tất cả, cứ N từ ẩn một, chỉ thực từ
+// (từ vựng), chỉ hư từ
+enum class ClozeMode { AllWords, EveryNth, ContentWords, FunctionWords };
+
+static bool isFunctionWord(const QString& lowerWord)
+{
+    static const QSet<QString> words = {
+        "a", "an", "the",
+        "i", "me", "my", "mine", "you", "your", "yours", "he", "him", "his",
+        "she", "her", "hers", "it", "its", "we", "us", "our", "ours",
+        "they", "them", "their", "theirs",
+        "this", "that", "these", "those", "who", "whom", "whose", "which",
+        "what",
+        "and", "or", "but", "nor", "so", "yet", "if", "than", "because",
+        "as", "while", "when", "where", "though", "although", "since",
+        "unless", "until",
+        "of", "to", "in", "on", "at", "by", "for", "with", "from", "about",
+        "into", "onto", "over", "under", "up", "down", "out", "off",
+        "through", "between", "after", "before", "during", "without",
+        "within", "against", "among", "around", "upon",
+        "is", "am", "are", "was", "were", "be", "been", "being",
+        "do", "does", "did", "have", "has", "had", "will", "would",
+        "shall", "should", "can", "could", "may", "might", "must",
+        "not", "no", "there", "here", "then", "too", "very", "just", "also",
+        "all", "some", "any", "each", "every", "both", "either", "neither",
+        "i'm", "i've", "i'll", "i'd", "it's", "that's", "there's", "let's",
+        "you're", "we're", "they're", "don't", "doesn't", "didn't",
+        "can't", "won't", "isn't", "aren't", "wasn't", "weren't"
+    };
+    return words.contains(lowerWord);
+}
+
+// Một câu tách sẵn: cờ hư từ tính một lần khi nạp; các chuỗi ẩn dựng sẵn
+// cho kiểu ẩn đang chọn, nên bật/tắt Hide chỉ là gán chuỗi có sẵn.
+struct ClozeLayout
+{
+    QStringList   words;
+    QVector<bool> function;
+    QString plainHtml;      // label khi hiện
+    QString maskedText;     // cột Content khi ẩn
+    QString maskedHtml;     // label khi ẩn
+};
+
+// mỗi từ là link (click để nghe riêng từ đó)
+static QString clozeLink(int wordIdx, const QString& shownHtml)
+{
+    return QString("<a href=\"%1\" style=\"color:#0b3d91; "
+        "text-decoration:none;\">%2</a>").arg(wordIdx).arg(shownHtml);
+}
+
+static ClozeLayout buildClozeLayout(const QString& text)
+{
+    ClozeLayout c;
+    c.words = sentenceWords(text);
+    c.function.resize(c.words.size());
+    QStringList html;
+    for (int i = 0; i < c.words.size(); ++i) {
+        QString core;
+        for (QChar ch : c.words[i]) {
+            if (ch.isLetterOrNumber())
+                core += ch.toLower();
+            else if (ch == QLatin1Char('\'') || ch == QChar(0x2019))
+                core += QLatin1Char('\'');
+        }
+        c.function[i] = isFunctionWord(core);
+        html << clozeLink(i, c.words[i].toHtmlEscaped());
+    }
+    c.plainHtml = html.join(' ');
+    return c;
+}
+
+// chữ/số của từ bị ẩn thành '_', dấu câu giữ nguyên
+static void applyClozeMask(ClozeLayout& c, ClozeMode mode, int everyN)
+{
+    QStringList text, html;
+    for (int i = 0; i < c.words.size(); ++i) {
+        bool mask = true;
+        switch (mode) {
+        case ClozeMode::AllWords:
+            break;
+        case ClozeMode::EveryNth:
+            mask = (i + 1) % std::max(1, everyN) == 0;
+            break;
+        case ClozeMode::ContentWords:
+            mask = !c.function[i];
+            break;
+        case ClozeMode::FunctionWords:
+            mask = c.function[i];
+            break;
+        }
+        QString w = c.words[i];
+        if (mask) {
+            for (QChar& ch : w)
+                if (ch.isLetterOrNumber()) ch = QLatin1Char('_');
+        }
+        text << w;
+        html << clozeLink(i, w.toHtmlEscaped());
+    }
+    c.maskedText = text.join(' ');
+    c.maskedHtml = html.join(' ');
+}
+
+//===================== Pitch (F0) =====================
+
+// Đường F0 cho luyện ngữ điệu. YIN trên tín hiệu đã hạ về ~8–11 kHz:
+// hàm sai khác d(τ) được cộng dồn theo mẫu j ở vòng ngoài, τ ở vòng trong,
+// nên vòng trong là phép toán theo phần tử trên cả dải τ – compiler vector
+// hoá được, không cần intrinsics.
+static constexpr double kPitchMinHz = 70.0;
+static constexpr double kPitchMaxHz = 500.0;
+
+struct PitchContour
+{
+    double frameSec = 0.01;
+    QVector<float> hz;      // mỗi khung một giá trị, 0 = không hữu thanh
+};
+
+static PitchContour trackPitch(const PcmData& pcm, qint64 f0, qint64 f1)
+{
+    PitchContour c;
+    f0 = std::max<qint64>(0, f0);
+    f1 = std::min(pcm.frames(), f1);
+    if (pcm.sampleRate <= 0 || f1 <= f0) return c;
+
+    const int decim = std::max(1, pcm.sampleRate / 8000);
+    const int sr = pcm.sampleRate / decim;
+    QVector<float> y(int((f1 - f0) / decim));
+    const PcmSlice slice(pcm, f0, f1);
+    const qint16* x = slice.data();
+    for (int k = 0; k < y.size(); ++k) {
+        int acc = 0;
+        for (int d = 0; d < decim; ++d)
+            acc += x[qint64(k) * decim + d];
+        y[k] = float(acc) / decim;
+    }
+
+    const int hop = std::max(1, sr / 100);
+    const int tauMin = std::max(2, int(sr / kPitchMaxHz));
+    const int tauMax = int(sr / kPitchMinHz) + 1;
+    const int win = tauMax;
+    const int frames = (int(y.size()) + hop - 1) / hop;
+    c.frameSec = double(hop) * decim / pcm.sampleRate;
+    c.hz.fill(0.0f, frames);
+
+    // khung nhỏ hơn đỉnh 35 dB coi là lặng, khỏi tìm cao độ
+    QVector<float> buf(win + tauMax), d(tauMax + 1), rms(frames);
+    auto load = [&](int i) {
+        const int start = i * hop + hop / 2 - (win + tauMax) / 2;
+        for (int j = 0; j < buf.size(); ++j) {
+            const int k = start + j;
+            buf[j] = (k >= 0 && k < y.size()) ? y[k] : 0.0f;
+        }
+    };
+    float peak = 0.0f;
+    for (int i = 0; i < frames; ++i) {
+        load(i);
+        double acc = 0.0;
+        for (int j = 0; j < win; ++j)
+            acc += double(buf[j]) * buf[j];
+        rms[i] = float(std::sqrt(acc / win));
+        peak = std::max(peak, rms[i]);
+    }
+    const float gate = std::max(100.0f, peak * 0.0178f);
+
+    for (int i = 0; i < frames; ++i) {
+        if (rms[i] < gate) continue;
+        load(i);
+        std::fill(d.begin(), d.end(), 0.0f);
+        float* dd = d.data();
+        for (int j = 0; j < win; ++j) {
+            const float xj = buf[j];
+            const float* xs = buf.constData() + j;
+            for (int tau = 1; tau <= tauMax; ++tau) {
+                const float t = xj - xs[tau];
+                dd[tau] += t * t;
+            }
+        }
+
+        // hiệu chuẩn theo trung bình tích luỹ (CMNDF), lấy cực tiểu đầu
+        // tiên dưới ngưỡng
+        double running = 0.0;
+        int best = -1;
+        for (int tau = 1; tau <= tauMax; ++tau) {
+            running += dd[tau];
+            dd[tau] = running > 0.0 ? float(dd[tau] * tau / running) : 1.0f;
+        }
+        for (int tau = tauMin; tau < tauMax; ++tau) {
+            if (dd[tau] < 0.15f) {
+                while (tau + 1 < tauMax && dd[tau + 1] < dd[tau]) ++tau;
+                best = tau;
+                break;
+            }
+        }
+        if (best < 0) continue;
+
+        // nội suy parabol quanh cực tiểu
+        const float a = dd[best - 1], b = dd[best], e = dd[best + 1];
+        const float den = a - 2.0f * b + e;
+        const float shift = den > 0.0f ? 0.5f * (a - e) / den : 0.0f;
+        c.hz[i] = float(sr / (best + std::clamp(shift, -0.5f, 0.5f)));
+    }
+
+    // trung vị 3 điểm trên các khung hữu thanh liền nhau: bỏ nhảy quãng tám lẻ
+    const QVector<float> raw = c.hz;
+    for (int i = 1; i + 1 < frames; ++i) {
+        if (raw[i - 1] > 0.0f && raw[i] > 0.0f && raw[i + 1] > 0.0f) {
+            c.hz[i] = std::max(std::min(raw[i - 1], raw[i]),
+                std::min(std::max(raw[i - 1], raw[i]), raw[i + 1]));
+        }
+    }
+    return c;
+}
+
+// Contour theo key do người gọi đặt (row câu mẫu, take...). Một entry chỉ
+// đúng cho đúng (pcm, f0, f1) đã tính; đổi mép câu → span khác → tính lại.
+// Tính trên TaskPool; GUI gọi collect() để nhận kết quả, generation() tăng
+// mỗi lần có contour mới để mọi widget đang vẽ biết mà vẽ lại.
+class PitchCache
+{
+public:
+    PitchCache() : m_shared(QSharedPointer<Shared>::create()) {}
+    ~PitchCache() { m_token.cancel(); }
+
+    // bỏ hết (đổi audio); task cũ bị huỷ theo token
+    void reset(const CancelToken& lesson)
+    {
+        m_token.cancel();
+        m_token = CancelToken::create(lesson);
+        m_shared = QSharedPointer<Shared>::create();
+        m_entries.clear();
+        m_pending.clear();
+        ++m_generation;
+    }
+
+    // null → chưa có, đã xếp lịch tính
+    QSharedPointer<const PitchContour> contour(quint64 key,
+        const QSharedPointer<const PcmData>& pcm, qint64 f0, qint64 f1,
+        TaskPool::Priority prio = TaskPool::Visible)
+    {
+        if (!pcm || pcm->isEmpty() || f1 <= f0) return {};
+        const Span span{ pcm, f0, f1 };
+        const auto it = m_entries.constFind(key);
+        if (it != m_entries.cend() && it->span == span) {
+            ++m_stats.hits;
+            return it->contour;
+        }
+        ++m_stats.misses;
+
+        const auto pend = m_pending.constFind(key);
+        if (pend == m_pending.cend() || !(*pend == span)) {
+            m_pending.insert(key, span);
+            TaskPool::instance().submit(
+                [shared = m_shared, span, key]() {
+                    auto c = QSharedPointer<PitchContour>::create(
+                        trackPitch(*span.pcm, span.f0, span.f1));
+                    QMutexLocker lock(&shared->mutex);
+                    shared->done.push_back({ key, span, std::move(c) });
+                }, prio, m_token);
+        }
+        return {};
+    }
+
+    // GUI thread; true nếu có contour mới
+    bool collect()
+    {
+        QVector<Done> done;
+        {
+            QMutexLocker lock(&m_shared->mutex);
+            done.swap(m_shared->done);
+        }
+        for (Done& d : done) {
+            const auto pend = m_pending.constFind(d.key);
+            if (pend != m_pending.cend() && *pend == d.span)
+                m_pending.erase(pend);
+            m_entries.insert(d.key, { d.span, std::move(d.contour) });
+        }
+        if (done.isEmpty()) return false;
+        ++m_generation;
+        return true;
+    }
+
+    int generation() const { return m_generation; }
+
+    struct Stats
+    {
+        qint64 hits = 0;
+        qint64 misses = 0;      // chưa có hoặc span đã đổi
+        int    contours = 0;
+        qint64 bytes = 0;
+    };
+
+    Stats stats() const
+    {
+        Stats s = m_stats;
+        s.contours = int(m_entries.size());
+        for (const Entry& e : m_entries)
+            s.bytes += e.contour->hz.size() * qint64(sizeof(float));
+        return s;
+    }
+
+private:
+    struct Span
+    {
+        QSharedPointer<const PcmData> pcm;
+        qint64 f0 = 0;
+        qint64 f1 = 0;
+
+        bool operator==(const Span& o) const
+        {
+            return pcm == o.pcm && f0 == o.f0 && f1 == o.f1;
+        }
+    };
+
+    struct Entry
+    {
+        Span span;
+        QSharedPointer<const PitchContour> contour;
+    };
+
+    struct Done
+    {
+        quint64 key = 0;
+        Span span;
+        QSharedPointer<const PitchContour> contour;
+    };
+
+    struct Shared
+    {
+        QMutex mutex;
+        QVector<Done> done;
+    };
+
+    CancelToken m_token;
+    QSharedPointer<Shared> m_shared;
+    QHash<quint64, Entry> m_entries;
+    QHash<quint64, Span> m_pending;
+    int m_generation = 0;
+    Stats m_stats;
+};
+
+//===================== Lesson document (shared) =====================
+
+// Min/max theo từng khối mẫu – waveform thật. levels[0] là khối 256
+// frame, mỗi mức sau gộp đôi mức trước; khi vẽ chọn mức sao cho mỗi pixel
+// chỉ đọc 1–2 peak, nên chi phí một khung hình không phụ thuộc độ dài file.
+struct WavePeaks
+{
+    struct Level
+    {
+        int framesPerPeak = 256;
+        QVector<qint16> minv;
+        QVector<qint16> maxv;
+    };
+
+    int sampleRate = 0;
+    QVector<Level> levels;
+    int absMax = 1;
+
+    bool isEmpty() const { return levels.isEmpty() || levels[0].minv.isEmpty(); }
+
+    // mức thô nhất mà một peak vẫn không rộng hơn một pixel
+    const Level& levelFor(double framesPerPixel) const
+    {
+        int best = 0;
+        for (int i = 1; i < levels.size(); ++i) {
+            if (levels[i].framesPerPeak > framesPerPixel) break;
+            best = i;
+        }
+        return levels[best];
+    }
+};
+
+static QSharedPointer<WavePeaks> buildPeaks(const PcmData& pcm,
+    int framesPerPeak = 256)
+{
+    auto peaks = QSharedPointer<WavePeaks>::create();
+    peaks->sampleRate = pcm.sampleRate;
+
+    const qint64 frames = pcm.frames();
+    const qint64 n = (frames + framesPerPeak - 1) / framesPerPeak;
+    WavePeaks::Level base;
+    base.framesPerPeak = framesPerPeak;
+    base.minv.resize(n);
+    base.maxv.resize(n);
+
+    // mức 0 chia khối trên TaskPool, mỗi khối tự giữ absMax riêng (và
+    // giải nén phần PCM của mình nếu lesson đang nén)
+    qint16* minv = base.minv.data();
+    qint16* maxv = base.maxv.data();
+    constexpr qint64 kChunkPeaks = 4096;
+    const int chunks = int((n + kChunkPeaks - 1) / kChunkPeaks);
+    QVector<int> chunkMax(chunks, 1);
+    int* cmax = chunkMax.data();
+    TaskPool::instance().parallelFor(chunks, [&](int c) {
+        const qint64 i0 = c * kChunkPeaks;
+        const qint64 i1 = std::min(n, i0 + kChunkPeaks);
+        const qint64 f0 = i0 * framesPerPeak;
+        const PcmSlice slice(pcm, f0, std::min(frames, i1 * framesPerPeak));
+        const qint16* x = slice.data();
+        int absMax = 1;
+        for (qint64 i = i0; i < i1; ++i) {
+            const qint64 a = i * framesPerPeak - f0;
+            const qint64 b = std::min(frames, a + f0 + framesPerPeak) - f0;
+            qint16 lo = x[a], hi = x[a];
+            for (qint64 k = a + 1; k < b; ++k) {
+                lo = std::min(lo, x[k]);
+                hi = std::max(hi, x[k]);
+            }
+            minv[i] = lo;
+            maxv[i] = hi;
+            absMax = std::max({ absMax, std::abs(int(lo)), int(hi) });
+        }
+        cmax[c] = absMax;
+    });
+    peaks->absMax = chunkMax.isEmpty()
+        ? 1 : *std::max_element(chunkMax.cbegin(), chunkMax.cend());
+    peaks->levels.append(std::move(base));
+
+    // gộp đôi cho tới khi còn 1 peak (~2x bộ nhớ của mức 0)
+    while (peaks->levels.last().minv.size() > 1) {
+        const WavePeaks::Level& prev = peaks->levels.last();
+        const qsizetype m = (prev.minv.size() + 1) / 2;
+        WavePeaks::Level next;
+        next.framesPerPeak = prev.framesPerPeak * 2;
+        next.minv.resize(m);
+        next.maxv.resize(m);
+        for (qsizetype i = 0; i < m; ++i) {
+            const qsizetype a = 2 * i;
+            const qsizetype b = std::min(a + 1, prev.minv.size() - 1);
+            next.minv[i] = std::min(prev.minv[a], prev.minv[b]);
+            next.maxv[i] = std::max(prev.maxv[a], prev.maxv[b]);
+        }
+        peaks->levels.append(std::move(next));
+    }
+    return peaks;
+}
+
+// Gain phát cho một đoạn frame (chuẩn hoá loudness theo câu). Bảng sắp
+// theo f0, các đoạn nối liền nhau từ đầu tới cuối file.
+struct GainSpan
+{
+    qint64 f0 = 0;
+    qint64 f1 = 0;
+    float  gain = 1.0f;
+};
+using GainMap = QVector<GainSpan>;
+
+// Một lesson duy nhất cho cả Setup và Practice. Tab sửa dữ liệu trực
+// tiếp rồi gọi sentenceChanged()/sentencesChanged(); các tab khác được
+// báo qua observer (file không dùng moc nên không có signal riêng).
+class LessonDocument
+{
+public:
+    // Gains: chỉ loudness/gain đổi (đo nền xong), câu giữ nguyên
+    enum class Change { Reset, Sentence, Sentences, Gains };
+    using Observer = std::function<void(Change change, int row)>;
+
+    LessonDocument() : m_inbox(QSharedPointer<Inbox>::create())
+    {
+        // kết quả task nền về GUI qua poll (không moc, không queued signal)
+        m_poll.setInterval(kPollMs);
+        QObject::connect(&m_poll, &QTimer::timeout,
+            [this]() { drainInbox(); });
+    }
+
+    ~LessonDocument()
+    {
+        m_loadToken.cancel();
+        cancelToken.cancel();
+        setLoading(false);
+    }
+
+    QString audioPath;
+    QString textPath;
+    QString jsonPath;
+    double  playSpeed = 1.0;
+    int     lastSentence = 0;
+    QVector<Sentence> sentences;
+
+    // audio đã giải mã – chỉ đọc, dùng chung
+    QSharedPointer<const PcmData>   pcm;
+    QSharedPointer<const WavePeaks> peaks;
+
+    // gain theo câu từ loudness đã đo, dựng lại mỗi khi câu đổi; engine
+    // nhận bảng mới qua AudioEngine::setGains()
+    QSharedPointer<const GainMap>   gains;
+
+    // huỷ mọi task nền của lesson cũ khi đổi audio
+    CancelToken cancelToken;
+
+    // bản thu gần nhất của người học cho từng câu (theo Sentence::key, nên
+    // vẫn đúng câu khi thêm/xoá dòng)
+    QHash<quint32, QSharedPointer<const PcmData>> takes;
+
+    // F0 theo câu: xếp lịch nền cho mọi câu ngay khi nạp/sửa, nên lật qua
+    // lại giữa các câu chỉ đọc cache
+    PitchCache pitch;
+
+    double duration() const
+    {
+        if (!pcm || pcm->isEmpty()) return 0.0;
+        return double(pcm->frames()) / pcm->sampleRate;
+    }
+
+    // bộ nhớ lesson đang giữ (HUD); tile spectrogram thuộc widget nên
+    // không tính ở đây
+    struct Memory
+    {
+        qint64 pcm = 0;
+        qint64 pcmMapped = 0;   // map từ file: page cache, hệ điều hành tự thả
+        qint64 peaks = 0;
+        qint64 takes = 0;
+        qint64 pitch = 0;
+        qint64 text = 0;        // câu + word timing
+        qint64 total() const { return pcm + peaks + takes + pitch + text; }
+    };
+
+    Memory memory() const
+    {
+        Memory m;
+        if (pcm) {
+            m.pcm = pcm->storedBytes();
+            if (pcm->isMapped())
+                m.pcmMapped = pcm->frames() * qint64(sizeof(qint16));
+        }
+        if (peaks) {
+            for (const WavePeaks::Level& l : peaks->levels)
+                m.peaks += (l.minv.size() + l.maxv.size())
+                    * qint64(sizeof(qint16));
+        }
+        for (const auto& t : takes)
+            m.takes += t->frames() * qint64(sizeof(qint16));
+        m.pitch = pitch.stats().bytes;
+        for (const Sentence& s : sentences)
+            m.text += qint64(sizeof(Sentence)) + s.text.size() * 2
+                + s.wordStartMs.size() * qint64(sizeof(quint32));
+        return m;
+    }
+
+    // null → đang tính (xem PitchCache::collect)
+    QSharedPointer<const PitchContour> sentencePitch(int row,
+        TaskPool::Priority prio = TaskPool::Visible)
+    {
+        if (!pcm || row < 0 || row >= sentences.size()) return {};
+        const Sentence& s = sentences[row];
+        if (s.begin < 0.0 || s.end <= s.begin) return {};
+        return pitch.contour(quint64(row), pcm,
+            qint64(s.begin * pcm->sampleRate),
+            qint64(s.end * pcm->sampleRate), prio);
+    }
+
+    QSharedPointer<const PcmData> take(int row) const
+    {
+        if (row < 0 || row >= sentences.size()) return {};
+        return takes.value(sentences[row].key);
+    }
+
+    void setTake(int row, QSharedPointer<const PcmData> t)
+    {
+        if (row < 0 || row >= sentences.size()) return;
+        takes.insert(sentences[row].key, std::move(t));
+    }
+
+    // -1 nếu câu đã bị xoá
+    int rowOfKey(quint32 key) const
+    {
+        for (int i = 0; i < sentences.size(); ++i) {
+            if (sentences[i].key == key) return i;
+        }
+        return -1;
+    }
+
+    QSharedPointer<const PitchContour> takePitch(int row)
+    {
+        const QSharedPointer<const PcmData> t = take(row);
+        if (!t) return {};
+        return pitch.contour((quint64(1) << 32) | sentences[row].key, t,
+            0, t->frames());
+    }
+
+    void addObserver(const void* owner, Observer cb)
+    {
+        m_observers.push_back({ owner, std::move(cb) });
+    }
+
+    void removeObservers(const void* owner)
+    {
+        m_observers.removeIf([owner](const ObserverEntry& e) {
+            return e.owner == owner;
+        });
+    }
+
+    // Nạp lesson mới. Cùng file audio thì áp ngay; file khác thì giải mã
+    // (+ nén, peaks) trên TaskPool dưới token của lesson mới và chỉ thay
+    // lesson (Reset) khi xong, nên trong lúc chờ document vẫn là lesson cũ
+    // nguyên vẹn. Gọi lại trước khi xong thì lần nạp trước bị bỏ.
+    void setLesson(const QString& audio, const QString& text,
+        const QString& json, double speed, int lastSent,
+        const QVector<Sentence>& sents)
+    {
+        PendingLesson next{ audio, text, json, speed, lastSent, sents };
+        m_loadToken.cancel();
+        const quint64 serial = ++m_loadSerial;
+        // lần trước giải mã hỏng (file bị khoá, thiếu codec) thì giải mã lại
+        if (pcm && !pcm->isEmpty() && audio == audioPath) {
+            setLoading(false);
+            applyLesson(std::move(next));
+            return;
+        }
+
+        m_loadToken = CancelToken::create();
+        setLoading(true);
+        TaskPool::instance().submit(
+            [this, inbox = m_inbox, serial, next = std::move(next)]() {
+                auto data = QSharedPointer<PcmData>::create();
+                QSharedPointer<const WavePeaks> pk;
+                if (decodeAudioFile(next.audio, *data)) {
+                    // SHADOWING_PCM=compressed: PCM dạng khối nén (máy ít RAM)
+                    static const bool compress =
+                        qEnvironmentVariable("SHADOWING_PCM") == "compressed";
+                    if (compress)
+                        compressPcm(*data);
+                    if (!data->isEmpty())
+                        pk = buildPeaks(*data);
+                }
+                else {
+                    qWarning("cannot decode audio %s", qPrintable(next.audio));
+                }
+                // chỉ chạy trên GUI (drainInbox) nên dùng this được
+                post(inbox, [this, serial, next, data, pk]() {
+                    finishLoad(serial, next, data, pk);
+                });
+            }, TaskPool::Visible, m_loadToken);
+    }
+
+    // sau khi sửa sentences[row] (thời gian, nội dung, confirm)
+    void sentenceChanged(int row, const void* sender)
+    {
+        if (row < 0 || row >= sentences.size()) return;
+        estimateWordTimes(sentences[row], pcm.data());
+        sentencePitch(row, TaskPool::Normal);
+        if (pcm)
+            analyzeLoudness(sentences[row], *pcm);
+        updateGains();
+        notify(Change::Sentence, row, sender);
+    }
+
+    // sau khi thêm/xoá/gán lại nhiều câu; take của câu còn lại được giữ
+    void sentencesChanged(const void* sender)
+    {
+        assignKeys();
+        QSet<quint32> alive;
+        for (const Sentence& s : sentences)
+            alive.insert(s.key);
+        takes.removeIf([&alive](const auto& it) {
+            return !alive.contains(it.key());
+        });
+        updateAllWordTimes();
+        requestAllPitch();
+        // chỉ câu mới/đổi thời gian (loudness NaN) được đo lại, ở nền
+        measureLoudness();
+        updateGains();
+        notify(Change::Sentences, -1, sender);
+    }
+
+private:
+    struct PendingLesson
+    {
+        QString audio;
+        QString text;
+        QString json;
+        double  speed = 1.0;
+        int     lastSent = 0;
+        QVector<Sentence> sentences;
+    };
+
+    // GUI thread: giải mã xong; bỏ qua nếu đã có lần nạp mới hơn
+    void finishLoad(quint64 serial, const PendingLesson& next,
+        QSharedPointer<const PcmData> data,
+        QSharedPointer<const WavePeaks> pk)
+    {
+        if (serial != m_loadSerial) return;
+        setLoading(false);
+        // token của lần nạp thành token lesson: task cũ bị huỷ theo
+        cancelToken.cancel();
+        cancelToken = m_loadToken;
+        m_loadToken = CancelToken();
+        pitch.reset(cancelToken);
+        pcm = std::move(data);
+        peaks = std::move(pk);
+        applyLesson(next);
+    }
+
+    void applyLesson(const PendingLesson& next)
+    {
+        audioPath = next.audio;
+        textPath = next.text;
+        jsonPath = next.json;
+        playSpeed = next.speed;
+        lastSentence = next.lastSent;
+        sentences = next.sentences;
+        takes.clear();
+        assignKeys();
+        updateAllWordTimes();
+        requestAllPitch();
+        // loudness đã lưu trong JSON thì dùng lại, chỉ đo câu còn thiếu
+        measureLoudness();
+        updateGains();
+
+        notify(Change::Reset, -1, nullptr);
+    }
+
+    void setLoading(bool on)
+    {
+        if (on == m_loading) return;
+        m_loading = on;
+        if (on) {
+            QApplication::setOverrideCursor(Qt::WaitCursor);
+            m_poll.start();
+        }
+        else {
+            QApplication::restoreOverrideCursor();
+        }
+    }
+
+    // Kết quả task nền chờ áp vào document. Worker chỉ giữ inbox (sống
+    // tiếp nếu document đã huỷ), không chạm tới document.
+    struct Inbox
+    {
+        QMutex mutex;
+        QVector<std::function<void()>> done;
+    };
+
+    static void post(const QSharedPointer<Inbox>& inbox,
+        std::function<void()> fn)
+    {
+        QMutexLocker lock(&inbox->mutex);
+        inbox->done.push_back(std::move(fn));
+    }
+
+    // GUI thread; dừng poll khi không còn việc nào đang chờ
+    void drainInbox()
+    {
+        QVector<std::function<void()>> done;
+        {
+            QMutexLocker lock(&m_inbox->mutex);
+            done.swap(m_inbox->done);
+        }
+        for (const auto& fn : done)
+            fn();
+        if (!m_loading && !m_measuring)
+            m_poll.stop();
+    }
+
+    // Đo loudness các câu còn NaN trên TaskPool dưới token của lesson (bản
+    // sao câu, GUI không chờ); xong thì áp theo Sentence::key, dựng lại
+    // gain và báo Gains. Câu đổi thời gian trong lúc đo thì bỏ kết quả cũ.
+    void measureLoudness()
+    {
+        const quint64 serial = ++m_measureSerial;
+        m_measuring = false;
+        if (!pcm || pcm->isEmpty()) return;
+        QVector<Sentence> todo;
+        for (const Sentence& s : sentences) {
+            if (std::isnan(s.loudness) && s.begin >= 0.0 && s.end > s.begin)
+                todo.push_back(s);
+        }
+        if (todo.isEmpty()) return;
+
+        m_measuring = true;
+        m_poll.start();
+        TaskPool::instance().submit(
+            [this, inbox = m_inbox, serial, data = pcm, todo]() mutable {
+                analyzeLoudness(todo, *data);
+                post(inbox, [this, serial, data, todo]() {
+                    finishLoudness(serial, data, todo);
+                });
+            }, TaskPool::Normal, cancelToken);
+    }
+
+    // GUI thread
+    void finishLoudness(quint64 serial,
+        const QSharedPointer<const PcmData>& data,
+        const QVector<Sentence>& measured)
+    {
+        if (serial == m_measureSerial)
+            m_measuring = false;
+        if (data != pcm) return;
+
+        QHash<quint32, int> rows;
+        for (int i = 0; i < sentences.size(); ++i)
+            rows.insert(sentences[i].key, i);
+        bool changed = false;
+        for (const Sentence& m : measured) {
+            const int row = rows.value(m.key, -1);
+            if (row < 0) continue;
+            Sentence& s = sentences[row];
+            if (!std::isnan(s.loudness) || s.begin != m.begin
+                || s.end != m.end)
+                continue;
+            s.loudness = m.loudness;
+            s.peakDb = m.peakDb;
+            changed = true;
+        }
+        if (!changed) return;
+        updateGains();
+        notify(Change::Gains, -1, nullptr);
+    }
+
+    // câu mới (key 0) hoặc câu chép từ câu khác (trùng key) nhận key mới
+    void assignKeys()
+    {
+        QSet<quint32> seen;
+        for (Sentence& s : sentences) {
+            if (s.key == 0 || seen.contains(s.key))
+                s.key = ++m_lastKey;
+            seen.insert(s.key);
+        }
+    }
+
+    void updateAllWordTimes()
+    {
+        Sentence* sents = sentences.data();    // detach trước khi chia luồng
+        const PcmData* data = pcm.data();
+        TaskPool::instance().parallelFor(int(sentences.size()),
+            [sents, data](int i) { estimateWordTimes(sents[i], data); });
+    }
+
+    void requestAllPitch()
+    {
+        for (int i = 0; i < sentences.size(); ++i)
+            sentencePitch(i, TaskPool::Background);
+    }
+
+    // Mỗi câu giữ gain của nó từ begin tới begin của câu sau (khoảng lặng
+    // giữa hai câu theo câu trước, để gain không nhảy hai lần). Câu chồng
+    // nhau thì câu sau thắng.
+    void updateGains()
+    {
+        gains.reset();
+        if (!pcm || pcm->isEmpty()) return;
+        const int sr = pcm->sampleRate;
+        const qint64 total = pcm->frames();
+
+        QVector<GainSpan> spans;
+        for (const Sentence& s : sentences) {
+            if (s.begin < 0.0 || s.end <= s.begin) continue;
+            GainSpan g;
+            g.f0 = std::clamp<qint64>(qint64(s.begin * sr), 0, total);
+            g.gain = float(loudnessGain(s));
+            spans.push_back(g);
+        }
+        std::stable_sort(spans.begin(), spans.end(),
+            [](const GainSpan& a, const GainSpan& b) { return a.f0 < b.f0; });
+
+        auto map = QSharedPointer<GainMap>::create();
+        qint64 at = 0;
+        for (int i = 0; i < spans.size(); ++i) {
+            GainSpan g = spans[i];
+            g.f0 = std::max(g.f0, at);
+            g.f1 = (i + 1 < spans.size()) ? spans[i + 1].f0 : total;
+            if (i == 0) g.f0 = 0;
+            if (g.f1 <= g.f0) continue;
+            map->push_back(g);
+            at = g.f1;
+        }
+        if (!map->isEmpty())
+            gains = map;
+    }
+
+    struct ObserverEntry
+    {
+        const void* owner = nullptr;
+        Observer    callback;
+    };
+
+    void notify(Change change, int row, const void* sender)
+    {
+        const QVector<ObserverEntry> observers = m_observers;
+        for (const ObserverEntry& e : observers) {
+            if (e.owner != sender)
+                e.callback(change, row);
+        }
+    }
+
+    static constexpr int kPollMs = 30;
+
+    QVector<ObserverEntry> m_observers;
+    QSharedPointer<Inbox> m_inbox;
+    QTimer      m_poll;
+    CancelToken m_loadToken;    // lesson đang giải mã
+    quint64     m_loadSerial = 0;
+    quint64     m_measureSerial = 0;    // lần đo loudness mới nhất
+    quint32     m_lastKey = 0;      // Sentence::key đã cấp
+    bool        m_loading = false;
+    bool        m_measuring = false;
+};
+
+//===================== Audio engine (shared) =====================
+
+// Hàng đợi một producer / một consumer, không khoá
+template <typename T, int N>
+class SpscQueue
+{
+public:
+    bool push(const T& v)
+    {
+        const int head = m_head.load(std::memory_order_relaxed);
+        const int next = (head + 1) % N;
+        if (next == m_tail.load(std::memory_order_acquire))
+            return false;   // đầy
+        m_items[head] = v;
+        m_head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& v)
+    {
+        const int tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+            return false;
+        v = m_items[tail];
+        m_tail.store((tail + 1) % N, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, N> m_items{};
+    std::atomic<int> m_head{ 0 };
+    std::atomic<int> m_tail{ 0 };
+};
+
+struct AudioCommand
+{
+    enum Type { PlayRange, Play, Pause, TogglePause, Stop, Seek,
+                SetLoop, SetRate, Grain, PlayTake, StopTake,
+                SetGains, SetNormalize, QueueSegment };
+    Type   type = Stop;
+    qint64 a = 0;       // frame
+    qint64 b = -1;      // frame, <0 = tới cuối file
+    double value = 0.0;
+    const PcmData* take = nullptr;  // PlayTake; GUI giữ sống (xem playTake)
+    const GainMap* gains = nullptr; // SetGains; giữ sống như take
+    int     tag = -1;               // QueueSegment: row của câu
+    quint32 seq = 0;                // gán trong send()
+    quint32 flow = 0;               // thao tác UI gửi lệnh (trace)
+};
+
+// Trạng thái phát tại một thời điểm, đọc được từ mọi widget/luồng
+struct PlaybackSnapshot
+{
+    enum State { Stopped, Playing, Paused };
+    State  state = Stopped;
+    qint64 frame = 0;
+    qint64 rangeBegin = 0;
+    qint64 rangeEnd = 0;
+    bool   loop = false;
+    double rate = 1.0;
+    int    sampleRate = 0;
+    qint64 publishNs = 0;       // steady clock lúc callback công bố
+    int    latencyFrames = 0;   // frame đã nằm trong buffer của sink
+    int    drillTag = -1;       // drill: tag của đoạn đang phát, -1 = không drill
+    int    drillPending = 0;    // đoạn đã xếp, chưa bắt đầu
+
+    double position() const
+    {
+        return sampleRate > 0 ? double(frame) / sampleRate : 0.0;
+    }
+
+    // Vị trí đang thực sự phát ra loa (giây): lùi lại phần đã nằm trong
+    // buffer rồi nội suy theo thời gian trôi qua kể từ lần công bố.
+    double playheadAt(qint64 nowNs) const
+    {
+        if (sampleRate <= 0) return 0.0;
+        double f = double(frame);
+        if (state == Playing) {
+            const double maxElapsed =
+                double(latencyFrames) / sampleRate + 0.005;
+            const double elapsed = std::clamp(
+                double(nowNs - publishNs) * 1e-9, 0.0, maxElapsed);
+            f += (elapsed * sampleRate - latencyFrames) * rate;
+            f = std::min(f, double(frame));
+            if (f < double(rangeBegin)) {
+                if (loop && rangeEnd > rangeBegin)
+                    f += double(rangeEnd - rangeBegin);
+                else
+                    f = double(rangeBegin);
+            }
+        }
+        return f / sampleRate;
+    }
+};
+
+// Một engine duy nhất cho cả ứng dụng: một QAudioSink (pull mode)
+// đọc thẳng từ PCM của lesson. Sink sống trên luồng audio riêng (backend
+// Qt phục vụ pull bằng timer trên luồng sở hữu sink), nên GUI bận vẽ hay
+// chấm điểm không làm cạn buffer. GUI chỉ đẩy lệnh vào hàng đợi; luồng
+// audio áp dụng lệnh ở đầu mỗi lần đọc và công bố trạng thái qua
+// seqlock, nên không có khoá nào giữa GUI và callback audio.
+class AudioEngine
+{
+public:
+    AudioEngine()
+    {
+        m_thread.setObjectName("audio");
+        m_context.moveToThread(&m_thread);
+        m_thread.start(QThread::TimeCriticalPriority);
+    }
+
+    ~AudioEngine()
+    {
+        onAudioThread([this] { closeSink(); });
+        m_thread.quit();
+        m_thread.wait();
+    }
+
+    // GUI thread. Mở sink ngay để lần phát đầu không phải chờ.
+    void setSource(QSharedPointer<const PcmData> pcm)
+    {
+        if (pcm == m_pcm) return;
+        // sink dừng trên luồng của nó; sau đó không còn ai đọc m_pcm nên
+        // GUI đặt lại trạng thái render được
+        onAudioThread([this] { closeSink(); });
+
+        m_pcm = std::move(pcm);
+        AudioCommand dropped;
+        while (m_commands.pop(dropped)) {}
+        m_state = PlaybackSnapshot::Stopped;
+        m_cursor = 0.0;
+        m_rangeBegin = 0;
+        m_rangeEnd = -1;
+        m_loop = false;
+        endDrill();
+        m_grains.fill(GrainVoice());
+        // sink đã dừng: cấp phát buffer giải nén ở đây, không ở callback
+        m_read.reset(m_pcm.data());
+        for (GrainVoice& g : m_grains)
+            g.read.reset(m_pcm.data());
+        m_take = nullptr;
+        m_takeHold.reset();
+        m_gains = nullptr;
+        m_gainsHold.reset();
+        m_retired.clear();
+        m_normalize = m_wantNormalize;
+        m_gainF0 = 0;
+        m_gainF1 = -1;
+        m_gainQ12 = m_gainTarget = kGainOne;
+        m_lastRenderNs = 0;
+        publish();
+
+        if (!hasSource()) return;
+        onAudioThread([this] { openSink(); });
+    }
+
+    bool hasSource() const { return m_pcm && !m_pcm->isEmpty(); }
+
+    // ----- lệnh (GUI thread) -----
+    void playRange(double begin, double end, bool loop = false)
+    {
+        AudioCommand c;
+        c.type = AudioCommand::PlayRange;
+        c.a = toFrame(begin);
+        c.b = end > begin ? toFrame(end) : -1;
+        c.value = loop ? 1.0 : 0.0;
+        send(c);
+    }
+    void play()        { send({ AudioCommand::Play }); }
+    void pause()       { send({ AudioCommand::Pause }); }
+    void togglePause() { send({ AudioCommand::TogglePause }); }
+    void stop()        { send({ AudioCommand::Stop }); }
+
+    // trả seq của lệnh (0 = bị bỏ), xem isApplied()
+    quint32 seek(double sec)
+    {
+        AudioCommand c;
+        c.type = AudioCommand::Seek;
+        c.a = toFrame(sec);
+        return send(c);
+    }
+
+    // luồng audio đã xử lý lệnh có seq này chưa (snapshot đã phản ánh nó)
+    bool isApplied(quint32 seq) const
+    {
+        if (seq == 0) return true;
+        const quint32 applied = m_appliedSeq.load(std::memory_order_acquire);
+        return qint32(applied - seq) >= 0;
+    }
+
+    // chu kỳ một lần render của sink (ms)
+    static constexpr int periodMs() { return kSinkBufferMs; }
+
+    struct Stats
+    {
+        qint64 callbacks = 0;
+        qint64 underruns = 0;   // callback tới trễ hơn cả buffer khi đang phát
+        double maxRenderMs = 0.0;   // kể từ lần takeStats() trước
+        double maxGapMs = 0.0;      // khoảng cách lớn nhất giữa hai callback
+        int    bufferMs = 0;
+    };
+
+    // GUI thread; đỉnh (max*) được đặt lại sau mỗi lần đọc
+    Stats takeStats()
+    {
+        Stats s;
+        s.callbacks = m_callbacks.load(std::memory_order_relaxed);
+        s.underruns = m_underruns.load(std::memory_order_relaxed);
+        s.maxRenderMs = m_maxRenderNs.exchange(0,
+            std::memory_order_relaxed) / 1e6;
+        s.maxGapMs = m_maxGapNs.exchange(0, std::memory_order_relaxed) / 1e6;
+        const int rate = m_pubSampleRate.load(std::memory_order_relaxed);
+        if (rate > 0)
+            s.bufferMs = int(qint64(m_latencyFrames.load(
+                std::memory_order_relaxed)) * 1000 / rate);
+        return s;
+    }
+
+    void setLoop(bool on)
+    {
+        AudioCommand c;
+        c.type = AudioCommand::SetLoop;
+        c.value = on ? 1.0 : 0.0;
+        send(c);
+    }
+
+    void setRate(double rate)
+    {
+        AudioCommand c;
+        c.type = AudioCommand::SetRate;
+        c.value = rate;
+        send(c);
+    }
+
+    // Bản thu của người học phát như một voice riêng trộn lên đường chính:
+    // gọi sau playRange() là A+B chồng nhau (cùng một callback nên khớp
+    // từng mẫu), sau stop() là chỉ B. Take cũ chỉ được thả khi luồng audio
+    // đã áp dụng lệnh thay nó (seq đã xác nhận), nên không cần khoá.
+    void playTake(QSharedPointer<const PcmData> take)
+    {
+        if (!take || take->isEmpty()) return;
+        AudioCommand c;
+        c.type = AudioCommand::PlayTake;
+        c.take = take.data();
+        const quint32 seq = send(c);
+        if (seq == 0) return;
+        if (m_takeHold)
+            m_retired.push_back({ seq, m_takeHold });
+        m_takeHold = std::move(take);
+        releaseRetired();
+    }
+
+    void stopTake() { send({ AudioCommand::StopTake }); }
+
+    // Bảng gain theo câu của lesson (LessonDocument::gains) cho đường phát
+    // chính; null = không đổi gain. Bảng cũ được thả giống take cũ.
+    void setGains(QSharedPointer<const GainMap> gains)
+    {
+        if (gains == m_gainsHold) return;
+        AudioCommand c;
+        c.type = AudioCommand::SetGains;
+        c.gains = gains.data();
+        const quint32 seq = send(c);
+        if (seq == 0) return;
+        if (m_gainsHold)
+            m_retired.push_back({ seq, m_gainsHold });
+        m_gainsHold = std::move(gains);
+        releaseRetired();
+    }
+
+    // Drill: xếp đoạn [begin, end) kèm gapSec lặng phía sau. Chưa drill thì
+    // đoạn phát ngay; đang drill thì nối sau các đoạn đã xếp và luồng audio
+    // tự chuyển sang khi đoạn trước hết lặng – khớp từng mẫu, không seek.
+    // PlayRange/Play/Stop/Seek huỷ drill. Trả seq như seek().
+    quint32 queueSegment(double begin, double end, double gapSec, int tag)
+    {
+        AudioCommand c;
+        c.type = AudioCommand::QueueSegment;
+        c.a = toFrame(begin);
+        c.b = toFrame(end);
+        c.value = gapSec;
+        c.tag = tag;
+        return send(c);
+    }
+
+    // bật/tắt chuẩn hoá loudness; giữ qua các lần đổi lesson
+    void setNormalize(bool on)
+    {
+        m_wantNormalize = on;
+        AudioCommand c;
+        c.type = AudioCommand::SetNormalize;
+        c.value = on ? 1.0 : 0.0;
+        send(c);
+    }
+
+    // Nghe thử quanh sec khi kéo/nhích mép câu: một grain ~150 ms (cửa sổ
+    // Hann) trộn lên đường phát chính, không đổi trạng thái transport.
+    void scrub(double sec)
+    {
+        AudioCommand c;
+        c.type = AudioCommand::Grain;
+        c.a = toFrame(sec);
+        send(c);
+    }
+
+    // ----- trạng thái (mọi luồng, không khoá) -----
+    PlaybackSnapshot snapshot() const
+    {
+        PlaybackSnapshot s;
+        for (;;) {
+            const quint32 seq0 = m_seq.load(std::memory_order_acquire);
+            if (seq0 & 1u) continue;    // đang ghi
+            s.state = PlaybackSnapshot::State(
+                m_pubState.load(std::memory_order_relaxed));
+            s.frame = m_pubFrame.load(std::memory_order_relaxed);
+            s.rangeBegin = m_pubRangeBegin.load(std::memory_order_relaxed);
+            s.rangeEnd = m_pubRangeEnd.load(std::memory_order_relaxed);
+            s.loop = m_pubLoop.load(std::memory_order_relaxed);
+            s.rate = m_pubRate.load(std::memory_order_relaxed);
+            s.sampleRate = m_pubSampleRate.load(std::memory_order_relaxed);
+            s.publishNs = m_pubNs.load(std::memory_order_relaxed);
+            s.latencyFrames = m_latencyFrames.load(std::memory_order_relaxed);
+            s.drillTag = m_pubDrillTag.load(std::memory_order_relaxed);
+            s.drillPending = m_pubDrillPending.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_seq.load(std::memory_order_relaxed) == seq0)
+                return s;
+        }
+    }
+
+    bool isPlaying() const
+    {
+        return snapshot().state == PlaybackSnapshot::Playing;
+    }
+
+    // vị trí đang nghe (giây) – dùng cho Set Begin/End, seek bằng phím
+    double playhead() const
+    {
+        return snapshot().playheadAt(steadyNowNs());
+    }
+
+    // ----- luồng audio -----
+    qint64 render(char* data, qint64 maxlen)
+    {
+        const qint64 frames = maxlen / qint64(sizeof(qint16));
+        qint16* out = reinterpret_cast<qint16*>(data);
+        const qint64 t0 = steadyNowNs();
+        checkUnderrun(t0);
+
+        AudioCommand c;
+        while (m_commands.pop(c))
+            apply(c);
+        if (m_outFlow) {
+            // mẫu đầu tiên sau lệnh nằm ở đầu buffer này, ra loa sau
+            // phần sink đang giữ
+            const qint64 waitNs = qint64(m_latencyFrames.load(
+                std::memory_order_relaxed)) * 1000000000 / m_pcm->sampleRate;
+            Trace::instant("audio.out", m_outFlow, waitNs);
+            m_outFlow = 0;
+        }
+        Trace::instant("sink.write", 0, frames);
+
+        const qint64 total = m_pcm->frames();
+        if (m_resampler.isPassthrough()) {
+            for (qint64 i = 0; i < frames; ++i)
+                out[i] = qint16(std::clamp(mixSample(total), -32768, 32767));
+        }
+        else {
+            // trộn ở rate của lesson, đổi sang rate sink từng khúc
+            float* mix = m_mixOut.data();
+            for (qint64 i = 0; i < frames;) {
+                const int n = int(std::min<qint64>(frames - i, kResampleChunk));
+                m_resampler.pull(mix, n, [this, total](float* dst, int k) {
+                    for (int j = 0; j < k; ++j)
+                        dst[j] = float(mixSample(total));
+                });
+                for (int j = 0; j < n; ++j)
+                    out[i + j] = qint16(std::lrint(
+                        std::clamp(mix[j], -32768.0f, 32767.0f)));
+                i += n;
+            }
+        }
+
+        publish();
+        const qint64 renderNs = steadyNowNs() - t0;
+        if (renderNs > m_maxRenderNs.load(std::memory_order_relaxed))
+            m_maxRenderNs.store(renderNs, std::memory_order_relaxed);
+        m_callbacks.fetch_add(1, std::memory_order_relaxed);
+        return frames * qint64(sizeof(qint16));
+    }
+
+private:
+    class Device : public QIODevice
+    {
+    public:
+        explicit Device(AudioEngine* engine) : m_engine(engine) {}
+        bool isSequential() const override { return true; }
+        qint64 bytesAvailable() const override
+        {
+            return std::numeric_limits<qint32>::max()
+                + QIODevice::bytesAvailable();
+        }
+
+    protected:
+        qint64 readData(char* data, qint64 maxlen) override
+        {
+            return m_engine->render(data, maxlen);
+        }
+        qint64 writeData(const char*, qint64) override { return -1; }
+
+    private:
+        AudioEngine* m_engine;
+    };
+
+    // luồng audio: mở sink cho m_pcm (trạng thái render đã đặt lại)
+    void openSink()
+    {
+        // ring trace cấp ở đây, không ở lần ghi đầu tiên trong render()
+        Trace::registerThread("audio");
+        // Sink chạy ở rate thiết bị ưa dùng (thường 48 kHz): lesson 44.1 kHz
+        // được resample ở đây thay vì để backend tự đổi (chất lượng tuỳ OS).
+        const QAudioDevice dev = QMediaDevices::defaultAudioOutput();
+        const int devRate = dev.preferredFormat().sampleRate();
+        QAudioFormat fmt;
+        fmt.setSampleRate(devRate > 0 ? devRate : m_pcm->sampleRate);
+        fmt.setChannelCount(1);
+        fmt.setSampleFormat(QAudioFormat::Int16);
+        if (!dev.isFormatSupported(fmt))
+            fmt.setSampleRate(m_pcm->sampleRate);
+        m_resampler.configure(m_pcm->sampleRate, fmt.sampleRate());
+        m_mixOut.assign(kResampleChunk, 0.0f);
+
+        m_sink = std::make_unique<QAudioSink>(dev, fmt);
+        // Buffer ngắn để grain scrub nghe được ngay (< 20 ms); chỉ ổn vì
+        // sink có luồng riêng, GUI bận không làm trễ lần nạp. Máy vẫn để
+        // cạn buffer (underrun) thì từ lần mở sink sau dùng buffer an toàn.
+        const int bufferMs = m_underruns.load(std::memory_order_relaxed) > 0
+            ? kSafeBufferMs : kSinkBufferMs;
+        m_sink->setBufferSize(
+            qsizetype(fmt.sampleRate() * bufferMs / 1000)
+            * qsizetype(sizeof(qint16)));
+        m_device = std::make_unique<Device>(this);
+        m_device->open(QIODevice::ReadOnly);
+        m_sink->start(m_device.get());
+        // độ trễ tính theo frame của lesson: buffer sink + trễ của filter
+        const qsizetype bufFrames =
+            m_sink->bufferSize() / qsizetype(sizeof(qint16));
+        m_latencyFrames.store(
+            int(qint64(bufFrames) * m_pcm->sampleRate / fmt.sampleRate())
+                + m_resampler.delayInputFrames(),
+            std::memory_order_relaxed);
+    }
+
+    // luồng audio
+    void closeSink()
+    {
+        if (m_sink) {
+            m_sink->stop();     // render() không còn được gọi
+            m_sink.reset();
+        }
+        m_device.reset();
+    }
+
+    // Chạy fn trên luồng audio và chờ xong. Chỉ dùng khi mở/đóng sink:
+    // luồng audio không bao giờ chờ GUI nên không khoá chết.
+    template <typename Fn>
+    void onAudioThread(Fn fn)
+    {
+        QMetaObject::invokeMethod(&m_context, fn,
+            Qt::BlockingQueuedConnection);
+    }
+
+    qint64 toFrame(double sec) const
+    {
+        if (!hasSource() || sec <= 0.0) return 0;
+        return std::min(m_pcm->frames(),
+            qint64(std::llround(sec * m_pcm->sampleRate)));
+    }
+
+    // trả seq của lệnh, 0 nếu bị bỏ (chưa có nguồn hoặc hàng đợi đầy –
+    // hiếm: 64 lệnh/chu kỳ)
+    quint32 send(AudioCommand c)
+    {
+        if (!hasSource()) return 0;
+        c.seq = m_sendSeq + 1;
+        c.flow = Trace::currentFlow();
+        if (!m_commands.push(c)) return 0;
+        Trace::instant("engine.send", c.flow, c.type);
+        return ++m_sendSeq;
+    }
+
+    // luồng audio. Sink kéo dữ liệu mỗi khi buffer có chỗ; hai lần gọi
+    // cách nhau lâu hơn cả buffer nghĩa là buffer đã cạn và loa nghe tiếng
+    // vấp. Chỉ tính khi đang có tiếng (im lặng thì vấp không nghe thấy).
+    void checkUnderrun(qint64 now)
+    {
+        const qint64 gap = m_lastRenderNs > 0 ? now - m_lastRenderNs : 0;
+        m_lastRenderNs = now;
+        if (gap > m_maxGapNs.load(std::memory_order_relaxed))
+            m_maxGapNs.store(gap, std::memory_order_relaxed);
+        const bool audible = m_state == PlaybackSnapshot::Playing || m_take;
+        const qint64 bufferNs = qint64(m_latencyFrames.load(
+            std::memory_order_relaxed)) * 1000000000 / m_pcm->sampleRate;
+        if (audible && bufferNs > 0 && gap > bufferNs) {
+            m_underruns.fetch_add(1, std::memory_order_relaxed);
+            Trace::instant("audio.underrun", 0, gap);
+        }
+    }
+
+    void releaseRetired()
+    {
+        const quint32 applied = m_appliedSeq.load(std::memory_order_acquire);
+        m_retired.removeIf([applied](const Retired& r) {
+            return qint32(applied - r.seq) >= 0;
+        });
+    }
+
+    qint64 rangeEnd() const
+    {
+        const qint64 total = m_pcm->frames();
+        return (m_rangeEnd < 0) ? total : std::min(m_rangeEnd, total);
+    }
+
+    // luồng audio: một mẫu đã trộn (transport + take + grain), rate lesson
+    int mixSample(qint64 total)
+    {
+        int v = transportSample(total) + takeSample();
+        for (GrainVoice& g : m_grains) {
+            if (g.pos >= g.len) continue;
+            const double w = 0.5 - 0.5 * std::cos(
+                2.0 * M_PI * double(g.pos) / double(g.len));
+            v += int(g.read.at(g.start + g.pos) * w);
+            ++g.pos;
+        }
+        return v;
+    }
+
+    // luồng audio: mẫu kế tiếp của take (0 khi không phát take)
+    int takeSample()
+    {
+        if (!m_take) return 0;
+        const qint64 k = qint64(m_takePos);
+        if (k + 1 >= m_take->frames()) {
+            m_take = nullptr;
+            return 0;
+        }
+        const double frac = m_takePos - double(k);
+        const int s0 = m_take->data()[k];
+        const int s1 = m_take->data()[k + 1];
+        m_takePos += m_takeStep;
+        return int(s0 + (s1 - s0) * frac);
+    }
+
+    // luồng audio: mẫu kế tiếp của đường phát chính (0 khi không phát)
+    int transportSample(qint64 total)
+    {
+        if (m_state != PlaybackSnapshot::Playing)
+            return 0;
+        if (m_gapLeft > 0) {
+            // drill: lặng cho người học nhắc lại, rồi sang đoạn kế tiếp
+            if (--m_gapLeft > 0 || !nextSegment())
+                return 0;
+        }
+        const qint64 end = rangeEnd();
+        if (m_cursor >= double(end)) {
+            if (m_drillTag >= 0) {
+                m_cursor = double(end);
+                m_gapLeft = m_drillGap;
+                if (m_gapLeft > 0 || !nextSegment())
+                    return 0;
+            }
+            else if (m_loop && end > m_rangeBegin) {
+                m_cursor = double(m_rangeBegin);
+                Trace::instant("audio.wrap", 0, m_rangeBegin);
+            }
+            else {
+                m_state = PlaybackSnapshot::Stopped;
+                m_cursor = double(end);
+                return 0;
+            }
+        }
+        const qint64 k = qint64(m_cursor);
+        const double frac = m_cursor - double(k);
+        const int s0 = m_read.at(k);
+        const int s1 = (k + 1 < total) ? m_read.at(k + 1) : s0;
+        m_cursor += m_rate;
+        const int v = int(s0 + (s1 - s0) * frac);
+        return m_gains ? applyGain(k, v) : v;
+    }
+
+    // luồng audio: gain của câu chứa frame. Phát tuần tự chỉ so hai mốc
+    // của đoạn hiện tại; ra khỏi đoạn (sang câu, seek, loop) mới tìm lại.
+    // Đổi gain thì trượt dần ~5 ms để không lách cách.
+    int applyGain(qint64 frame, int v)
+    {
+        if (frame < m_gainF0 || frame >= m_gainF1)
+            locateGain(frame);
+        if (m_gainQ12 != m_gainTarget)
+            m_gainQ12 += std::clamp(m_gainTarget - m_gainQ12,
+                -kGainRampStep, kGainRampStep);
+        return (v * m_gainQ12) >> 12;
+    }
+
+    struct DrillSegment
+    {
+        qint64 f0 = 0;
+        qint64 f1 = 0;
+        qint64 gap = 0;     // frame lặng sau đoạn
+        int    tag = -1;
+    };
+
+    // luồng audio: đoạn drill bắt đầu phát từ mẫu kế tiếp
+    void startSegment(const DrillSegment& seg)
+    {
+        m_rangeBegin = seg.f0;
+        m_rangeEnd = seg.f1;
+        m_cursor = double(seg.f0);
+        m_loop = false;
+        m_state = PlaybackSnapshot::Playing;
+        m_drillTag = seg.tag;
+        m_drillGap = seg.gap;
+        m_gapLeft = 0;
+    }
+
+    // false (và dừng) khi hàng đợi drill đã hết
+    bool nextSegment()
+    {
+        if (m_drillPending == 0) {
+            endDrill();
+            m_state = PlaybackSnapshot::Stopped;
+            return false;
+        }
+        const DrillSegment seg = m_drillQueue[0];
+        std::move(m_drillQueue.begin() + 1,
+            m_drillQueue.begin() + m_drillPending, m_drillQueue.begin());
+        --m_drillPending;
+        startSegment(seg);
+        Trace::instant("audio.drill", 0, seg.tag);
+        return true;
+    }
+
+    void endDrill()
+    {
+        m_drillTag = -1;
+        m_drillPending = 0;
+        m_drillGap = 0;
+        m_gapLeft = 0;
+    }
+
+    void locateGain(qint64 frame)
+    {
+        const GainMap& map = *m_gains;
+        auto it = std::upper_bound(map.cbegin(), map.cend(), frame,
+            [](qint64 f, const GainSpan& g) { return f < g.f0; });
+        if (it != map.cbegin() && frame < (it - 1)->f1) {
+            --it;
+            m_gainF0 = it->f0;
+            m_gainF1 = it->f1;
+            m_gainTarget = int(std::lround(it->gain * kGainOne));
+        }
+        else {
+            m_gainF0 = it == map.cbegin() ? 0 : (it - 1)->f1;
+            m_gainF1 = it == map.cend()
+                ? std::numeric_limits<qint64>::max() : it->f0;
+            m_gainTarget = kGainOne;
+        }
+        if (!m_normalize)
+            m_gainTarget = kGainOne;
+    }
 
-//===================== Data model =====================
+    void apply(const AudioCommand& c)
+    {
+        const qint64 total = m_pcm->frames();
+        switch (c.type) {
+        case AudioCommand::PlayRange:
+            endDrill();
+            m_rangeBegin = std::clamp<qint64>(c.a, 0, total);
+            m_rangeEnd = c.b;
+            m_loop = c.value != 0.0;
+            m_cursor = double(m_rangeBegin);
+            m_state = PlaybackSnapshot::Playing;
+            break;
+        case AudioCommand::Play:
+            if (m_state == PlaybackSnapshot::Paused) {
+                m_state = PlaybackSnapshot::Playing;
+                break;
+            }
+            endDrill();
+            if (m_cursor >= double(total)) m_cursor = 0.0;
+            m_rangeBegin = qint64(m_cursor);
+            m_rangeEnd = -1;
+            m_loop = false;
+            m_state = PlaybackSnapshot::Playing;
+            break;
+        case AudioCommand::Pause:
+            if (m_state == PlaybackSnapshot::Playing)
+                m_state = PlaybackSnapshot::Paused;
+            break;
+        case AudioCommand::TogglePause:
+            if (m_state == PlaybackSnapshot::Playing)
+                m_state = PlaybackSnapshot::Paused;
+            else if (m_state == PlaybackSnapshot::Paused)
+                m_state = PlaybackSnapshot::Playing;
+            break;
+        case AudioCommand::Stop:
+            endDrill();
+            m_state = PlaybackSnapshot::Stopped;
+            break;
+        case AudioCommand::Seek: {
+            endDrill();
+            const qint64 f = std::clamp<qint64>(c.a, 0, total);
+            // seek ra ngoài đoạn đang phát thì nới đoạn
+            if (f < m_rangeBegin) m_rangeBegin = f;
+            if (f >= rangeEnd()) m_rangeEnd = -1;
+            m_cursor = double(f);
+            break;
+        }
+        case AudioCommand::SetLoop:
+            m_loop = c.value != 0.0;
+            break;
+        case AudioCommand::SetRate:
+            m_rate = std::clamp(c.value, 0.25, 4.0);
+            break;
+        case AudioCommand::Grain: {
+            // thay voice đã phát xa nhất; grain cách nhau nửa độ dài thì
+            // hai cửa sổ Hann chồng 50% cộng lại phẳng
+            GrainVoice* g = &m_grains[0];
+            for (GrainVoice& v : m_grains) {
+                if (v.progress() > g->progress()) g = &v;
+            }
+            const qint64 len = std::min(total,
+                qint64(m_pcm->sampleRate * kGrainSec));
+            g->start = std::clamp<qint64>(c.a - len / 2, 0, total - len);
+            g->len = len;
+            g->pos = 0;
+            break;
+        }
+        case AudioCommand::PlayTake:
+            // take thu ở rate của micro, phát ra ở rate của lesson
+            m_take = c.take;
+            m_takePos = 0.0;
+            m_takeStep = double(c.take->sampleRate) / m_pcm->sampleRate;
+            break;
+        case AudioCommand::StopTake:
+            m_take = nullptr;
+            break;
+        case AudioCommand::SetGains:
+            m_gains = c.gains;
+            m_gainF0 = 0;
+            m_gainF1 = -1;      // tìm lại ở mẫu kế tiếp
+            break;
+        case AudioCommand::SetNormalize:
+            m_normalize = c.value != 0.0;
+            m_gainF0 = 0;
+            m_gainF1 = -1;
+            break;
+        case AudioCommand::QueueSegment: {
+            DrillSegment seg;
+            seg.f0 = std::clamp<qint64>(c.a, 0, total);
+            seg.f1 = std::clamp<qint64>(c.b, seg.f0, total);
+            seg.gap = qint64(std::max(0.0, c.value) * m_pcm->sampleRate);
+            seg.tag = c.tag;
+            if (m_drillTag < 0 || m_state == PlaybackSnapshot::Stopped)
+                startSegment(seg);
+            else if (m_drillPending < int(m_drillQueue.size()))
+                m_drillQueue[m_drillPending++] = seg;
+            break;
+        }
+        }
+        m_appliedSeq.store(c.seq, std::memory_order_release);
+        if (c.flow) {
+            Trace::instant("audio.apply", c.flow, c.type);
+            // lệnh làm tiếng phát ra: báo "audio.out" ở đầu buffer này
+            // (SetRate/SetLoop/Grain cùng thao tác không tính)
+            const bool starts = c.type == AudioCommand::PlayRange
+                || c.type == AudioCommand::QueueSegment
+                || c.type == AudioCommand::Play
+                || c.type == AudioCommand::TogglePause
+                || c.type == AudioCommand::Seek;
+            if ((starts && m_state == PlaybackSnapshot::Playing)
+                || c.type == AudioCommand::PlayTake)
+                m_outFlow = c.flow;
+        }
+    }
 
-struct Sentence
-{
-    int     id = 0;
-    double  begin = -1.0;    // seconds, <0 = undefined
-    double  end = -1.0;
-    QString text;
-    bool    confirm = false;
+    void publish()
+    {
+        const quint32 seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_pubState.store(int(m_state), std::memory_order_relaxed);
+        m_pubFrame.store(qint64(m_cursor), std::memory_order_relaxed);
+        m_pubRangeBegin.store(m_rangeBegin, std::memory_order_relaxed);
+        m_pubRangeEnd.store(hasSource() ? rangeEnd() : 0,
+            std::memory_order_relaxed);
+        m_pubLoop.store(m_loop, std::memory_order_relaxed);
+        m_pubRate.store(m_rate, std::memory_order_relaxed);
+        m_pubSampleRate.store(hasSource() ? m_pcm->sampleRate : 0,
+            std::memory_order_relaxed);
+        m_pubDrillTag.store(m_drillTag, std::memory_order_relaxed);
+        m_pubDrillPending.store(m_drillPending, std::memory_order_relaxed);
+        m_pubNs.store(steadyNowNs(), std::memory_order_relaxed);
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    struct Retired
+    {
+        quint32 seq = 0;    // lệnh đã thay take / bảng gain này
+        QSharedPointer<const void> data;
+    };
+
+    // GUI thread
+    QSharedPointer<const PcmData> m_pcm;
+    SpscQueue<AudioCommand, 64>   m_commands;
+    quint32                       m_sendSeq = 0;
+    QSharedPointer<const PcmData> m_takeHold;
+    QSharedPointer<const GainMap> m_gainsHold;
+    QVector<Retired>              m_retired;
+    bool                          m_wantNormalize = true;
+    std::atomic<quint32>          m_appliedSeq{ 0 };
+
+    // luồng audio: sink và device được tạo, chạy và huỷ trên m_thread
+    QThread                       m_thread;
+    QObject                       m_context;    // sống trên m_thread
+    std::unique_ptr<QAudioSink>   m_sink;
+    std::unique_ptr<Device>       m_device;
+
+    struct GrainVoice
+    {
+        qint64 start = 0;
+        qint64 len = 0;
+        qint64 pos = 0;
+        PcmCursor read;     // grain xa đường chính → khối riêng
+        double progress() const
+        {
+            return len > 0 ? double(pos) / double(len) : 1.0;
+        }
+    };
+
+    static constexpr int    kSinkBufferMs = 15;
+    static constexpr int    kSafeBufferMs = 45;     // sau khi đã underrun
+    static constexpr double kGrainSec = 0.15;
+    static constexpr int    kResampleChunk = 256;
+    static constexpr int    kGainOne = 1 << 12;     // Q12; gain tối đa 4x
+    static constexpr int    kGainRampStep = 16;     // 1x→2x trong 256 mẫu
+
+    // luồng audio (hoặc GUI khi sink đã dừng)
+    PcmCursor m_read;           // đường phát chính
+    Resampler m_resampler;      // rate lesson → rate sink
+    std::vector<float> m_mixOut;
+    std::array<GrainVoice, 2> m_grains;
+    const PcmData* m_take = nullptr;
+    const GainMap* m_gains = nullptr;
+    bool   m_normalize = true;
+    qint64 m_gainF0 = 0;        // đoạn của m_gainTarget
+    qint64 m_gainF1 = -1;
+    int    m_gainTarget = kGainOne;
+    int    m_gainQ12 = kGainOne;
+    quint32 m_outFlow = 0;      // thao tác chờ ghi "audio.out"
+    double m_takePos = 0.0;
+    double m_takeStep = 1.0;
+    PlaybackSnapshot::State m_state = PlaybackSnapshot::Stopped;
+    double m_cursor = 0.0;      // frame, có phần lẻ khi rate != 1
+    qint64 m_rangeBegin = 0;
+    qint64 m_rangeEnd = -1;
+    bool   m_loop = false;
+    double m_rate = 1.0;
+    std::array<DrillSegment, 4> m_drillQueue;   // đoạn drill chờ phát
+    int    m_drillPending = 0;
+    int    m_drillTag = -1;     // đoạn drill đang phát, -1 = không drill
+    qint64 m_drillGap = 0;      // lặng sau đoạn đang phát
+    qint64 m_gapLeft = 0;       // > 0: đang trong khoảng lặng
+
+    // bản công bố (seqlock)
+    std::atomic<quint32> m_seq{ 0 };
+    std::atomic<int>     m_pubState{ 0 };
+    std::atomic<qint64>  m_pubFrame{ 0 };
+    std::atomic<qint64>  m_pubRangeBegin{ 0 };
+    std::atomic<qint64>  m_pubRangeEnd{ 0 };
+    std::atomic<bool>    m_pubLoop{ false };
+    std::atomic<double>  m_pubRate{ 1.0 };
+    std::atomic<int>     m_pubSampleRate{ 0 };
+    std::atomic<qint64>  m_pubNs{ 0 };
+    std::atomic<int>     m_latencyFrames{ 0 };
+    std::atomic<int>     m_pubDrillTag{ -1 };
+    std::atomic<int>     m_pubDrillPending{ 0 };
+
+    // số liệu cho HUD (luồng audio ghi, GUI đọc)
+    qint64 m_lastRenderNs = 0;
+    std::atomic<qint64>  m_callbacks{ 0 };
+    std::atomic<qint64>  m_underruns{ 0 };
+    std::atomic<qint64>  m_maxRenderNs{ 0 };
+    std::atomic<qint64>  m_maxGapNs{ 0 };
 };
 
-//===================== Helpers =====================
+// Gộp seek khi giữ phím mũi tên: mỗi auto-repeat chỉ dời đích, lệnh Seek
+// gửi ngay ở lần đầu rồi tối đa một lệnh mỗi chu kỳ audio. Khi lệnh trước
+// chưa được áp dụng, bước kế tiếp tính từ đích chứ không từ playhead (còn
+// cũ) nên không bị giật lùi. Giữ lâu thì bước nhân đôi dần tới kMaxAccel.
+class SeekCoalescer
+{
+public:
+    explicit SeekCoalescer(AudioEngine* engine) : m_engine(engine)
+    {
+        m_timer.setSingleShot(true);
+        m_timer.setTimerType(Qt::PreciseTimer);
+        m_timer.setInterval(AudioEngine::periodMs());
+        QObject::connect(&m_timer, &QTimer::timeout, [this]() {
+            if (m_dirty) flush();
+        });
+    }
+
+    // một lần nhấn hoặc auto-repeat; dir = ±1, duration <= 0 = chưa biết
+    void nudge(int dir, bool autoRepeat, double duration)
+    {
+        const qint64 now = steadyNowNs();
+        if (!autoRepeat) m_holdStartNs = now;
+        const double held = (now - m_holdStartNs) / 1e9;
+        const double accel = std::min(kMaxAccel,
+            std::exp2(std::max(0.0, held - kAccelDelaySec) / kDoublingSec));
+
+        const bool inFlight = m_dirty || !m_engine->isApplied(m_lastSeq);
+        const double base = inFlight ? m_target : m_engine->playhead();
+        m_target = std::max(0.0, base + dir * kStepSec * accel);
+        if (duration > 0.0) m_target = std::min(m_target, duration);
+
+        m_dirty = true;
+        if (!m_timer.isActive()) flush();
+    }
+
+private:
+    void flush()
+    {
+        TraceFlow flow("ui.seek");
+        m_lastSeq = m_engine->seek(m_target);
+        m_dirty = false;
+        m_timer.start();
+    }
+
+    static constexpr double kStepSec = 0.3;
+    static constexpr double kAccelDelaySec = 0.4;   // giữ ngắn: bước đều
+    static constexpr double kDoublingSec = 0.5;
+    static constexpr double kMaxAccel = 256.0;      // ~77 s mỗi repeat
+
+    AudioEngine* m_engine;
+    QTimer  m_timer;
+    double  m_target = 0.0;
+    bool    m_dirty = false;
+    quint32 m_lastSeq = 0;
+    qint64  m_holdStartNs = 0;
+};
 
-static QString formatTime(double sec)
+// Loại thao tác cho báo cáo độ trễ: đổi câu, phát lại câu đang lặp
+// (loop restart) hay phát thường
+static const char* playTraceName(int prevRow, int row, bool loop)
 {
-    if (sec < 0) return QString();
-    int msec = int(std::round(sec * 1000.0));
-    int minutes = msec / 60000;
-    msec -= minutes * 60000;
-    int seconds = msec / 1000;
-    msec -= seconds * 1000;
-    return QString("%1:%2.%3")
-        .arg(minutes, 2, 10, QLatin1Char('0'))
-        .arg(seconds, 2, 10, QLatin1Char('0'))
-        .arg(msec, 3, 10, QLatin1Char('0'));
+    if (row != prevRow) return "ui.sentence";
+    return loop ? "ui.loop" : "ui.play";
 }
 
-static double parseTime(const QString& s)
+// Drill "nghe – nhắc lại": câu N, khoảng lặng theo độ dài câu (đã tính tốc
+// độ phát), rồi N+1... Engine tự nối các đoạn trong callback nên chuyển
+// câu khớp từng mẫu; lớp này chỉ giữ sẵn một đoạn chờ sau đoạn đang phát.
+// Mỗi đoạn (câu + lặng) dài hơn nhiều so với chu kỳ poll, nên GUI bận một
+// lúc cũng không làm hụt nhịp.
+class DrillScheduler
+{
+public:
+    using RowHandler = std::function<void(int row)>;
+    using EndHandler = std::function<void(bool finished)>;  // false = bị huỷ
+
+    DrillScheduler(AudioEngine* engine, const LessonDocument* doc)
+        : m_engine(engine), m_doc(doc)
+    {
+        m_timer.setInterval(kPollMs);
+        QObject::connect(&m_timer, &QTimer::timeout, [this]() { poll(); });
+    }
+
+    // câu đang phát đổi (GUI chọn theo)
+    void setRowHandler(RowHandler h) { m_onRow = std::move(h); }
+    void setEndHandler(EndHandler h) { m_onEnd = std::move(h); }
+
+    // lặng = factor × độ dài câu ở tốc độ phát + thời gian phản xạ;
+    // 0 = không chờ. Áp cho các câu xếp sau đó.
+    void setGapFactor(double factor) { m_gapFactor = std::max(0.0, factor); }
+    void setRate(double rate) { m_rate = std::clamp(rate, 0.25, 4.0); }
+
+    bool isActive() const { return m_timer.isActive(); }
+
+    // false nếu từ row trở đi không còn câu có thời gian hợp lệ
+    bool start(int row)
+    {
+        stop();
+        m_nextRow = std::max(0, row);
+        m_shownRow = -1;
+        if (!queueNext()) return false;
+        m_startSeq = m_lastSeq;
+        queueNext();
+        m_timer.start();
+        return true;
+    }
+
+    void stop()
+    {
+        if (!m_timer.isActive()) return;
+        m_timer.stop();
+        m_engine->stop();
+    }
+
+private:
+    void poll()
+    {
+        if (!m_engine->isApplied(m_startSeq)) return;
+        const PlaybackSnapshot snap = m_engine->snapshot();
+        if (snap.drillTag < 0) {
+            // engine hết hàng và tự dừng, hoặc lệnh khác đã huỷ drill
+            m_timer.stop();
+            const bool finished = m_nextRow >= m_doc->sentences.size()
+                && snap.state == PlaybackSnapshot::Stopped;
+            if (m_onEnd) m_onEnd(finished);
+            return;
+        }
+        if (snap.drillTag != m_shownRow) {
+            m_shownRow = snap.drillTag;
+            if (m_onRow) m_onRow(m_shownRow);
+        }
+        if (snap.drillPending == 0 && m_engine->isApplied(m_lastSeq))
+            queueNext();
+    }
+
+    bool queueNext()
+    {
+        const QVector<Sentence>& sents = m_doc->sentences;
+        while (m_nextRow < sents.size()) {
+            const Sentence& s = sents[m_nextRow];
+            if (s.begin < 0.0 || s.end <= s.begin) {
+                ++m_nextRow;
+                continue;
+            }
+            const double gap = m_gapFactor > 0.0
+                ? kReactionSec + m_gapFactor * (s.end - s.begin) / m_rate
+                : 0.0;
+            const quint32 seq = m_engine->queueSegment(s.begin, s.end, gap,
+                m_nextRow);
+            if (seq == 0) return false;     // hàng lệnh đầy: lần poll sau
+            m_lastSeq = seq;
+            ++m_nextRow;
+            return true;
+        }
+        return false;
+    }
+
+    static constexpr int    kPollMs = 50;
+    static constexpr double kReactionSec = 0.4;
+
+    AudioEngine*          m_engine;
+    const LessonDocument* m_doc;
+    QTimer     m_timer;
+    RowHandler m_onRow;
+    EndHandler m_onEnd;
+    double     m_gapFactor = 1.0;
+    double     m_rate = 1.0;
+    int        m_nextRow = 0;       // câu sẽ xếp tiếp
+    int        m_shownRow = -1;
+    quint32    m_startSeq = 0;
+    quint32    m_lastSeq = 0;
+};
+
+//===================== Learner recording =====================
+
+// Ring buffer mẫu một producer / một consumer, ghi/đọc theo khối.
+// Chỉ số head/tail tăng mãi (quint32 tràn vòng vẫn đúng), dung lượng 2^k.
+class SampleRing
+{
+public:
+    explicit SampleRing(int capacityPow2)
+        : m_buf(capacityPow2), m_mask(quint32(capacityPow2 - 1)) {}
+
+    // producer: trả số mẫu đã ghi (đầy thì bỏ phần dư)
+    int write(const qint16* src, int n)
+    {
+        const quint32 head = m_head.load(std::memory_order_relaxed);
+        const quint32 tail = m_tail.load(std::memory_order_acquire);
+        const int room = int(m_mask + 1 - (head - tail));
+        n = std::min(n, room);
+        for (int i = 0; i < n; ++i)
+            m_buf[int((head + quint32(i)) & m_mask)] = src[i];
+        m_head.store(head + quint32(n), std::memory_order_release);
+        return n;
+    }
+
+    // consumer
+    int read(qint16* dst, int n)
+    {
+        const quint32 tail = m_tail.load(std::memory_order_relaxed);
+        const quint32 head = m_head.load(std::memory_order_acquire);
+        n = std::min(n, int(head - tail));
+        for (int i = 0; i < n; ++i)
+            dst[i] = m_buf[int((tail + quint32(i)) & m_mask)];
+        m_tail.store(tail + quint32(n), std::memory_order_release);
+        return n;
+    }
+
+    // chỉ gọi khi không còn producer
+    void clear()
+    {
+        m_tail.store(m_head.load(std::memory_order_acquire),
+            std::memory_order_release);
+    }
+
+private:
+    std::vector<qint16> m_buf;
+    quint32 m_mask;
+    std::atomic<quint32> m_head{ 0 };
+    std::atomic<quint32> m_tail{ 0 };
+};
+
+// Thu micro cho một câu. QAudioSource chạy trên luồng riêng (như sink của
+// AudioEngine) và đẩy mẫu vào Device → ring buffer (không cấp phát, không
+// khoá); GUI chỉ là consumer, rút ring mỗi 20 ms và khi dừng, nên GUI bận
+// một lúc cũng không mất mẫu. Take trả về là PCM mono Int16 đã cắt lặng
+// hai đầu, dùng ngay được cho AudioEngine::playTake() – không qua
+// file/encode.
+class Recorder
+{
+public:
+    Recorder()
+    {
+        m_thread.setObjectName("mic");
+        m_context.moveToThread(&m_thread);
+        m_thread.start(QThread::TimeCriticalPriority);
+        m_drainTimer.setInterval(20);
+        QObject::connect(&m_drainTimer, &QTimer::timeout,
+            [this]() { drain(); });
+    }
+
+    ~Recorder()
+    {
+        onMicThread([this] { closeSource(); });
+        m_thread.quit();
+        m_thread.wait();
+    }
+
+    bool isRecording() const { return m_recording; }
+
+    // ưu tiên đúng rate của lesson; micro không hỗ trợ thì thu ở rate của
+    // nó rồi đổi về rate lesson, để take phát không cần nội suy
+    bool start(int preferredRate)
+    {
+        if (m_recording) return true;
+        const QAudioDevice dev = QMediaDevices::defaultAudioInput();
+        if (dev.isNull()) return false;
+
+        QAudioFormat fmt;
+        fmt.setSampleRate(preferredRate > 0 ? preferredRate
+            : dev.preferredFormat().sampleRate());
+        fmt.setChannelCount(1);
+        fmt.setSampleFormat(QAudioFormat::Int16);
+        if (!dev.isFormatSupported(fmt))
+            fmt.setSampleRate(dev.preferredFormat().sampleRate());
+        if (!dev.isFormatSupported(fmt)) return false;
+
+        m_rate = fmt.sampleRate();
+        // micro không thu được đúng rate lesson: resample ngay khi rút ring
+        m_outRate = preferredRate > 0 ? preferredRate : m_rate;
+        m_resampler.configure(m_rate, m_outRate);
+        m_resampled.assign(size_t(m_resampler.maxOutputFor(kDrainChunk)), 0.0f);
+        m_samples.clear();
+        m_ring.clear();     // chưa có producer
+        bool ok = false;
+        onMicThread([&] { ok = openSource(dev, fmt); });
+        if (!ok) return false;
+        m_recording = true;
+        m_drainTimer.start();
+        return true;
+    }
+
+    QSharedPointer<const PcmData> stop()
+    {
+        if (!m_recording) return {};
+        // source dừng trên luồng của nó; sau đó rút nốt phần còn trong ring
+        onMicThread([this] { closeSource(); });
+        m_recording = false;
+        m_drainTimer.stop();
+        drain();
+
+        auto take = QSharedPointer<PcmData>::create();
+        take->sampleRate = m_outRate;
+        take->samples = trimSilence(m_samples);
+        m_samples = QVector<qint16>();
+        return take;
+    }
+
+private:
+    class Device : public QIODevice
+    {
+    public:
+        explicit Device(Recorder* rec) : m_rec(rec) {}
+        bool isSequential() const override { return true; }
+
+    protected:
+        qint64 readData(char*, qint64) override { return -1; }
+        qint64 writeData(const char* data, qint64 len) override
+        {
+            m_rec->m_ring.write(reinterpret_cast<const qint16*>(data),
+                int(len / qint64(sizeof(qint16))));
+            return len;     // ring đầy thì bỏ, không chặn luồng audio
+        }
+
+    private:
+        Recorder* m_rec;
+    };
+
+    // luồng mic: source và device được tạo, chạy và huỷ ở đây
+    bool openSource(const QAudioDevice& dev, const QAudioFormat& fmt)
+    {
+        m_source = std::make_unique<QAudioSource>(dev, fmt);
+        m_source->setBufferSize(qsizetype(m_rate / 100)
+            * qsizetype(sizeof(qint16)));   // ~10 ms
+        m_device = std::make_unique<Device>(this);
+        m_device->open(QIODevice::WriteOnly);
+        m_source->start(m_device.get());
+        if (m_source->error() != QAudio::NoError) {
+            closeSource();
+            return false;
+        }
+        return true;
+    }
+
+    void closeSource()
+    {
+        if (m_source) {
+            m_source->stop();
+            m_source.reset();
+        }
+        m_device.reset();
+    }
+
+    // Chạy fn trên luồng mic và chờ xong (chỉ khi mở/đóng source)
+    template <typename Fn>
+    void onMicThread(Fn fn)
+    {
+        QMetaObject::invokeMethod(&m_context, fn,
+            Qt::BlockingQueuedConnection);
+    }
+
+    void drain()
+    {
+        qint16 buf[kDrainChunk];
+        float in[kDrainChunk];
+        const qsizetype maxSamples = qsizetype(m_outRate) * kMaxTakeSec;
+        for (int n; (n = m_ring.read(buf, kDrainChunk)) > 0;) {
+            const qsizetype room = maxSamples - m_samples.size();
+            if (room <= 0) continue;
+            if (m_resampler.isPassthrough()) {
+                const qsizetype k = std::min<qsizetype>(n, room);
+                const qsizetype at = m_samples.size();
+                m_samples.resize(at + k);
+                std::copy_n(buf, k, m_samples.data() + at);
+                continue;
+            }
+            for (int i = 0; i < n; ++i) in[i] = buf[i];
+            const int m = m_resampler.process(in, n, m_resampled.data());
+            for (qsizetype i = 0; i < std::min<qsizetype>(m, room); ++i)
+                m_samples.push_back(qint16(std::lrint(
+                    std::clamp(m_resampled[i], -32768.0f, 32767.0f))));
+        }
+    }
+
+    // bỏ lặng đầu/cuối (dưới 5% đỉnh), chừa 50 ms mỗi bên
+    QVector<qint16> trimSilence(const QVector<qint16>& x) const
+    {
+        int peak = 0;
+        for (qint16 v : x) peak = std::max(peak, std::abs(int(v)));
+        const int thr = std::max(300, peak / 20);
+        qsizetype b = 0, e = x.size();
+        while (b < e && std::abs(int(x[b])) < thr) ++b;
+        while (e > b && std::abs(int(x[e - 1])) < thr) --e;
+        if (b >= e) return {};
+        const qsizetype margin = m_outRate / 20;
+        b = std::max<qsizetype>(0, b - margin);
+        e = std::min<qsizetype>(x.size(), e + margin);
+        return x.mid(b, e - b);
+    }
+
+    static constexpr int kMaxTakeSec = 60;
+    static constexpr int kDrainChunk = 1024;
+
+    // luồng mic; m_source và m_device chỉ chạm tới trên m_thread
+    QThread     m_thread;
+    QObject     m_context;      // sống trên m_thread
+    std::unique_ptr<QAudioSource> m_source;
+    std::unique_ptr<Device> m_device;
+    bool        m_recording = false;
+    SampleRing  m_ring{ 1 << 16 };
+    QTimer      m_drainTimer;
+    QVector<qint16> m_samples;
+    int         m_rate = 0;         // rate micro
+    int         m_outRate = 0;      // rate của take (= lesson nếu có)
+    Resampler   m_resampler;
+    std::vector<float> m_resampled;
+};
+
+//===================== Spectrogram =====================
+
+// FFT radix-2 tại chỗ trên mảng re/im tách rời. Twiddle của từng tầng
+// nằm liền nhau nên vòng lặp trong không có gather/phụ thuộc và compiler
+// tự vector hoá (SSE/AVX/NEON) được. n phải là luỹ thừa của 2.
+class Fft
 {
-    QString t = s.trimmed();
-    if (t.isEmpty()) return -1.0;
-    QStringList parts = t.split(':');
-    if (parts.size() != 2) return -1.0;
+public:
+    explicit Fft(int n) : m_n(n), m_rev(n)
+    {
+        int bits = 0;
+        while ((1 << bits) < n) ++bits;
+        for (int i = 0; i < n; ++i) {
+            int r = 0;
+            for (int b = 0; b < bits; ++b)
+                if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+            m_rev[i] = r;
+        }
+        for (int len = 2; len <= n; len <<= 1) {
+            const int half = len / 2;
+            for (int k = 0; k < half; ++k) {
+                const double a = -2.0 * M_PI * k / len;
+                m_twRe.push_back(float(std::cos(a)));
+                m_twIm.push_back(float(std::sin(a)));
+            }
+        }
+    }
+
+    void forward(float* re, float* im) const
+    {
+        for (int i = 0; i < m_n; ++i) {
+            const int j = m_rev[i];
+            if (j > i) {
+                std::swap(re[i], re[j]);
+                std::swap(im[i], im[j]);
+            }
+        }
+        int tw = 0;
+        for (int len = 2; len <= m_n; len <<= 1) {
+            const int half = len / 2;
+            const float* wr = m_twRe.constData() + tw;
+            const float* wi = m_twIm.constData() + tw;
+            for (int i = 0; i < m_n; i += len) {
+                float* ar = re + i;
+                float* ai = im + i;
+                float* br = ar + half;
+                float* bi = ai + half;
+                for (int k = 0; k < half; ++k) {
+                    const float tr = br[k] * wr[k] - bi[k] * wi[k];
+                    const float ti = br[k] * wi[k] + bi[k] * wr[k];
+                    br[k] = ar[k] - tr;
+                    bi[k] = ai[k] - ti;
+                    ar[k] += tr;
+                    ai[k] += ti;
+                }
+            }
+            tw += half;
+        }
+    }
 
-    bool ok1 = false, ok2 = false;
-    int minutes = parts[0].toInt(&ok1);
-    double secFloat = parts[1].toDouble(&ok2);
-    if (!ok1 || !ok2) return -1.0;
+private:
+    int m_n;
+    QVector<int> m_rev;
+    QVector<float> m_twRe;
+    QVector<float> m_twIm;
+};
 
-    return minutes * 60.0 + secFloat;
+// Tile spectrogram: kSpecTileCols cột × kSpecBins bin, 8 bit dB.
+// Mức zoom L: cột cách nhau kSpecHop·2^L frame (FFT 1024 điểm đặt thưa ra
+// chứ không gộp cột mức dưới), nên chi phí một tile không đổi theo mức.
+static constexpr int kSpecFft = 1024;
+static constexpr int kSpecHop = 256;
+static constexpr int kSpecBins = kSpecFft / 2;
+static constexpr int kSpecTileCols = 256;
+static constexpr int kSpecMaxLevel = 16;
+static constexpr double kSpecFloorDb = -90.0;
+
+static QVector<QRgb> spectrogramPalette()
+{
+    // đen → tím → đỏ cam → vàng nhạt (kiểu "magma")
+    static const QColor stops[] = {
+        QColor(0, 0, 4), QColor(80, 18, 123), QColor(200, 60, 80),
+        QColor(252, 160, 40), QColor(252, 253, 191)
+    };
+    QVector<QRgb> lut(256);
+    for (int i = 0; i < 256; ++i) {
+        const double f = i / 255.0 * 4.0;
+        const int k = std::min(3, int(f));
+        const double u = f - k;
+        const QColor& a = stops[k];
+        const QColor& b = stops[k + 1];
+        lut[i] = qRgb(int(a.red() + (b.red() - a.red()) * u),
+            int(a.green() + (b.green() - a.green()) * u),
+            int(a.blue() + (b.blue() - a.blue()) * u));
+    }
+    return lut;
 }
 
-static int countWords(const QString& s)
+static QImage computeSpectrogramTile(const PcmData& pcm, int level,
+    qint64 index)
 {
-    QStringList words =
-        s.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
-    return words.size();
+    static const QVector<QRgb> palette = spectrogramPalette();
+    QImage img(kSpecTileCols, kSpecBins, QImage::Format_Indexed8);
+    img.setColorTable(palette);
+
+    const Fft fft(kSpecFft);
+    QVector<float> win(kSpecFft), re(kSpecFft), im(kSpecFft);
+    for (int j = 0; j < kSpecFft; ++j)
+        win[j] = float(0.5 - 0.5 * std::cos(2.0 * M_PI * j / kSpecFft));
+
+    // 0 dB = sin biên độ tối đa (Hann: đỉnh phổ = A·N/4)
+    const double ref = 32768.0 * kSpecFft / 4.0;
+    const double norm = 1.0 / (ref * ref);
+
+    // mức thô: cột cách nhau xa hơn một khối, nên đọc ngẫu nhiên qua
+    // cursor chứ không giải nén cả tile
+    PcmCursor x;
+    x.reset(&pcm);
+    const qint64 total = pcm.frames();
+    const qint64 hop = qint64(kSpecHop) << level;
+    for (int col = 0; col < kSpecTileCols; ++col) {
+        const qint64 centre = (index * kSpecTileCols + col) * hop + hop / 2;
+        const qint64 start = centre - kSpecFft / 2;
+        for (int j = 0; j < kSpecFft; ++j) {
+            const qint64 k = start + j;
+            re[j] = (k >= 0 && k < total) ? x.at(k) * win[j] : 0.0f;
+            im[j] = 0.0f;
+        }
+        fft.forward(re.data(), im.data());
+
+        for (int b = 0; b < kSpecBins; ++b) {
+            const double p = (double(re[b]) * re[b] + double(im[b]) * im[b])
+                * norm;
+            const double db = 10.0 * std::log10(p + 1e-12);
+            const int v = int((db - kSpecFloorDb) / -kSpecFloorDb * 255.0);
+            img.scanLine(kSpecBins - 1 - b)[col] = uchar(std::clamp(v, 0, 255));
+        }
+    }
+    return img;
 }
 
-// Simple base splitter: split by . ? ! then trim.
-static QVector<QString> baseSplitSentences(const QString& text)
+// Thư mục cache trên đĩa cho một file audio (đổi file/mtime → thư mục mới)
+static QString spectrogramCacheDir(const QString& audioPath)
 {
-    QVector<QString> result;
-    QRegularExpression re(R"(([^.!?]+[.!?]))");
-    auto it = re.globalMatch(text);
-    while (it.hasNext()) {
-        auto m = it.next();
-        QString s = m.captured(1).trimmed();
-        if (!s.isEmpty())
-            result.push_back(s);
-    }
-    if (result.isEmpty()) {
-        QString s = text.trimmed();
-        if (!s.isEmpty())
-            result.push_back(s);
-    }
-    return result;
+    const QFileInfo fi(audioPath);
+    const QByteArray id = QString("%1|%2|%3")
+        .arg(fi.absoluteFilePath())
+        .arg(fi.size())
+        .arg(fi.lastModified().toMSecsSinceEpoch())
+        .toUtf8();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+        + "/spectrogram/"
+        + QString::fromLatin1(
+            QCryptographicHash::hash(id, QCryptographicHash::Sha1).toHex());
 }
 
-// Slightly “smarter” splitter following spec (chỉ ở mức đơn giản)
-static QVector<QString> splitTextIntoSentencesAdvanced(const QString& text)
+// Tile tính nền trên TaskPool (mọi core), đọc/ghi PNG trong thư mục
+// cache; GUI lấy tile đã xong qua collect() nên không cần signal/slot.
+// Token là con của token lesson: đổi lesson hoặc huỷ cache đều dừng task.
+class SpectrogramCache
 {
-    QVector<QString> base = baseSplitSentences(text);
-    QVector<QString> out;
+public:
+    SpectrogramCache(QSharedPointer<const PcmData> pcm, QString diskDir,
+        const CancelToken& lesson)
+        : m_pcm(std::move(pcm)), m_dir(std::move(diskDir)),
+          m_token(CancelToken::create(lesson)),
+          m_shared(QSharedPointer<Shared>::create())
+    {
+        m_tiles.setMaxCost(kMemoryBudgetKb);
+    }
 
-    const int MAX_WORDS = 25;   // ~2–4s, tuỳ tốc độ đọc
+    ~SpectrogramCache()
+    {
+        m_token.cancel();
+    }
 
-    for (QString s : base) {
-        s = s.trimmed();
-        if (s.isEmpty()) continue;
+    const QSharedPointer<const PcmData>& pcm() const { return m_pcm; }
 
-        QStringList words =
-            s.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+    // null → chưa có, đã xếp lịch tính (tile trong view: Visible,
+    // tile đón trước hai bên: Background)
+    const QImage* tile(int level, qint64 index,
+        TaskPool::Priority prio = TaskPool::Visible)
+    {
+        const quint64 key = (quint64(level) << 56) | quint64(index);
+        if (const QImage* img = m_tiles.object(key)) {
+            ++m_hits;
+            return img;
+        }
+        ++m_misses;
+        if (!m_pending.contains(key)) {
+            m_pending.insert(key);
+            schedule(level, index, key, prio);
+        }
+        return nullptr;
+    }
 
-        if (words.size() <= MAX_WORDS) {
-            out.push_back(s);
-            continue;
+    // GUI thread: nhận các tile worker đã xong; true nếu có tile mới
+    bool collect()
+    {
+        QVector<DoneTile> done;
+        {
+            QMutexLocker lock(&m_shared->mutex);
+            done.swap(m_shared->done);
         }
+        for (DoneTile& d : done) {
+            m_pending.remove(d.key);
+            const int cost = int(d.image.sizeInBytes() / 1024) + 1;
+            m_tiles.insert(d.key, new QImage(std::move(d.image)), cost);
+        }
+        return !done.isEmpty();
+    }
 
-        int start = 0;
-        for (int i = 0; i < words.size(); ++i) {
-            bool shouldSplit = false;
-            if (i - start >= MAX_WORDS / 2) {
-                QString w = words[i].toLower();
-                if (w == "and" || w == "but" || w == "because"
-                    || w == "so" || w == "however"
-                    || words[i].endsWith(',')) {
-                    shouldSplit = true;
+    struct Stats
+    {
+        qint64 hits = 0;        // tile có sẵn trong bộ nhớ
+        qint64 misses = 0;
+        qint64 diskLoads = 0;   // miss được đọc lại từ cache đĩa
+        qint64 computed = 0;    // miss phải tính FFT
+        int    tiles = 0;
+        int    kb = 0;
+        int    pending = 0;
+    };
+
+    Stats stats() const
+    {
+        Stats s;
+        s.hits = m_hits;
+        s.misses = m_misses;
+        s.diskLoads = m_shared->diskLoads.load(std::memory_order_relaxed);
+        s.computed = m_shared->computed.load(std::memory_order_relaxed);
+        s.tiles = int(m_tiles.count());
+        s.kb = int(m_tiles.totalCost());
+        s.pending = int(m_pending.size());
+        return s;
+    }
+
+private:
+    struct DoneTile
+    {
+        quint64 key = 0;
+        QImage  image;
+    };
+
+    struct Shared
+    {
+        QMutex mutex;
+        QVector<DoneTile> done;
+        std::atomic<qint64> diskLoads{ 0 };
+        std::atomic<qint64> computed{ 0 };
+    };
+
+    void schedule(int level, qint64 index, quint64 key,
+        TaskPool::Priority prio)
+    {
+        TaskPool::instance().submit(
+            [shared = m_shared, pcm = m_pcm, dir = m_dir,
+             level, index, key]() {
+                const QString file =
+                    dir + QString("/L%1_%2.png").arg(level).arg(index);
+                QImage img;
+                if (!img.load(file) || img.width() != kSpecTileCols
+                    || img.height() != kSpecBins) {
+                    img = computeSpectrogramTile(*pcm, level, index);
+                    QDir().mkpath(dir);
+                    img.save(file);
+                    shared->computed.fetch_add(1, std::memory_order_relaxed);
                 }
-            }
-            if (shouldSplit) {
-                QString seg = words.mid(start, i - start + 1).join(" ");
-                out.push_back(seg.trimmed());
-                start = i + 1;
-            }
+                else {
+                    shared->diskLoads.fetch_add(1, std::memory_order_relaxed);
+                }
+                QMutexLocker lock(&shared->mutex);
+                shared->done.push_back({ key, std::move(img) });
+            }, prio, m_token);
+    }
+
+    static constexpr int kMemoryBudgetKb = 32 * 1024;
+
+    QSharedPointer<const PcmData> m_pcm;
+    QString m_dir;
+    CancelToken m_token;
+    QSharedPointer<Shared> m_shared;
+    QCache<quint64, QImage> m_tiles;
+    QSet<quint64> m_pending;
+    qint64 m_hits = 0;
+    qint64 m_misses = 0;
+};
+
+//===================== Take scoring =====================
+
+// So take của người học với câu mẫu, không cần ASR: trích đặc trưng phổ
+// cho cả hai, căn thời gian bằng DTW rồi đọc ra lệch tempo/nhịp theo từ.
+// Khung 10 ms, cửa sổ 25 ms; mỗi khung là c1..c12 MFCC đã trừ trung bình
+// (CMN – bớt khác biệt giọng/micro) + log năng lượng, đệm tới kFeatDim float
+// để khoảng cách là vòng lặp độ dài cố định mà compiler vector hoá được.
+static constexpr int kFeatDim = 16;
+static constexpr int kMfcc = 12;
+static constexpr int kMelBands = 26;
+static constexpr float kFeatFloorDb = -35.0f;   // dưới mức này coi là lặng
+
+struct FeatureTrack
+{
+    double frameSec = 0.01;
+    int frames = 0;
+    QVector<float> v;           // frames × kFeatDim
+    QVector<float> levelDb;     // 0 dB = khung to nhất
+
+    const float* frame(int i) const { return v.constData() + i * kFeatDim; }
+};
+
+static FeatureTrack extractFeatures(const PcmData& pcm, qint64 f0, qint64 f1)
+{
+    FeatureTrack t;
+    f0 = std::max<qint64>(0, f0);
+    f1 = std::min(pcm.frames(), f1);
+    if (pcm.sampleRate <= 0 || f1 <= f0) return t;
+
+    // đặc trưng chỉ cần tới ~8 kHz: hạ rate về ~16–24 kHz bằng trung bình
+    // từng nhóm mẫu, FFT nhỏ đi 2–4 lần
+    const int decim = std::max(1, pcm.sampleRate / 16000);
+    const int sr = pcm.sampleRate / decim;
+    QVector<float> y(int((f1 - f0) / decim));
+    const PcmSlice slice(pcm, f0, f1);
+    const qint16* x = slice.data();
+    for (int k = 0; k < y.size(); ++k) {
+        int acc = 0;
+        for (int d = 0; d < decim; ++d)
+            acc += x[qint64(k) * decim + d];
+        y[k] = float(acc) / decim;
+    }
+
+    const int hop = std::max(1, sr / 100);
+    const int win = std::max(2, sr / 40);
+    int nfft = 2;
+    while (nfft < win) nfft <<= 1;
+    const int half = nfft / 2;
+    t.frameSec = double(hop) * decim / pcm.sampleRate;
+    t.frames = std::max(1, (int(y.size()) + hop - 1) / hop);
+
+    // bank lọc mel tam giác 80 Hz – 7.6 kHz, mép tính theo bin (lẻ) nên
+    // mọi sample rate cho cùng dải tần
+    auto toMel = [](double hz) { return 2595.0 * std::log10(1.0 + hz / 700.0); };
+    auto toHz = [](double m) { return 700.0 * (std::pow(10.0, m / 2595.0) - 1.0); };
+    const double mLo = toMel(80.0);
+    const double mHi = toMel(std::min(7600.0, sr / 2.0));
+    double edge[kMelBands + 2];
+    for (int k = 0; k < kMelBands + 2; ++k)
+        edge[k] = toHz(mLo + (mHi - mLo) * k / (kMelBands + 1)) * nfft / sr;
+    int bandFirst[kMelBands], bandOff[kMelBands + 1];
+    QVector<float> weight;
+    bandOff[0] = 0;
+    for (int m = 0; m < kMelBands; ++m) {
+        const double a = edge[m], c = edge[m + 1], z = edge[m + 2];
+        bandFirst[m] = int(a) + 1;
+        for (int b = bandFirst[m]; b < z && b <= half; ++b)
+            weight.push_back(float(b < c ? (b - a) / (c - a)
+                                         : (z - b) / (z - c)));
+        bandOff[m + 1] = weight.size();
+    }
+
+    float dct[kMfcc][kMelBands];
+    for (int c = 0; c < kMfcc; ++c)
+        for (int m = 0; m < kMelBands; ++m)
+            dct[c][m] = float(std::cos(M_PI * (c + 1) * (m + 0.5) / kMelBands));
+
+    QVector<float> hann(win);
+    for (int j = 0; j < win; ++j)
+        hann[j] = float(0.5 - 0.5 * std::cos(2.0 * M_PI * j / win));
+    const double ref = 32768.0 * win / 4.0;
+    const float norm = float(1.0 / (ref * ref));
+
+    t.v.fill(0.0f, t.frames * kFeatDim);
+    t.levelDb.resize(t.frames);
+
+    // phổ công suất (half + 1 bin) của khung i → MFCC + mức
+    auto finishFrame = [&](int i, const float* power) {
+        double energy = 0.0;
+        for (int b = 0; b <= half; ++b)
+            energy += power[b];
+
+        float logMel[kMelBands];
+        for (int m = 0; m < kMelBands; ++m) {
+            const float* w = weight.constData() + bandOff[m];
+            const float* p = power + bandFirst[m];
+            float acc = 0.0f;
+            for (int k = 0; k < bandOff[m + 1] - bandOff[m]; ++k)
+                acc += p[k] * w[k];
+            logMel[m] = std::log(acc + 1e-10f);
+        }
+
+        float* out = t.v.data() + i * kFeatDim;
+        for (int c = 0; c < kMfcc; ++c) {
+            float acc = 0.0f;
+            for (int m = 0; m < kMelBands; ++m)
+                acc += dct[c][m] * logMel[m];
+            out[c] = acc;
+        }
+        t.levelDb[i] = float(10.0 * std::log10(energy + 1e-10));
+    };
+
+    // tín hiệu thực: hai khung liền nhau đi chung một FFT phức (khung i ở
+    // phần thực, i+1 ở phần ảo) rồi tách phổ bằng đối xứng liên hợp
+    const Fft fft(nfft);
+    QVector<float> re(nfft), im(nfft), p0(half + 1), p1(half + 1);
+    auto load = [&](float* dst, int i) {
+        const int start = i * hop + hop / 2 - win / 2;
+        for (int j = 0; j < nfft; ++j) {
+            const int k = start + j;
+            dst[j] = (j < win && k >= 0 && k < y.size()) ? y[k] * hann[j]
+                                                        : 0.0f;
         }
-        if (start < words.size()) {
-            QString seg = words.mid(start).join(" ");
-            out.push_back(seg.trimmed());
+    };
+    for (int i = 0; i < t.frames; i += 2) {
+        load(re.data(), i);
+        if (i + 1 < t.frames) load(im.data(), i + 1);
+        else std::fill(im.begin(), im.end(), 0.0f);
+        fft.forward(re.data(), im.data());
+
+        for (int b = 0; b <= half; ++b) {
+            const int nb = (nfft - b) & (nfft - 1);
+            const float ar = re[b] + re[nb], ai = im[b] - im[nb];
+            const float br = im[b] + im[nb], bi = re[nb] - re[b];
+            p0[b] = (ar * ar + ai * ai) * 0.25f * norm;
+            p1[b] = (br * br + bi * bi) * 0.25f * norm;
         }
+        finishFrame(i, p0.constData());
+        if (i + 1 < t.frames) finishFrame(i + 1, p1.constData());
     }
 
-    if (out.isEmpty())
-        out = base;
+    // CMN cho MFCC; năng lượng tương đối so với khung to nhất, kẹp ở sàn
+    float mean[kMfcc] = {};
+    float peakDb = -200.0f;
+    for (int i = 0; i < t.frames; ++i) {
+        for (int c = 0; c < kMfcc; ++c)
+            mean[c] += t.v[i * kFeatDim + c];
+        peakDb = std::max(peakDb, t.levelDb[i]);
+    }
+    for (int c = 0; c < kMfcc; ++c)
+        mean[c] /= float(t.frames);
+    for (int i = 0; i < t.frames; ++i) {
+        float* out = t.v.data() + i * kFeatDim;
+        for (int c = 0; c < kMfcc; ++c)
+            out[c] -= mean[c];
+        t.levelDb[i] = std::max(t.levelDb[i] - peakDb, kFeatFloorDb * 2);
+        out[kMfcc] = t.levelDb[i] / 5.0f;
+    }
+    return t;
+}
 
-    return out;
+// khoảng [b, e) các khung có tiếng (bỏ lặng hai đầu)
+static bool voicedSpan(const FeatureTrack& t, int& b, int& e)
+{
+    b = 0;
+    e = t.frames;
+    while (b < e && t.levelDb[b] < kFeatFloorDb) ++b;
+    while (e > b && t.levelDb[e - 1] < kFeatFloorDb) --e;
+    return e - b >= 2;
 }
 
-// JSON helpers – chung cho Setup & Practice
-static bool loadLessonJson(const QString& jsonPath,
-    QString& audioPath,
-    QString& textPath,
-    QVector<Sentence>& sentences,
-    double& playSpeed,
-    int& lastSentence)
+// Euclid trên kFeatDim chiều: bình phương từng phần tử rồi cộng dồn kiểu
+// cây – mỗi vòng là phép toán theo phần tử nên vector hoá được mà không
+// cần -ffast-math (khác với cộng dồn tuần tự một biến float).
+static float featureDistance(const float* a, const float* b)
 {
-    QFile f(jsonPath);
-    if (!f.open(QIODevice::ReadOnly)) {
-        QMessageBox::warning(nullptr, "Error",
-            "Cannot open JSON file:\n" + jsonPath);
-        return false;
+    float sq[kFeatDim];
+    for (int d = 0; d < kFeatDim; ++d) {
+        const float t = a[d] - b[d];
+        sq[d] = t * t;
     }
-    QByteArray data = f.readAll();
-    f.close();
+    for (int w = kFeatDim / 2; w > 0; w /= 2)
+        for (int d = 0; d < w; ++d)
+            sq[d] += sq[d + w];
+    return std::sqrt(sq[0]);
+}
 
-    QJsonParseError err;
-    QJsonDocument doc = QJsonDocument::fromJson(data, &err);
-    if (err.error != QJsonParseError::NoError || !doc.isObject()) {
-        QMessageBox::warning(nullptr, "Error",
-            "Invalid JSON format:\n" + jsonPath);
-        return false;
+// DTW trong dải Sakoe–Chiba quanh đường chéo của hai khoảng có tiếng.
+// Trả về, cho mỗi khung a[ab + i], vị trí khung tương ứng của b (tính từ bb,
+// trung bình nếu đường đi dừng nhiều bước ở cùng i); meanCost = chi phí TB
+// mỗi bước.
+static QVector<float> dtwAlign(const FeatureTrack& a, int ab, int ae,
+    const FeatureTrack& b, int bb, int be, double& meanCost)
+{
+    const int n = ae - ab;
+    const int m = be - bb;
+    const int radius = std::max(n, m) / 6 + 10;
+
+    QVector<int> lo(n), hi(n), rowOff(n + 1);
+    rowOff[0] = 0;
+    for (int i = 0; i < n; ++i) {
+        const int c = n > 1 ? int(qint64(i) * (m - 1) / (n - 1)) : 0;
+        lo[i] = std::max(0, c - radius);
+        hi[i] = std::min(m - 1, c + radius);
+        rowOff[i + 1] = rowOff[i] + hi[i] - lo[i] + 1;
     }
 
-    QJsonObject root = doc.object();
-    audioPath = root["audio_path"].toString();
-    textPath = root["text_path"].toString();
-    playSpeed = root["play_speed"].toDouble(1.0);
-    lastSentence = root["last_selected_sentence"].toInt(0);
+    // 0 = chéo, 1 = từ hàng trên (i-1, j), 2 = từ trái (i, j-1)
+    QVector<uchar> step(rowOff[n]);
+    const float inf = std::numeric_limits<float>::infinity();
+    QVector<float> prev(m, inf), cur(m, inf);
+    for (int i = 0; i < n; ++i) {
+        const float* fa = a.frame(ab + i);
+        std::fill(cur.begin(), cur.end(), inf);
+        for (int j = lo[i]; j <= hi[i]; ++j) {
+            const float d = featureDistance(fa, b.frame(bb + j));
+            float best;
+            uchar s;
+            if (i == 0 && j == 0) {
+                best = 0.0f;
+                s = 0;
+            }
+            else {
+                const float diag = (i > 0 && j > 0) ? prev[j - 1] : inf;
+                const float up = i > 0 ? prev[j] : inf;
+                const float left = j > 0 ? cur[j - 1] : inf;
+                best = diag;
+                s = 0;
+                if (up < best) { best = up; s = 1; }
+                if (left < best) { best = left; s = 2; }
+            }
+            cur[j] = best + d;
+            step[rowOff[i] + j - lo[i]] = s;
+        }
+        std::swap(prev, cur);
+    }
 
-    sentences.clear();
-    QJsonArray arr = root["sentences"].toArray();
-    for (int i = 0; i < arr.size(); ++i) {
-        QJsonObject o = arr[i].toObject();
-        Sentence s;
-        s.id = o["id"].toInt(i + 1);
-        s.begin = o["begin"].toDouble(-1.0);
-        s.end = o["end"].toDouble(-1.0);
-        s.text = o["text"].toString();
-        s.confirm = o["confirmed"].toBool(false);
-        sentences.push_back(s);
-    }
-    return true;
+    QVector<float> sumJ(n, 0.0f);
+    QVector<int> cnt(n, 0);
+    meanCost = prev[m - 1];
+    if (!std::isfinite(meanCost)) return {};
+
+    int i = n - 1, j = m - 1, len = 0;
+    while (true) {
+        sumJ[i] += float(j);
+        ++cnt[i];
+        ++len;
+        if (i == 0 && j == 0) break;
+        const uchar s = step[rowOff[i] + j - lo[i]];
+        if (s != 2) --i;
+        if (s != 1) --j;
+    }
+    meanCost /= std::max(1, len);
+
+    for (int k = 0; k < n; ++k)
+        sumJ[k] /= float(std::max(1, cnt[k]));
+    return sumJ;
 }
 
-static bool saveLessonJson(const QString& jsonPath,
-    const QString& audioPath,
-    const QString& textPath,
-    const QVector<Sentence>& sentences,
-    double playSpeed,
-    int lastSentence)
+struct TakeScore
 {
-    QJsonObject root;
-    root["audio_path"] = audioPath;
-    root["text_path"] = textPath;
-    root["play_speed"] = playSpeed;
-    root["last_selected_sentence"] = lastSentence;
-
-    QJsonArray arr;
-    for (const Sentence& s : sentences) {
-        QJsonObject o;
-        o["id"] = s.id;
-        o["begin"] = s.begin;
-        o["end"] = s.end;
-        o["text"] = s.text;
-        o["confirmed"] = s.confirm;
-        arr.push_back(o);
-    }
-    root["sentences"] = arr;
-
-    QJsonDocument doc(root);
-    QByteArray data = doc.toJson(QJsonDocument::Indented);
-
-    QFile f(jsonPath);
-    if (!f.open(QIODevice::WriteOnly)) {
-        QMessageBox::warning(nullptr, "Error",
-            "Cannot write JSON file:\n" + jsonPath);
-        return false;
+    bool   valid = false;
+    double tempo = 1.0;       // độ dài phần có tiếng: take / mẫu
+    double rhythmMs = 0.0;    // lệch nhịp TB (|.|) của đầu từ sau khi bù tempo
+    int    worstWord = -1;
+    double worstMs = 0.0;     // lệch có dấu của từ đó (+ = vào trễ)
+    double distance = 0.0;    // chi phí DTW TB mỗi bước (giống nhau ↔ nhỏ)
+    double elapsedMs = 0.0;
+};
+
+static TakeScore scoreTake(const PcmData& model, const Sentence& s,
+    const PcmData& take)
+{
+    TakeScore r;
+    if (model.isEmpty() || take.isEmpty() || s.end <= s.begin) return r;
+    const qint64 t0 = steadyNowNs();
+
+    const qint64 f0 = qint64(s.begin * model.sampleRate);
+    const qint64 f1 = qint64(s.end * model.sampleRate);
+    FeatureTrack fa, fb;
+    TaskPool::instance().parallelFor(2, [&](int k) {
+        if (k == 0) fa = extractFeatures(model, f0, f1);
+        else fb = extractFeatures(take, 0, take.frames());
+    });
+
+    int ab = 0, ae = 0, bb = 0, be = 0;
+    if (!voicedSpan(fa, ab, ae) || !voicedSpan(fb, bb, be)) return r;
+
+    const QVector<float> map = dtwAlign(fa, ab, ae, fb, bb, be, r.distance);
+    if (map.isEmpty()) return r;
+    r.tempo = double(be - bb) * fb.frameSec / (double(ae - ab) * fa.frameSec);
+
+    // đầu mỗi từ của mẫu → thời điểm tương ứng trong take, so với vị trí
+    // kỳ vọng nếu chỉ nói nhanh/chậm đều
+    double sumAbs = 0.0;
+    int counted = 0;
+    for (int w = 0; w < s.wordStartMs.size(); ++w) {
+        const int i = int(s.wordStartMs[w] / 1000.0 / fa.frameSec) - ab;
+        if (i <= 0 || i >= map.size()) continue;
+        const double got = map[i] * fb.frameSec;
+        const double expect = i * fa.frameSec * r.tempo;
+        const double dev = (got - expect) * 1000.0;
+        sumAbs += std::abs(dev);
+        ++counted;
+        if (r.worstWord < 0 || std::abs(dev) > std::abs(r.worstMs)) {
+            r.worstWord = w;
+            r.worstMs = dev;
+        }
     }
-    f.write(data);
-    f.close();
-    return true;
+    if (counted > 0) r.rhythmMs = sumAbs / counted;
+
+    r.valid = true;
+    r.elapsedMs = (steadyNowNs() - t0) / 1e6;
+    return r;
 }
 
 //===================== Waveform widget =====================
 
+// Chỉ mục khoảng thời gian các câu cho waveform: segs sắp theo begin kèm
+// maxEnd tiền tố (không giảm) để lấy các câu giao [a, b) bằng upper_bound;
+// edges sắp theo thời điểm để tìm mép gần con trỏ trong O(log n).
+struct SegmentIndex
+{
+    struct Segment
+    {
+        double begin = 0.0;
+        double end = 0.0;
+        int    row = 0;         // chỉ số trong LessonDocument::sentences
+        bool   confirm = false;
+    };
+
+    struct Edge
+    {
+        double t = 0.0;
+        int    seg = 0;         // chỉ số trong segs
+        bool   isEnd = false;
+    };
+
+    QVector<Segment> segs;
+    QVector<double>  maxEnd;
+    QVector<Edge>    edges;
+
+    void build(const QVector<Sentence>& sentences)
+    {
+        segs.clear();
+        edges.clear();
+        for (int i = 0; i < sentences.size(); ++i) {
+            const Sentence& s = sentences[i];
+            if (s.begin >= 0.0 && s.end > s.begin)
+                segs.push_back({ s.begin, s.end, i, s.confirm });
+        }
+        std::sort(segs.begin(), segs.end(),
+            [](const Segment& a, const Segment& b) { return a.begin < b.begin; });
+
+        maxEnd.resize(segs.size());
+        edges.reserve(segs.size() * 2);
+        double m = 0.0;
+        for (int i = 0; i < segs.size(); ++i) {
+            m = std::max(m, segs[i].end);
+            maxEnd[i] = m;
+            edges.push_back({ segs[i].begin, i, false });
+            edges.push_back({ segs[i].end, i, true });
+        }
+        std::sort(edges.begin(), edges.end(),
+            [](const Edge& a, const Edge& b) { return a.t < b.t; });
+    }
+
+    // segs[firstOverlapping(a)..] là các câu có thể kết thúc sau a;
+    // duyệt tiếp tới khi begin >= b
+    int firstOverlapping(double a) const
+    {
+        return int(std::upper_bound(maxEnd.cbegin(), maxEnd.cend(), a)
+            - maxEnd.cbegin());
+    }
+
+    // mép gần t nhất trong ±tol, -1 nếu không có. Hai câu liền nhau có
+    // chung một mốc: bên trái mốc lấy End câu trước, bên phải lấy Begin.
+    int nearestEdge(double t, double tol) const
+    {
+        auto it = std::lower_bound(edges.cbegin(), edges.cend(), t - tol,
+            [](const Edge& e, double v) { return e.t < v; });
+        int best = -1;
+        double bestD = tol;
+        for (; it != edges.cend() && it->t <= t + tol; ++it) {
+            const double d = std::abs(it->t - t);
+            const bool preferred = (t < it->t) == it->isEnd;
+            if (best < 0 || d < bestD || (d == bestD && preferred)) {
+                best = int(it - edges.cbegin());
+                bestD = d;
+            }
+        }
+        return best;
+    }
+};
+
 class WaveformWidget : public QWidget
 {
 public:
+    using SegmentEditedHandler =
+        std::function<void(int row, double begin, double end)>;
+    enum class ViewMode { Waveform, Spectrogram };
+
     explicit WaveformWidget(QWidget* parent = nullptr)
         : QWidget(parent)
     {
-        setMinimumHeight(120);
+        setMinimumHeight(120);
+        setMouseTracking(true);     // đổi con trỏ khi rê qua mép câu
+
+        // playhead: đọc snapshot của engine mỗi khung hình khi đang phát,
+        // chỉ thăm dò thưa khi đứng yên
+        m_frameTimer = new QTimer(this);
+        m_frameTimer->setTimerType(Qt::PreciseTimer);
+        connect(m_frameTimer, &QTimer::timeout,
+            this, [this]() { tickPlayhead(); });
+
+        // zoom/pan mượt + quán tính: chỉ chạy khi view đang di chuyển
+        m_animTimer = new QTimer(this);
+        m_animTimer->setTimerType(Qt::PreciseTimer);
+        connect(m_animTimer, &QTimer::timeout,
+            this, [this]() { tickAnimation(); });
+    }
+
+    ~WaveformWidget() override
+    {
+        if (m_doc) m_doc->removeObservers(this);
+    }
+
+    void setEngine(const AudioEngine* engine)
+    {
+        m_engine = engine;
+        m_frameTimer->start(kIdlePollMs);
+    }
+
+    // vẽ vùng mọi câu trong view; chỉ mục dựng lại mỗi khi document đổi
+    void setDocument(QSharedPointer<LessonDocument> doc)
+    {
+        if (m_doc) m_doc->removeObservers(this);
+        m_doc = std::move(doc);
+        rebuildSegments();
+        m_doc->addObserver(this, [this](LessonDocument::Change, int) {
+            rebuildSegments();
+        });
+    }
+
+    // có handler → mép câu kéo được; thả chuột thì báo (row, begin, end)
+    void setSegmentEditedHandler(SegmentEditedHandler h)
+    {
+        m_onSegmentEdited = std::move(h);
+    }
+
+    // Spectrogram: thấy rõ âm xát (s, th...) mà năng lượng không lộ ra
+    void setViewMode(ViewMode mode)
+    {
+        if (mode == m_viewMode) return;
+        m_viewMode = mode;
+        if (mode == ViewMode::Waveform)
+            m_spectro.reset();
+        invalidateBackground();
+    }
+
+    // đường F0 của câu mẫu và take chồng lên waveform/spectrogram
+    void setPitchVisible(bool on)
+    {
+        if (on == m_showPitch) return;
+        m_showPitch = on;
+        invalidateBackground();
+    }
+
+    // nghe thử vị trí mép trong lúc kéo (engine phát một grain ngắn)
+    void setScrubHandler(std::function<void(double sec)> h)
+    {
+        m_onScrub = std::move(h);
     }
 
     void setDuration(double sec)
     {
         m_duration = std::max(0.0, sec);
+        m_velocity = 0.0;
         if (!m_hasView) {
             m_viewStart = 0.0;
             m_viewEnd = (m_duration > 0.0 ? m_duration : 1.0);
         }
-        update();
+        clampRange(m_viewStart, m_viewEnd);
+        m_targetStart = m_viewStart;
+        m_targetEnd = m_viewEnd;
+        invalidateBackground();
     }
 
+    // chỉ vẽ lại vùng selection cũ + mới, nền giữ nguyên trong cache
     void setSelection(double begin, double end)
     {
+        if (begin == m_selBegin && end == m_selEnd) return;
+        update(selectionRect(m_selBegin, m_selEnd));
         m_selBegin = begin;
         m_selEnd = end;
-        update();
+        update(selectionRect(m_selBegin, m_selEnd));
+    }
+
+    // peaks thật từ PCM; null → waveform minh hoạ như cũ
+    void setPeaks(QSharedPointer<const WavePeaks> peaks)
+    {
+        m_peaks = std::move(peaks);
+        invalidateBackground();
+    }
+
+    // gọi mỗi khi dải view hiển thị thay đổi (overview vẽ khung theo)
+    void setViewChangedHandler(std::function<void(double, double)> h)
+    {
+        m_onViewChanged = std::move(h);
+        if (m_onViewChanged) m_onViewChanged(m_viewStart, m_viewEnd);
+    }
+
+    // dời view (giữ độ zoom) để t nằm giữa
+    void centerOn(double t)
+    {
+        if (m_duration <= 0.0) return;
+        const double half = (m_targetEnd - m_targetStart) / 2.0;
+        m_hasView = true;
+        animateTo(t - half, t + half);
     }
 
     // zoom around current view center
     void zoomIn()
     {
         if (m_duration <= 0) return;
-        double center = (m_viewStart + m_viewEnd) / 2.0;
-        double len = (m_viewEnd - m_viewStart) / 1.5;
-        len = std::max(len, m_duration / 100.0);
-        m_viewStart = center - len / 2.0;
-        m_viewEnd = center + len / 2.0;
-        clampView();
+        double center = (m_targetStart + m_targetEnd) / 2.0;
+        double len = (m_targetEnd - m_targetStart) / 1.5;
         m_hasView = true;
-        update();
+        animateTo(center - len / 2.0, center + len / 2.0);
     }
 
     void zoomOut()
     {
         if (m_duration <= 0) return;
-        double center = (m_viewStart + m_viewEnd) / 2.0;
-        double len = (m_viewEnd - m_viewStart) * 1.5;
-        len = std::min(len, m_duration);
-        m_viewStart = center - len / 2.0;
-        m_viewEnd = center + len / 2.0;
-        clampView();
+        double center = (m_targetStart + m_targetEnd) / 2.0;
+        double len = (m_targetEnd - m_targetStart) * 1.5;
         m_hasView = true;
-        update();
+        animateTo(center - len / 2.0, center + len / 2.0);
     }
 
     void fitAll()
     {
         if (m_duration <= 0) return;
-        m_viewStart = 0.0;
-        m_viewEnd = m_duration;
         m_hasView = false;
-        update();
+        animateTo(0.0, m_duration);
     }
 
     // Auto zoom theo rule 20–60–20 (xấp xỉ)
@@ -333,16 +3141,336 @@ public:
             if (viewStart < 0.0) viewStart = 0.0;
         }
 
-        m_viewStart = viewStart;
-        m_viewEnd = viewEnd;
         m_hasView = true;
-        update();
+        animateTo(viewStart, viewEnd);
     }
 
 protected:
-    void paintEvent(QPaintEvent*) override
+    // Wheel: zoom quanh điểm dưới con trỏ; Shift+wheel hoặc cuộn ngang: pan
+    void wheelEvent(QWheelEvent* ev) override
+    {
+        if (m_duration <= 0.0) {
+            ev->ignore();
+            return;
+        }
+        const QPoint d = ev->angleDelta();
+        const double len = m_targetEnd - m_targetStart;
+        if (d.x() != 0 || (ev->modifiers() & Qt::ShiftModifier)) {
+            const double notches = (d.x() != 0 ? d.x() : d.y()) / 120.0;
+            const double shift = -notches * len * kWheelPanFraction;
+            animateTo(m_targetStart + shift, m_targetEnd + shift);
+        }
+        else if (d.y() != 0) {
+            const QRectF r = plotRect();
+            const double f = std::clamp(
+                (ev->position().x() - r.left()) / std::max(1.0, r.width()),
+                0.0, 1.0);
+            // thời điểm đang hiển thị dưới con trỏ giữ nguyên sau khi zoom
+            const double anchor = m_viewStart + f * (m_viewEnd - m_viewStart);
+            const double newLen = std::clamp(
+                len * std::pow(kWheelZoomStep, -d.y() / 120.0),
+                minViewLength(), m_duration);
+            animateTo(anchor - f * newLen, anchor + (1.0 - f) * newLen);
+        }
+        m_hasView = true;
+        ev->accept();
+    }
+
+    // Bấm trúng mép câu → kéo mép; chỗ khác → kéo để pan, thả khi còn
+    // vận tốc thì trôi tiếp (kinetic)
+    void mousePressEvent(QMouseEvent* ev) override
+    {
+        if (ev->button() != Qt::LeftButton || m_duration <= 0.0) {
+            QWidget::mousePressEvent(ev);
+            return;
+        }
+        m_animTimer->stop();
+        m_velocity = 0.0;
+        m_dragVelocity = 0.0;
+        m_targetStart = m_viewStart;
+        m_targetEnd = m_viewEnd;
+
+        const int edge = hitEdge(ev->position().x());
+        if (edge >= 0) {
+            beginEdgeDrag(edge);
+            return;
+        }
+        m_dragging = true;
+        m_dragLastX = ev->position().x();
+        m_dragLastNs = steadyNowNs();
+        setCursor(Qt::ClosedHandCursor);
+    }
+
+    void mouseMoveEvent(QMouseEvent* ev) override
+    {
+        const double x = ev->position().x();
+        if (m_edgeSeg >= 0) {
+            const double t = std::clamp(
+                std::round(xToTime(x) * 1000.0) / 1000.0, m_edgeLo, m_edgeHi);
+            double& edge = m_edgeIsEnd ? m_edgeEnd : m_edgeBegin;
+            if (t == edge) return;
+            // nền không đổi (câu đang kéo vẽ ở overlay): chỉ vẽ lại dải
+            // cũ + mới
+            update(dragRect());
+            edge = t;
+            update(dragRect());
+            if (m_edgeMovesSel)
+                setSelection(m_edgeBegin, m_edgeEnd);
+            scrubAt(t, false);
+            return;
+        }
+        if (!m_dragging) {
+            if (hitEdge(x) >= 0)
+                setCursor(Qt::SizeHorCursor);
+            else
+                unsetCursor();
+            QWidget::mouseMoveEvent(ev);
+            return;
+        }
+        const double shift = (m_dragLastX - x) * secondsPerPixel();
+        const qint64 now = steadyNowNs();
+        const double dt = (now - m_dragLastNs) / 1e9;
+        if (dt > 0.0) {
+            // làm mượt để vận tốc lúc thả không phụ thuộc một mẫu lẻ
+            m_dragVelocity = 0.7 * (shift / dt) + 0.3 * m_dragVelocity;
+        }
+        m_dragLastX = x;
+        m_dragLastNs = now;
+
+        m_viewStart += shift;
+        m_viewEnd += shift;
+        clampRange(m_viewStart, m_viewEnd);
+        m_targetStart = m_viewStart;
+        m_targetEnd = m_viewEnd;
+        m_hasView = true;
+        invalidateBackground();
+    }
+
+    void mouseReleaseEvent(QMouseEvent* ev) override
+    {
+        if (m_edgeSeg >= 0 && ev->button() == Qt::LeftButton) {
+            const SegmentIndex::Segment& sg = m_segments.segs[m_edgeSeg];
+            const int row = sg.row;
+            const bool changed =
+                m_edgeBegin != sg.begin || m_edgeEnd != sg.end;
+            m_edgeSeg = -1;
+            unsetCursor();
+            // vị trí cuối có thể đã bị bỏ qua do giới hạn tần suất
+            if (changed)
+                scrubAt(m_edgeIsEnd ? m_edgeEnd : m_edgeBegin, true);
+            if (changed && m_onSegmentEdited)
+                m_onSegmentEdited(row, m_edgeBegin, m_edgeEnd);
+            // câu trở lại nền, dựng nền một lần
+            invalidateBackground();
+            return;
+        }
+        if (!m_dragging || ev->button() != Qt::LeftButton) {
+            QWidget::mouseReleaseEvent(ev);
+            return;
+        }
+        m_dragging = false;
+        unsetCursor();
+
+        // dừng tay một lúc trước khi thả → không trôi
+        const double idle = (steadyNowNs() - m_dragLastNs) / 1e9;
+        const double pxPerSec = std::abs(m_dragVelocity) / secondsPerPixel();
+        if (idle < kKineticIdleSec && pxPerSec > kKineticMinPxPerSec) {
+            m_velocity = m_dragVelocity;
+            startAnimation();
+        }
+    }
+
+    void paintEvent(QPaintEvent* ev) override
+    {
+        const qint64 t0 = steadyNowNs();
+        paintFrame(ev);
+        const double ms = (steadyNowNs() - t0) / 1e6;
+        m_paintStats.lastMs = ms;
+        m_paintStats.avgMs = m_paintStats.frames == 0
+            ? ms : 0.9 * m_paintStats.avgMs + 0.1 * ms;
+        m_paintStats.maxMs = std::max(m_paintStats.maxMs, ms);
+        ++m_paintStats.frames;
+    }
+
+public:
+    // thời gian paintEvent (HUD); maxMs đặt lại sau mỗi lần đọc
+    struct PaintStats
+    {
+        double lastMs = 0.0;
+        double avgMs = 0.0;     // trung bình trượt
+        double maxMs = 0.0;
+        qint64 frames = 0;
+    };
+
+    PaintStats takePaintStats()
+    {
+        const PaintStats s = m_paintStats;
+        m_paintStats.maxMs = 0.0;
+        return s;
+    }
+
+    bool spectrogramStats(SpectrogramCache::Stats& out) const
     {
+        if (!m_spectro) return false;
+        out = m_spectro->stats();
+        return true;
+    }
+
+private:
+    // Nền (thân waveform + gradient + baseline) nằm trong m_background,
+    // chỉ render lại khi view/kích thước/peaks đổi; mỗi lần paint chỉ blit
+    // đúng vùng bẩn rồi vẽ overlay (câu đang kéo mép, selection, playhead)
+    // lên trên.
+    void paintFrame(QPaintEvent* ev)
+    {
+        ensureBackground();
+
         QPainter p(this);
+        const QRect dirty = ev->rect();
+        const qreal dpr = m_background.devicePixelRatio();
+        p.drawPixmap(QRectF(dirty), m_background,
+            QRectF(dirty.x() * dpr, dirty.y() * dpr,
+                dirty.width() * dpr, dirty.height() * dpr));
+
+        if (m_duration <= 0.0) return;
+
+        const QRectF r = plotRect();
+        p.setRenderHint(QPainter::Antialiasing);
+
+        if (m_edgeSeg >= 0 && !dragRect().isNull())
+            paintDraggedSegment(p, r);
+
+        // playhead
+        if (!playheadRect(m_playhead).isNull()) {
+            const double x = timeToX(m_playhead);
+            p.setPen(QPen(QColor(255, 80, 80), 2));
+            p.drawLine(QPointF(x, r.top()), QPointF(x, r.bottom()));
+        }
+
+        // draw selected region
+        if (!selectionRect(m_selBegin, m_selEnd).isNull()) {
+            const double x1 = timeToX(std::max(m_selBegin, m_viewStart));
+            const double x2 = timeToX(std::min(m_selEnd, m_viewEnd));
+            QRectF sel(x1, r.top(), x2 - x1, r.height());
+            p.fillRect(sel, QColor(0, 0, 255, 60));
+            p.setPen(QPen(Qt::yellow, 2));
+            p.drawRect(sel);
+        }
+    }
+
+private:
+    void invalidateBackground()
+    {
+        m_bgDirty = true;
+        update();
+        if (m_onViewChanged) m_onViewChanged(m_viewStart, m_viewEnd);
+    }
+
+    void rebuildSegments()
+    {
+        m_edgeSeg = -1;     // chỉ số cũ không còn đúng
+        m_segments.build(m_doc->sentences);
+        invalidateBackground();
+    }
+
+    // mép câu dưới toạ độ x (trong ±kHandlePx), -1 nếu không sửa được
+    int hitEdge(double x) const
+    {
+        if (!m_onSegmentEdited || m_duration <= 0.0) return -1;
+        return m_segments.nearestEdge(xToTime(x),
+            kHandlePx * secondsPerPixel());
+    }
+
+    // giới hạn theo câu kề: Begin không lùi qua End của các câu trước,
+    // End không vượt Begin câu sau, câu luôn dài ít nhất kMinSegmentSec
+    void beginEdgeDrag(int edgeIdx)
+    {
+        const SegmentIndex::Edge& ed = m_segments.edges[edgeIdx];
+        const SegmentIndex::Segment& sg = m_segments.segs[ed.seg];
+        const int n = m_segments.segs.size();
+        m_edgeSeg = ed.seg;
+        m_edgeIsEnd = ed.isEnd;
+        m_edgeBegin = sg.begin;
+        m_edgeEnd = sg.end;
+        if (ed.isEnd) {
+            m_edgeLo = std::min(sg.end, sg.begin + kMinSegmentSec);
+            m_edgeHi = ed.seg + 1 < n
+                ? std::max(m_segments.segs[ed.seg + 1].begin, sg.end)
+                : std::max(m_duration, sg.end);
+        }
+        else {
+            m_edgeLo = ed.seg > 0
+                ? std::min(m_segments.maxEnd[ed.seg - 1], sg.begin)
+                : 0.0;
+            m_edgeHi = std::max(sg.begin, sg.end - kMinSegmentSec);
+        }
+        m_edgeMovesSel = (m_selBegin == sg.begin && m_selEnd == sg.end);
+        setCursor(Qt::SizeHorCursor);
+        // câu chuyển từ nền sang overlay: dựng nền một lần lúc bắt đầu
+        invalidateBackground();
+    }
+
+    // grain cách nhau ≥ nửa độ dài grain để các cửa sổ chồng đúng 50%
+    void scrubAt(double t, bool force)
+    {
+        if (!m_onScrub || t == m_lastScrubSec) return;
+        const qint64 now = steadyNowNs();
+        if (!force && now - m_lastScrubNs < kScrubIntervalNs) return;
+        m_lastScrubNs = now;
+        m_lastScrubSec = t;
+        m_onScrub(t);
+    }
+
+    // dải + mép của câu đang kéo (overlay), rỗng nếu ngoài view
+    QRect dragRect() const
+    {
+        if (m_edgeSeg < 0) return QRect();
+        return selectionRect(m_edgeBegin, m_edgeEnd).adjusted(-1, 0, 1, 0);
+    }
+
+    static QColor bandColor(bool confirmed)
+    {
+        return confirmed ? QColor(80, 200, 120, 35) : QColor(255, 170, 60, 35);
+    }
+
+    // Câu đang kéo mép không nằm trong nền (xem paintBackground) mà vẽ đè
+    // ở đây theo m_edgeBegin/m_edgeEnd, nên kéo không phải dựng lại nền.
+    void paintDraggedSegment(QPainter& p, const QRectF& r)
+    {
+        const double b = m_edgeBegin, e = m_edgeEnd;
+        const double x1 = timeToX(std::max(b, m_viewStart));
+        const double x2 = timeToX(std::min(e, m_viewEnd));
+        if (x2 > x1) {
+            p.fillRect(QRectF(x1, r.top(), x2 - x1, r.height()),
+                bandColor(m_segments.segs[m_edgeSeg].confirm));
+        }
+        for (double t : { b, e }) {
+            if (t < m_viewStart || t > m_viewEnd) continue;
+            const double x = timeToX(t);
+            p.setPen(QPen(QColor(255, 255, 255, 110), 1));
+            p.drawLine(QLineF(x, r.top(), x, r.bottom()));
+            p.fillRect(QRectF(x - 3.0, r.top(), 6.0, 10.0),
+                QColor(255, 255, 255, 170));
+        }
+    }
+
+    void ensureBackground()
+    {
+        const qreal dpr = devicePixelRatioF();
+        const QSize px(qRound(width() * dpr), qRound(height() * dpr));
+        if (!m_bgDirty && m_background.size() == px
+            && m_background.devicePixelRatio() == dpr)
+            return;
+
+        m_background = QPixmap(px);
+        m_background.setDevicePixelRatio(dpr);
+        QPainter p(&m_background);
+        paintBackground(p);
+        m_bgDirty = false;
+    }
+
+    void paintBackground(QPainter& p)
+    {
         p.fillRect(rect(), QColor(0, 30, 60));
 
         if (m_duration <= 0.0) {
@@ -352,43 +3480,110 @@ protected:
             return;
         }
 
-        QRectF r = rect().adjusted(5, 5, -5, -5);
+        const QRectF r = plotRect();
         p.setRenderHint(QPainter::Antialiasing);
 
-        // stylized waveform: filled symmetrical envelope with subtle variation
-        const int steps = 220;
+        // vùng các câu giao view: dải mờ phía sau waveform, mép vẽ sau cùng
+        QVector<QRectF> bands[2];   // [0] chưa confirm, [1] đã confirm
+        QVector<QLineF> edgeLines;
+        QVector<QRectF> grips;
+        for (int i = m_segments.firstOverlapping(m_viewStart);
+            i < m_segments.segs.size()
+            && m_segments.segs[i].begin < m_viewEnd; ++i) {
+            if (i == m_edgeSeg) continue;   // đang kéo: vẽ ở overlay
+            const double b = m_segments.segs[i].begin;
+            const double e = m_segments.segs[i].end;
+            const double x1 = timeToX(std::max(b, m_viewStart));
+            const double x2 = timeToX(std::min(e, m_viewEnd));
+            if (x2 <= x1) continue;
+            bands[m_segments.segs[i].confirm ? 1 : 0]
+                .append(QRectF(x1, r.top(), x2 - x1, r.height()));
+            for (double t : { b, e }) {
+                if (t < m_viewStart || t > m_viewEnd) continue;
+                const double x = timeToX(t);
+                edgeLines.append(QLineF(x, r.top(), x, r.bottom()));
+                if (m_onSegmentEdited)
+                    grips.append(QRectF(x - 3.0, r.top(), 6.0, 10.0));
+            }
+        }
+        const bool spectro = m_viewMode == ViewMode::Spectrogram
+            && paintSpectrogram(p, r);
+        p.setPen(Qt::NoPen);
+        p.setBrush(bandColor(false));
+        p.drawRects(bands[0]);
+        p.setBrush(bandColor(true));
+        p.drawRects(bands[1]);
+
+        auto drawEdges = [&]() {
+            p.setPen(QPen(QColor(255, 255, 255, 110), 1));
+            p.drawLines(edgeLines);
+            p.setPen(Qt::NoPen);
+            p.setBrush(QColor(255, 255, 255, 170));
+            p.drawRects(grips);
+        };
+        if (spectro) {
+            if (m_showPitch) paintPitch(p, r);
+            drawEdges();
+            return;
+        }
+
+        // waveform body: real min/max peaks when available, otherwise
+        // the stylized symmetrical envelope with subtle variation
+        const bool real = m_peaks && !m_peaks->isEmpty();
+        const int steps = real ? std::max(1, int(r.width())) : 220;
         const double halfH = r.height() * 0.45;
 
-        // Build a closed path (top + bottom) to fill the waveform body
-        QPainterPath body;
-        body.moveTo(r.left(), r.center().y());
+        const WavePeaks::Level* lv = nullptr;
+        double perSec = 0.0;
+        if (real) {
+            const double framesPerPixel = (m_viewEnd - m_viewStart)
+                * m_peaks->sampleRate / steps;
+            lv = &m_peaks->levelFor(framesPerPixel);
+            perSec = double(m_peaks->sampleRate) / lv->framesPerPeak;
+        }
+
+        QVector<double> ampTop(steps + 1), ampBot(steps + 1);
         for (int i = 0; i <= steps; ++i) {
             double tNorm = double(i) / steps;
             double tView = m_viewStart + tNorm * (m_viewEnd - m_viewStart);
+
+            if (real) {
+                const double tNext = m_viewStart
+                    + double(i + 1) / steps * (m_viewEnd - m_viewStart);
+                const qsizetype n = lv->minv.size();
+                qsizetype i0 = std::clamp<qsizetype>(
+                    qsizetype(tView * perSec), 0, n - 1);
+                qsizetype i1 = std::clamp<qsizetype>(
+                    qsizetype(std::ceil(tNext * perSec)), i0 + 1, n);
+                int lo = 0, hi = 0;
+                for (qsizetype k = i0; k < i1; ++k) {
+                    lo = std::min<int>(lo, lv->minv[k]);
+                    hi = std::max<int>(hi, lv->maxv[k]);
+                }
+                ampTop[i] = double(hi) / m_peaks->absMax;
+                ampBot[i] = double(-lo) / m_peaks->absMax;
+                continue;
+            }
 
             double base = 0.55 + 0.25 * std::sin(tView * 4.0 * M_PI);
             double detail = 0.18 * std::sin(tView * 11.0 * M_PI + 1.3)
                 + 0.12 * std::sin(tView * 7.0 * M_PI + 0.4);
             double envelope = 0.65 + 0.35 * std::sin(M_PI * tNorm);
             double amp = std::clamp(base + detail, 0.08, 1.0) * envelope;
+            ampTop[i] = amp;
+            ampBot[i] = amp;
+        }
 
-            double x = r.left() + tNorm * r.width();
-            double yTop = r.center().y() - amp * halfH;
-            body.lineTo(x, yTop);
+        // Build a closed path (top + bottom) to fill the waveform body
+        QPainterPath body;
+        body.moveTo(r.left(), r.center().y());
+        for (int i = 0; i <= steps; ++i) {
+            double x = r.left() + double(i) / steps * r.width();
+            body.lineTo(x, r.center().y() - ampTop[i] * halfH);
         }
         for (int i = steps; i >= 0; --i) {
-            double tNorm = double(i) / steps;
-            double tView = m_viewStart + tNorm * (m_viewEnd - m_viewStart);
-
-            double base = 0.55 + 0.25 * std::sin(tView * 4.0 * M_PI);
-            double detail = 0.18 * std::sin(tView * 11.0 * M_PI + 1.3)
-                + 0.12 * std::sin(tView * 7.0 * M_PI + 0.4);
-            double envelope = 0.65 + 0.35 * std::sin(M_PI * tNorm);
-            double amp = std::clamp(base + detail, 0.08, 1.0) * envelope;
-
-            double x = r.left() + tNorm * r.width();
-            double yBot = r.center().y() + amp * halfH;
-            body.lineTo(x, yBot);
+            double x = r.left() + double(i) / steps * r.width();
+            body.lineTo(x, r.center().y() + ampBot[i] * halfH);
         }
         body.closeSubpath();
 
@@ -406,43 +3601,263 @@ protected:
         p.setPen(QPen(QColor(0, 130, 190, 180), 1.5, Qt::DashLine));
         p.drawLine(QPointF(r.left(), r.center().y()), QPointF(r.right(), r.center().y()));
 
-        // draw selected region
-        if (m_selBegin >= 0.0 && m_selEnd > m_selBegin) {
-            double b = std::max(m_selBegin, m_viewStart);
-            double e = std::min(m_selEnd, m_viewEnd);
-            if (e > b) {
-                double x1 = r.left() +
-                    ((b - m_viewStart) /
-                        (m_viewEnd - m_viewStart)) * r.width();
-                double x2 = r.left() +
-                    ((e - m_viewStart) /
-                        (m_viewEnd - m_viewStart)) * r.width();
-                QRectF sel(x1, r.top(), x2 - x1, r.height());
-                p.fillRect(sel, QColor(0, 0, 255, 60));
-                p.setPen(QPen(Qt::yellow, 2));
-                p.drawRect(sel);
+        if (m_showPitch) paintPitch(p, r);
+        drawEdges();
+    }
+
+    // F0 câu mẫu (vàng) và take của người học (hồng, giãn đều theo độ dài
+    // câu vì take đã cắt lặng); trục dọc log kPitchMinHz–kPitchMaxHz
+    void paintPitch(QPainter& p, const QRectF& r)
+    {
+        if (!m_doc) return;
+        m_pitchGen = m_doc->pitch.generation();
+
+        const double range = std::log(kPitchMaxHz / kPitchMinHz);
+        auto trace = [&](QPainterPath& path, const PitchContour& c,
+            double begin, double secPerFrame) {
+            bool open = false;
+            for (int k = 0; k < c.hz.size(); ++k) {
+                const double t = begin + (k + 0.5) * secPerFrame;
+                if (c.hz[k] <= 0.0f || t < m_viewStart || t > m_viewEnd) {
+                    open = false;
+                    continue;
+                }
+                const double hz = std::clamp<double>(c.hz[k],
+                    kPitchMinHz, kPitchMaxHz);
+                const QPointF pt(timeToX(t), r.bottom()
+                    - std::log(hz / kPitchMinHz) / range * r.height());
+                if (open) path.lineTo(pt);
+                else path.moveTo(pt);
+                open = true;
             }
+        };
+
+        QPainterPath model, learner;
+        for (int i = m_segments.firstOverlapping(m_viewStart);
+            i < m_segments.segs.size()
+            && m_segments.segs[i].begin < m_viewEnd; ++i) {
+            if (i == m_edgeSeg) continue;   // đang kéo: span đổi liên tục
+            const SegmentIndex::Segment& sg = m_segments.segs[i];
+            if (const auto c = m_doc->sentencePitch(sg.row))
+                trace(model, *c, sg.begin, c->frameSec);
+            const auto c = m_doc->takePitch(sg.row);
+            if (c && !c->hz.isEmpty())
+                trace(learner, *c, sg.begin, (sg.end - sg.begin) / c->hz.size());
         }
+
+        p.save();
+        p.setClipRect(r);
+        p.setBrush(Qt::NoBrush);
+        p.setPen(QPen(QColor(255, 215, 0), 2));
+        p.drawPath(model);
+        p.setPen(QPen(QColor(255, 100, 200), 2));
+        p.drawPath(learner);
+        p.restore();
     }
 
-private:
-    void clampView()
+    // Vẽ các tile của mức zoom có khoảng cột gần nhất ≤ 1 pixel; tile chưa
+    // có thì để trống và được vẽ lại khi worker xong (xem tickPlayhead).
+    bool paintSpectrogram(QPainter& p, const QRectF& r)
+    {
+        if (!m_doc || !m_doc->pcm || m_doc->pcm->isEmpty()) return false;
+        if (!m_spectro || m_spectro->pcm() != m_doc->pcm) {
+            m_spectro = std::make_unique<SpectrogramCache>(m_doc->pcm,
+                spectrogramCacheDir(m_doc->audioPath), m_doc->cancelToken);
+        }
+
+        const int sr = m_doc->pcm->sampleRate;
+        const double framesPerPixel =
+            (m_viewEnd - m_viewStart) * sr / std::max(1.0, r.width());
+        int level = 0;
+        while (level < kSpecMaxLevel
+            && double(qint64(kSpecHop) << (level + 1)) <= framesPerPixel)
+            ++level;
+        const double tileSec =
+            double(qint64(kSpecHop) << level) * kSpecTileCols / sr;
+
+        p.save();
+        p.setClipRect(r);
+        p.setRenderHint(QPainter::SmoothPixmapTransform);
+        const qint64 first = qint64(m_viewStart / tileSec);
+        const qint64 last = qint64(m_viewEnd / tileSec);
+        for (qint64 i = first; i <= last; ++i) {
+            const QImage* img = m_spectro->tile(level, i);
+            if (!img) continue;
+            const double x1 = timeToX(i * tileSec);
+            const double x2 = timeToX((i + 1) * tileSec);
+            p.drawImage(QRectF(x1, r.top(), x2 - x1, r.height()), *img);
+        }
+        p.restore();
+
+        // đón trước một tile mỗi bên cho lúc pan
+        if (first > 0)
+            m_spectro->tile(level, first - 1, TaskPool::Background);
+        m_spectro->tile(level, last + 1, TaskPool::Background);
+        return true;
+    }
+
+    QRectF plotRect() const
+    {
+        return QRectF(rect()).adjusted(5, 5, -5, -5);
+    }
+
+    double timeToX(double t) const
+    {
+        const QRectF r = plotRect();
+        return r.left() + ((t - m_viewStart) /
+            (m_viewEnd - m_viewStart)) * r.width();
+    }
+
+    double xToTime(double x) const
+    {
+        const QRectF r = plotRect();
+        return m_viewStart + (x - r.left()) / std::max(1.0, r.width())
+            * (m_viewEnd - m_viewStart);
+    }
+
+    // vùng widget cần vẽ lại cho một selection (kể cả viền vàng 2px)
+    QRect selectionRect(double begin, double end) const
+    {
+        if (m_duration <= 0.0 || begin < 0.0 || end <= begin) return QRect();
+        const double b = std::max(begin, m_viewStart);
+        const double e = std::min(end, m_viewEnd);
+        if (e <= b) return QRect();
+        const QRectF r = plotRect();
+        const double x1 = timeToX(b), x2 = timeToX(e);
+        return QRectF(x1, r.top(), x2 - x1, r.height())
+            .adjusted(-3, -3, 3, 3).toAlignedRect();
+    }
+
+    // dải hẹp quanh vạch playhead
+    QRect playheadRect(double t) const
+    {
+        if (m_duration <= 0.0 || t < m_viewStart || t > m_viewEnd)
+            return QRect();
+        const QRectF r = plotRect();
+        const double x = timeToX(t);
+        return QRectF(x - 3, r.top() - 1, 6, r.height() + 2).toAlignedRect();
+    }
+
+    void tickPlayhead()
+    {
+        // tile spectrogram tính xong ở worker → vẽ lại nền
+        if (m_spectro && m_spectro->collect())
+            invalidateBackground();
+        // contour F0 mới xong (có thể do widget khác collect) → vẽ lại nền
+        if (m_showPitch && m_doc) {
+            m_doc->pitch.collect();
+            if (m_doc->pitch.generation() != m_pitchGen)
+                invalidateBackground();
+        }
+
+        if (!m_engine) return;
+        const PlaybackSnapshot snap = m_engine->snapshot();
+        const bool playing = snap.state == PlaybackSnapshot::Playing;
+        const double t = snap.sampleRate > 0
+            ? snap.playheadAt(steadyNowNs()) : -1.0;
+        if (t != m_playhead) {
+            update(playheadRect(m_playhead));
+            m_playhead = t;
+            update(playheadRect(m_playhead));
+        }
+
+        const int interval = playing ? frameIntervalMs() : kIdlePollMs;
+        if (m_frameTimer->interval() != interval)
+            m_frameTimer->setInterval(interval);
+    }
+
+    int frameIntervalMs() const
+    {
+        const qreal hz = screen() ? screen()->refreshRate() : 60.0;
+        return std::max(1, int(1000.0 / std::max<qreal>(hz, 1.0)));
+    }
+
+    double secondsPerPixel() const
+    {
+        return (m_viewEnd - m_viewStart) / std::max(1.0, plotRect().width());
+    }
+
+    double minViewLength() const
+    {
+        return std::min(m_duration, kMinViewSec);
+    }
+
+    // đặt đích cho view; tickAnimation() tiến dần tới đó mỗi khung hình
+    void animateTo(double start, double end)
+    {
+        clampRange(start, end);
+        m_targetStart = start;
+        m_targetEnd = end;
+        m_velocity = 0.0;
+        startAnimation();
+    }
+
+    void startAnimation()
+    {
+        m_lastAnimNs = steadyNowNs();
+        m_animTimer->setInterval(frameIntervalMs());
+        if (!m_animTimer->isActive())
+            m_animTimer->start();
+    }
+
+    void tickAnimation()
+    {
+        const qint64 now = steadyNowNs();
+        const double dt = std::clamp((now - m_lastAnimNs) / 1e9, 0.0, 0.1);
+        m_lastAnimNs = now;
+
+        if (m_velocity != 0.0) {
+            // quán tính: trôi theo vận tốc lúc thả, giảm dần theo hàm mũ,
+            // dừng khi chạm mép hoặc chậm hơn vài pixel/giây
+            const double start = m_targetStart + m_velocity * dt;
+            m_targetStart = start;
+            m_targetEnd += m_velocity * dt;
+            clampRange(m_targetStart, m_targetEnd);
+            m_velocity *= std::exp(-dt / kKineticTau);
+            if (m_targetStart != start
+                || std::abs(m_velocity) / secondsPerPixel() < kKineticMinPxPerSec)
+                m_velocity = 0.0;
+            m_viewStart = m_targetStart;
+            m_viewEnd = m_targetEnd;
+        }
+        else {
+            // zoom/pan: tiến về đích theo hàm mũ, bám hẳn khi lệch < nửa pixel
+            const double k = 1.0 - std::exp(-dt / kViewTau);
+            m_viewStart += (m_targetStart - m_viewStart) * k;
+            m_viewEnd += (m_targetEnd - m_viewEnd) * k;
+            const double eps = 0.5 * (m_targetEnd - m_targetStart)
+                / std::max(1.0, plotRect().width());
+            if (std::abs(m_viewStart - m_targetStart) < eps
+                && std::abs(m_viewEnd - m_targetEnd) < eps) {
+                m_viewStart = m_targetStart;
+                m_viewEnd = m_targetEnd;
+            }
+        }
+
+        if (m_velocity == 0.0 && m_viewStart == m_targetStart
+            && m_viewEnd == m_targetEnd)
+            m_animTimer->stop();
+        invalidateBackground();
+    }
+
+    // giữ độ dài view trong [minViewLength, duration] và dời (không cắt)
+    // cho nằm trong [0, duration]
+    void clampRange(double& start, double& end) const
     {
         if (m_duration <= 0.0) {
-            m_viewStart = 0.0;
-            m_viewEnd = 1.0;
+            start = 0.0;
+            end = 1.0;
             return;
         }
-        if (m_viewStart < 0.0) m_viewStart = 0.0;
-        if (m_viewEnd > m_duration) m_viewEnd = m_duration;
-        if (m_viewEnd - m_viewStart < m_duration / 100.0) {
-            m_viewEnd = m_viewStart + m_duration / 100.0;
-            if (m_viewEnd > m_duration) {
-                m_viewEnd = m_duration;
-                m_viewStart = m_viewEnd - m_duration / 100.0;
-                if (m_viewStart < 0.0) m_viewStart = 0.0;
-            }
+        const double minLen = minViewLength();
+        if (end - start < minLen) {
+            const double c = (start + end) / 2.0;
+            start = c - minLen / 2.0;
+            end = c + minLen / 2.0;
         }
+        const double len = std::min(end - start, m_duration);
+        start = std::clamp(start, 0.0, m_duration - len);
+        end = start + len;
     }
 
     double m_duration = 0.0;
@@ -451,6 +3866,227 @@ private:
     double m_viewStart = 0.0;
     double m_viewEnd = 1.0;
     bool   m_hasView = false;
+
+    // đích của animation zoom/pan và vận tốc quán tính (giây/giây)
+    static constexpr double kMinViewSec = 0.2;
+    static constexpr double kWheelZoomStep = 1.25;
+    static constexpr double kWheelPanFraction = 0.1;
+    static constexpr double kViewTau = 0.06;
+    static constexpr double kKineticTau = 0.325;
+    static constexpr double kKineticMinPxPerSec = 20.0;
+    static constexpr double kKineticIdleSec = 0.05;
+    QTimer* m_animTimer = nullptr;
+    double  m_targetStart = 0.0;
+    double  m_targetEnd = 1.0;
+    double  m_velocity = 0.0;
+    qint64  m_lastAnimNs = 0;
+
+    bool    m_dragging = false;
+    double  m_dragLastX = 0.0;
+    qint64  m_dragLastNs = 0;
+    double  m_dragVelocity = 0.0;
+
+    QSharedPointer<const WavePeaks> m_peaks;
+    ViewMode m_viewMode = ViewMode::Waveform;
+    std::unique_ptr<SpectrogramCache> m_spectro;
+    bool    m_showPitch = false;
+    int     m_pitchGen = -1;
+    QPixmap m_background;
+    bool    m_bgDirty = true;
+    PaintStats m_paintStats;
+    std::function<void(double, double)> m_onViewChanged;
+
+    // vùng các câu + kéo mép
+    static constexpr double kHandlePx = 4.0;
+    static constexpr double kMinSegmentSec = 0.05;
+    QSharedPointer<LessonDocument> m_doc;
+    SegmentIndex m_segments;
+    SegmentEditedHandler m_onSegmentEdited;
+    int    m_edgeSeg = -1;      // segs đang kéo mép, -1 = không
+    bool   m_edgeIsEnd = false;
+    bool   m_edgeMovesSel = false;
+    double m_edgeBegin = 0.0;
+    double m_edgeEnd = 0.0;
+    double m_edgeLo = 0.0;
+    double m_edgeHi = 0.0;
+
+    static constexpr qint64 kScrubIntervalNs = 75'000'000;
+    std::function<void(double)> m_onScrub;
+    qint64 m_lastScrubNs = 0;
+    double m_lastScrubSec = -1.0;
+
+    static constexpr int kIdlePollMs = 100;
+    const AudioEngine* m_engine = nullptr;
+    QTimer* m_frameTimer = nullptr;
+    double  m_playhead = -1.0;
+};
+
+//===================== Overview strip =====================
+
+// Dải tổng quan phía trên waveform: peaks thô của cả file, mỗi câu là một
+// dải màu (xanh = đã confirm, cam = chưa) và khung view hiện tại của
+// waveform. Nền cache trong pixmap, chỉ vẽ lại khi document đổi; các dải
+// chạm nhau cùng màu được gộp theo pixel rồi vẽ bằng một lần drawRects.
+class OverviewWidget : public QWidget
+{
+public:
+    using JumpHandler = std::function<void(double sec)>;
+
+    explicit OverviewWidget(QSharedPointer<LessonDocument> doc,
+        QWidget* parent = nullptr)
+        : QWidget(parent), m_doc(std::move(doc))
+    {
+        setFixedHeight(40);
+        setCursor(Qt::PointingHandCursor);
+        m_doc->addObserver(this, [this](LessonDocument::Change, int) {
+            invalidateBackground();
+        });
+    }
+
+    ~OverviewWidget() override
+    {
+        m_doc->removeObservers(this);
+    }
+
+    void setJumpHandler(JumpHandler h) { m_onJump = std::move(h); }
+
+    // khung view của waveform – chỉ vẽ lại khung cũ + mới
+    void setView(double start, double end)
+    {
+        if (start == m_viewStart && end == m_viewEnd) return;
+        update(viewRect());
+        m_viewStart = start;
+        m_viewEnd = end;
+        update(viewRect());
+    }
+
+protected:
+    void paintEvent(QPaintEvent* ev) override
+    {
+        ensureBackground();
+
+        QPainter p(this);
+        const QRect dirty = ev->rect();
+        const qreal dpr = m_background.devicePixelRatio();
+        p.drawPixmap(QRectF(dirty), m_background,
+            QRectF(dirty.x() * dpr, dirty.y() * dpr,
+                dirty.width() * dpr, dirty.height() * dpr));
+
+        const QRect vr = viewRect();
+        if (!vr.isNull()) {
+            p.setPen(QPen(QColor(255, 255, 255, 220), 1));
+            p.setBrush(QColor(255, 255, 255, 40));
+            p.drawRect(QRectF(vr).adjusted(0.5, 0.5, -0.5, -0.5));
+        }
+    }
+
+    void mousePressEvent(QMouseEvent* ev) override
+    {
+        const double dur = m_doc->duration();
+        if (ev->button() != Qt::LeftButton || dur <= 0.0 || !m_onJump) {
+            QWidget::mousePressEvent(ev);
+            return;
+        }
+        const double f = ev->position().x() / std::max(1, width());
+        m_onJump(std::clamp(f, 0.0, 1.0) * dur);
+    }
+
+private:
+    void invalidateBackground()
+    {
+        m_bgDirty = true;
+        update();
+    }
+
+    void ensureBackground()
+    {
+        const qreal dpr = devicePixelRatioF();
+        const QSize px(qRound(width() * dpr), qRound(height() * dpr));
+        if (!m_bgDirty && m_background.size() == px
+            && m_background.devicePixelRatio() == dpr)
+            return;
+
+        m_background = QPixmap(px);
+        m_background.setDevicePixelRatio(dpr);
+        QPainter p(&m_background);
+        paintBackground(p);
+        m_bgDirty = false;
+    }
+
+    void paintBackground(QPainter& p)
+    {
+        p.fillRect(rect(), QColor(0, 20, 40));
+        const double dur = m_doc->duration();
+        if (dur <= 0.0) return;
+
+        const int w = std::max(1, width());
+        const double h = height();
+        const double pxPerSec = w / dur;
+
+        // dải câu: [0] chưa confirm, [1] đã confirm
+        QVector<QRectF> bands[2];
+        for (const Sentence& s : m_doc->sentences) {
+            if (s.begin < 0.0 || s.end <= s.begin) continue;
+            const double x1 = s.begin * pxPerSec;
+            const double x2 = std::max(x1 + 1.0, s.end * pxPerSec);
+            QVector<QRectF>& v = bands[s.confirm ? 1 : 0];
+            if (!v.isEmpty() && x1 >= v.last().left()
+                && x1 <= v.last().right() + 0.5)
+                v.last().setRight(std::max(v.last().right(), x2));
+            else
+                v.append(QRectF(x1, 0.0, x2 - x1, h));
+        }
+        p.setPen(Qt::NoPen);
+        p.setBrush(QColor(255, 170, 60, 110));
+        p.drawRects(bands[0]);
+        p.setBrush(QColor(80, 200, 120, 110));
+        p.drawRects(bands[1]);
+
+        // peaks thô: một vạch min/max mỗi pixel, vẽ bằng một lần drawLines
+        const QSharedPointer<const WavePeaks> peaks = m_doc->peaks;
+        if (!peaks || peaks->isEmpty()) return;
+        const WavePeaks::Level& lv =
+            peaks->levelFor(dur * peaks->sampleRate / w);
+        const double perSec = double(peaks->sampleRate) / lv.framesPerPeak;
+        const qsizetype n = lv.minv.size();
+        const double mid = h / 2.0;
+        const double scale = h * 0.45 / peaks->absMax;
+
+        QVector<QLineF> lines;
+        lines.reserve(w);
+        for (int x = 0; x < w; ++x) {
+            const qsizetype i0 = std::clamp<qsizetype>(
+                qsizetype(x / pxPerSec * perSec), 0, n - 1);
+            const qsizetype i1 = std::clamp<qsizetype>(
+                qsizetype(std::ceil((x + 1) / pxPerSec * perSec)), i0 + 1, n);
+            int lo = 0, hi = 0;
+            for (qsizetype k = i0; k < i1; ++k) {
+                lo = std::min<int>(lo, lv.minv[k]);
+                hi = std::max<int>(hi, lv.maxv[k]);
+            }
+            lines.append(QLineF(x + 0.5, mid - hi * scale,
+                x + 0.5, mid - lo * scale));
+        }
+        p.setPen(QPen(QColor(0, 190, 220), 1));
+        p.drawLines(lines);
+    }
+
+    QRect viewRect() const
+    {
+        const double dur = m_doc->duration();
+        if (dur <= 0.0 || m_viewEnd <= m_viewStart) return QRect();
+        const double x1 = m_viewStart / dur * width();
+        const double x2 = m_viewEnd / dur * width();
+        return QRectF(x1, 0.0, std::max(3.0, x2 - x1), height())
+            .toAlignedRect();
+    }
+
+    QSharedPointer<LessonDocument> m_doc;
+    JumpHandler m_onJump;
+    QPixmap m_background;
+    bool    m_bgDirty = true;
+    double  m_viewStart = 0.0;
+    double  m_viewEnd = 0.0;
 };
 
 //===================== Setup Tab =====================
@@ -458,21 +4094,32 @@ private:
 class SetupTab : public QWidget
 {
 public:
-    explicit SetupTab(QWidget* parent = nullptr)
-        : QWidget(parent)
+    SetupTab(QSharedPointer<LessonDocument> doc, AudioEngine* engine,
+        QWidget* parent = nullptr)
+        : QWidget(parent), m_doc(std::move(doc)), m_engine(engine)
+    {
+        createUi();
+        createConnections();
+        m_doc->addObserver(this, [this](LessonDocument::Change c, int row) {
+            onDocumentChanged(c, row);
+        });
+    }
+
+    ~SetupTab() override
     {
-        createUi();
-        createConnections();
+        m_doc->removeObservers(this);
     }
 
+    WaveformWidget* waveform() const { return m_waveform; }
+
 protected:
     void keyPressEvent(QKeyEvent* ev) override
     {
         if (ev->key() == Qt::Key_Space) {
             // toggle play/pause câu hiện tại
-            if (m_player->playbackState()
-                == QMediaPlayer::PlayingState) {
-                m_player->pause();
+            TraceFlow flow("ui.play");
+            if (m_engine->isPlaying()) {
+                m_engine->pause();
             }
             else {
                 playSentence();
@@ -480,20 +4127,9 @@ protected:
             ev->accept();
             return;
         }
-        if (ev->key() == Qt::Key_Left) {
-            double pos = m_player->position() / 1000.0;
-            pos -= 0.3;
-            if (pos < 0.0) pos = 0.0;
-            m_player->setPosition(qint64(pos * 1000.0));
-            ev->accept();
-            return;
-        }
-        if (ev->key() == Qt::Key_Right) {
-            double pos = m_player->position() / 1000.0;
-            pos += 0.3;
-            if (m_duration > 0.0 &&
-                pos > m_duration) pos = m_duration;
-            m_player->setPosition(qint64(pos * 1000.0));
+        if (ev->key() == Qt::Key_Left || ev->key() == Qt::Key_Right) {
+            m_seeker.nudge(ev->key() == Qt::Key_Left ? -1 : 1,
+                ev->isAutoRepeat(), m_duration);
             ev->accept();
             return;
         }
@@ -504,6 +4140,7 @@ private:
     // widgets
     QTableWidget* m_table = nullptr;
     WaveformWidget* m_waveform = nullptr;
+    OverviewWidget* m_overview = nullptr;
 
     QPushButton* m_btnOpen = nullptr;
     QPushButton* m_btnSaveSection = nullptr;
@@ -530,23 +4167,20 @@ private:
     QPushButton* m_btnZoomIn = nullptr;
     QPushButton* m_btnZoomOut = nullptr;
     QPushButton* m_btnFit = nullptr;
+    QPushButton* m_btnSpectro = nullptr;
+    QPushButton* m_btnPitch = nullptr;
 
-    // data
-    QVector<Sentence> m_sentences;
+    // data (lesson dùng chung với Practice)
+    QSharedPointer<LessonDocument> m_doc;
     int   m_currentRow = -1;
+    int   m_playedRow = -1;     // câu của lần playSentence trước (trace)
     bool  m_loopSentence = false;
     bool  m_updatingTable = false;
 
-    // audio
-    QMediaPlayer* m_player = nullptr;
-    QAudioOutput* m_audioOut = nullptr;
-    double        m_duration = 0.0;
-
-    // paths & state
-    QString m_audioPath;
-    QString m_textPath;
-    QString m_currentJsonPath;
-    double  m_playSpeed = 1.0;
+    // audio (engine dùng chung toàn ứng dụng)
+    AudioEngine* m_engine = nullptr;
+    double       m_duration = 0.0;
+    SeekCoalescer m_seeker{ m_engine };    // ←/→ giữ phím
 
 private:
     void createUi()
@@ -679,18 +4313,31 @@ private:
         m_btnZoomIn = new QPushButton("+");
         m_btnZoomOut = new QPushButton("-");
         m_btnFit = new QPushButton("[]");
+        m_btnSpectro = new QPushButton("Spec");
+        m_btnSpectro->setCheckable(true);
+        m_btnSpectro->setToolTip("Spectrogram view");
+        m_btnPitch = new QPushButton("F0");
+        m_btnPitch->setCheckable(true);
+        m_btnPitch->setToolTip("Pitch contour overlay");
         m_btnZoomIn->setFixedSize(40, 40);
         m_btnZoomOut->setFixedSize(40, 40);
         m_btnFit->setFixedSize(40, 40);
+        m_btnSpectro->setFixedSize(40, 40);
+        m_btnPitch->setFixedSize(40, 40);
 
         QVBoxLayout* zoomLayout = new QVBoxLayout;
         zoomLayout->addWidget(m_btnZoomIn);
         zoomLayout->addWidget(m_btnZoomOut);
         zoomLayout->addWidget(m_btnFit);
+        zoomLayout->addWidget(m_btnSpectro);
+        zoomLayout->addWidget(m_btnPitch);
         zoomLayout->addStretch();
 
         // --- waveform ---
         m_waveform = new WaveformWidget;
+        m_waveform->setEngine(m_engine);
+        m_waveform->setDocument(m_doc);
+        m_overview = new OverviewWidget(m_doc);
 
         // --- mid row (controls + time + zoom) ---
         QHBoxLayout* midRow = new QHBoxLayout;
@@ -701,40 +4348,13 @@ private:
         QVBoxLayout* rightCol = new QVBoxLayout;
         rightCol->addWidget(m_table, 4);
         rightCol->addLayout(midRow);
+        rightCol->addWidget(m_overview);
         rightCol->addWidget(m_waveform, 2);
 
         QHBoxLayout* mainLayout = new QHBoxLayout(this);
         mainLayout->addLayout(leftCol, 0);
         mainLayout->addLayout(rightCol, 1);
         setLayout(mainLayout);
-
-        // --- audio player ---
-        m_player = new QMediaPlayer(this);
-        m_audioOut = new QAudioOutput(this);
-        m_player->setAudioOutput(m_audioOut);
-
-        connect(m_player, &QMediaPlayer::durationChanged,
-            this, [this](qint64 ms) {
-                m_duration = ms / 1000.0;
-                m_waveform->setDuration(m_duration);
-                autoAssignTimesIfEmpty();
-            });
-
-        connect(m_player, &QMediaPlayer::positionChanged,
-            this, [this](qint64 posMs) {
-                if (!m_loopSentence) return;
-                if (m_currentRow < 0 ||
-                    m_currentRow >= m_sentences.size())
-                    return;
-                const Sentence& s = m_sentences[m_currentRow];
-                if (s.begin >= 0 && s.end > s.begin) {
-                    double pos = posMs / 1000.0;
-                    if (pos > s.end + 0.05) {
-                        m_player->setPosition(
-                            qint64(s.begin * 1000.0));
-                    }
-                }
-            });
     }
 
     void createConnections()
@@ -768,15 +4388,17 @@ private:
                 if (!item) return;
                 int row = item->row();
                 int col = item->column();
-                if (row < 0 || row >= m_sentences.size())
+                if (row < 0 || row >= m_doc->sentences.size())
                     return;
                 if (col == 4) {
-                    m_sentences[row].confirm =
+                    m_doc->sentences[row].confirm =
                         (item->checkState() == Qt::Checked);
+                    m_doc->sentenceChanged(row, this);
                 }
                 else if (col == 3) {
                     // nội dung sửa tay
-                    m_sentences[row].text = item->text();
+                    m_doc->sentences[row].text = item->text();
+                    m_doc->sentenceChanged(row, this);
                 }
             });
 
@@ -788,12 +4410,16 @@ private:
         connect(m_btnPlayX, &QPushButton::clicked, this,
             [this]() { playSentence(); });
         connect(m_btnPause, &QPushButton::clicked, this,
-            [this]() { m_player->pause(); });
+            [this]() {
+                TraceFlow flow("ui.play");
+                m_engine->togglePause();
+            });
         connect(m_btnLoop, &QPushButton::clicked, this,
             [this]() {
                 m_loopSentence = !m_loopSentence;
                 m_btnLoop->setCheckable(true);
                 m_btnLoop->setChecked(m_loopSentence);
+                m_engine->setLoop(m_loopSentence);
             });
 
         // time adjust
@@ -824,6 +4450,35 @@ private:
             [this]() { m_waveform->zoomOut(); });
         connect(m_btnFit, &QPushButton::clicked, this,
             [this]() { m_waveform->fitAll();  });
+        connect(m_btnSpectro, &QPushButton::toggled, this,
+            [this](bool on) {
+                m_waveform->setViewMode(on
+                    ? WaveformWidget::ViewMode::Spectrogram
+                    : WaveformWidget::ViewMode::Waveform);
+            });
+        connect(m_btnPitch, &QPushButton::toggled, this,
+            [this](bool on) { m_waveform->setPitchVisible(on); });
+
+        // overview: khung theo view waveform; click → câu tại đó,
+        // ngoài mọi câu thì chỉ dời view
+        m_waveform->setViewChangedHandler([this](double a, double b) {
+            m_overview->setView(a, b);
+        });
+        m_overview->setJumpHandler([this](double t) {
+            const int row = sentenceAt(m_doc->sentences, t);
+            if (row >= 0)
+                goToSentence(row);
+            else
+                m_waveform->centerOn(t);
+        });
+
+        // kéo mép câu trên waveform
+        m_waveform->setSegmentEditedHandler(
+            [this](int row, double begin, double end) {
+                setTimesFromWaveform(row, begin, end);
+            });
+        m_waveform->setScrubHandler(
+            [this](double t) { m_engine->scrub(t); });
     }
 
     // -------- logic --------
@@ -875,27 +4530,18 @@ private:
         f.close();
 
         auto parts = splitTextIntoSentencesAdvanced(allText);
-        m_sentences.clear();
+        QVector<Sentence> sents;
         int id = 1;
         for (const QString& s : parts) {
             Sentence sen;
             sen.id = id++;
             sen.text = s.trimmed();
-            m_sentences.push_back(sen);
+            sents.push_back(sen);
         }
 
-        m_audioPath = audioPath;
-        m_textPath = textPath;
-        m_currentJsonPath.clear();
-
-        // load audio
-        m_player->setSource(QUrl::fromLocalFile(audioPath));
-        m_player->stop();
-
-        rebuildTable();
-        if (!m_sentences.isEmpty()) {
-            goToSentence(0);
-        }
+        // audio + bảng được nạp lại qua onDocumentChanged(Reset)
+        m_doc->setLesson(audioPath, textPath, QString(),
+            m_doc->playSpeed, 0, sents);
 
         // Tìm JSON cùng tên
         QFileInfo info(audioPath);
@@ -935,9 +4581,12 @@ private:
         int lastSent = 0;
         QVector<Sentence> sents;
 
+        QString err;
         if (!loadLessonJson(jsonPath, audio, text,
-            sents, speed, lastSent))
+            sents, speed, lastSent, &err)) {
+            QMessageBox::warning(this, "Error", err);
             return;
+        }
 
         // kiểm tra audio tồn tại
         if (!QFile::exists(audio)) {
@@ -952,50 +4601,79 @@ private:
             audio = newAudio;
         }
 
-        m_audioPath = audio;
-        m_textPath = text;
-        m_playSpeed = speed;
-        m_currentJsonPath = jsonPath;
-
-        m_sentences = sents;
-
-        m_player->setSource(QUrl::fromLocalFile(m_audioPath));
-        m_player->setPlaybackRate(m_playSpeed);
-        m_player->stop();
+        m_doc->setLesson(audio, text, jsonPath, speed, lastSent, sents);
+    }
 
-        rebuildTable();
+    void onDocumentChanged(LessonDocument::Change change, int row)
+    {
+        switch (change) {
+        case LessonDocument::Change::Reset: {
+            m_engine->setSource(m_doc->pcm);
+            m_engine->stop();
+            m_waveform->setPeaks(m_doc->peaks);
+            m_duration = m_doc->duration();
+            m_waveform->setDuration(m_duration);
 
-        if (!m_sentences.isEmpty()) {
-            if (lastSent < 0 || lastSent >= m_sentences.size())
-                lastSent = 0;
-            goToSentence(lastSent);
+            rebuildTable();
+            m_currentRow = -1;
+            if (!m_doc->sentences.isEmpty()) {
+                int lastSent = m_doc->lastSentence;
+                if (lastSent < 0 || lastSent >= m_doc->sentences.size())
+                    lastSent = 0;
+                goToSentence(lastSent);
+            }
+            autoAssignTimesIfEmpty();
+            break;
+        }
+        case LessonDocument::Change::Sentences:
+            rebuildTable();
+            if (m_currentRow >= m_doc->sentences.size())
+                m_currentRow = m_doc->sentences.size() - 1;
+            if (m_currentRow >= 0)
+                goToSentence(m_currentRow);
+            break;
+        case LessonDocument::Change::Gains:
+            break;
+        case LessonDocument::Change::Sentence: {
+            const Sentence& s = m_doc->sentences[row];
+            m_updatingTable = true;
+            if (auto* it = m_table->item(row, 3))
+                it->setText(s.text);
+            if (auto* it = m_table->item(row, 4))
+                it->setCheckState(s.confirm ? Qt::Checked : Qt::Unchecked);
+            m_updatingTable = false;
+            updateRow(row);
+            if (row == m_currentRow)
+                goToSentence(row);
+            break;
+        }
         }
     }
 
     void onSaveSection()
     {
-        if (m_audioPath.isEmpty() || m_sentences.isEmpty()) {
+        if (m_doc->audioPath.isEmpty() || m_doc->sentences.isEmpty()) {
             QMessageBox::information(this, "Info",
                 "Nothing to save.");
             return;
         }
-        if (m_currentJsonPath.isEmpty()) {
+        if (m_doc->jsonPath.isEmpty()) {
             onSaveAs();
             return;
         }
-        saveCurrentLesson(m_currentJsonPath);
+        saveCurrentLesson(m_doc->jsonPath);
     }
 
     void onSaveAs()
     {
-        if (m_audioPath.isEmpty() || m_sentences.isEmpty()) {
+        if (m_doc->audioPath.isEmpty() || m_doc->sentences.isEmpty()) {
             QMessageBox::information(this, "Info",
                 "Nothing to save.");
             return;
         }
 
-        QString dir = QFileInfo(m_audioPath).absolutePath();
-        QString base = QFileInfo(m_audioPath).completeBaseName();
+        QString dir = QFileInfo(m_doc->audioPath).absolutePath();
+        QString base = QFileInfo(m_doc->audioPath).completeBaseName();
         QString defName = dir + "/" + base + ".json";
 
         QString jsonPath = QFileDialog::getSaveFileName(
@@ -1007,15 +4685,17 @@ private:
             jsonPath += ".json";
 
         if (saveCurrentLesson(jsonPath)) {
-            m_currentJsonPath = jsonPath;
+            m_doc->jsonPath = jsonPath;
         }
     }
 
     bool saveCurrentLesson(const QString& jsonPath)
     {
         int lastSent = std::max(0, m_currentRow);
-        if (!saveLessonJson(jsonPath, m_audioPath, m_textPath,
-            m_sentences, m_playSpeed, lastSent)) {
+        QString err;
+        if (!saveLessonJson(jsonPath, m_doc->audioPath, m_doc->textPath,
+            m_doc->sentences, m_doc->playSpeed, lastSent, &err)) {
+            QMessageBox::warning(this, "Error", err);
             return false;
         }
         QMessageBox::information(this, "Saved",
@@ -1026,23 +4706,25 @@ private:
     void onNewTalk()
     {
         if (m_currentRow < 0 ||
-            m_currentRow >= m_sentences.size()) {
+            m_currentRow >= m_doc->sentences.size()) {
             // thêm vào cuối
             Sentence s;
-            s.id = m_sentences.size() + 1;
-            m_sentences.push_back(s);
+            s.id = m_doc->sentences.size() + 1;
+            m_doc->sentences.push_back(s);
+            m_doc->sentencesChanged(this);
             rebuildTable();
-            goToSentence(m_sentences.size() - 1);
+            goToSentence(m_doc->sentences.size() - 1);
             return;
         }
 
         Sentence s;
         s.id = m_currentRow + 2;
-        m_sentences.insert(m_currentRow + 1, s);
+        m_doc->sentences.insert(m_currentRow + 1, s);
 
         // renumber
-        for (int i = 0; i < m_sentences.size(); ++i)
-            m_sentences[i].id = i + 1;
+        for (int i = 0; i < m_doc->sentences.size(); ++i)
+            m_doc->sentences[i].id = i + 1;
+        m_doc->sentencesChanged(this);
 
         rebuildTable();
         goToSentence(m_currentRow + 1);
@@ -1051,16 +4733,17 @@ private:
     void onDeleteRow()
     {
         if (m_currentRow < 0 ||
-            m_currentRow >= m_sentences.size())
+            m_currentRow >= m_doc->sentences.size())
             return;
-        m_sentences.removeAt(m_currentRow);
+        m_doc->sentences.removeAt(m_currentRow);
         // renumber
-        for (int i = 0; i < m_sentences.size(); ++i)
-            m_sentences[i].id = i + 1;
+        for (int i = 0; i < m_doc->sentences.size(); ++i)
+            m_doc->sentences[i].id = i + 1;
+        m_doc->sentencesChanged(this);
 
         rebuildTable();
-        if (m_currentRow >= m_sentences.size())
-            m_currentRow = m_sentences.size() - 1;
+        if (m_currentRow >= m_doc->sentences.size())
+            m_currentRow = m_doc->sentences.size() - 1;
         if (m_currentRow >= 0)
             goToSentence(m_currentRow);
         else {
@@ -1073,14 +4756,14 @@ private:
 
     void onRowClicked(int row)
     {
-        if (row < 0 || row >= m_sentences.size())
+        if (row < 0 || row >= m_doc->sentences.size())
             return;
         goToSentence(row);
     }
 
     void onRowDoubleClicked(int row)
     {
-        if (row < 0 || row >= m_sentences.size())
+        if (row < 0 || row >= m_doc->sentences.size())
             return;
         goToSentence(row);
         playSentence();
@@ -1088,7 +4771,7 @@ private:
 
     void goToSentence(int row)
     {
-        if (row < 0 || row >= m_sentences.size())
+        if (row < 0 || row >= m_doc->sentences.size())
             return;
         m_currentRow = row;
 
@@ -1100,7 +4783,7 @@ private:
         m_lblSentenceIdx->setText(
             QString("Câu %1").arg(row + 1));
 
-        const Sentence& s = m_sentences[row];
+        const Sentence& s = m_doc->sentences[row];
         m_editBegin->setText(formatTime(s.begin));
         m_editEnd->setText(formatTime(s.end));
         m_waveform->setSelection(s.begin, s.end);
@@ -1110,28 +4793,38 @@ private:
 
     void playSentence()
     {
+        if (!m_engine->hasSource()) {
+            QMessageBox::warning(this, "Audio",
+                "Audio file not found or cannot be decoded.");
+            return;
+        }
+        TraceFlow flow(playTraceName(m_playedRow, m_currentRow,
+            m_loopSentence));
+        m_playedRow = m_currentRow;
+        m_engine->setRate(m_doc->playSpeed);
         if (m_currentRow < 0 ||
-            m_currentRow >= m_sentences.size()) {
-            m_player->play();
+            m_currentRow >= m_doc->sentences.size()) {
+            m_engine->play();
             return;
         }
 
-        const Sentence& s = m_sentences[m_currentRow];
-        if (s.begin >= 0.0)
-            m_player->setPosition(
-                qint64(s.begin * 1000.0));
-        m_player->setPlaybackRate(m_playSpeed);
-        m_player->play();
+        const Sentence& s = m_doc->sentences[m_currentRow];
+        if (s.begin >= 0.0 && s.end > s.begin)
+            m_engine->playRange(s.begin, s.end, m_loopSentence);
+        else if (s.begin >= 0.0)
+            m_engine->playRange(s.begin, -1.0);
+        else
+            m_engine->play();
     }
 
     void setTimeFromPlayHead(bool isBegin)
     {
         if (m_currentRow < 0 ||
-            m_currentRow >= m_sentences.size())
+            m_currentRow >= m_doc->sentences.size())
             return;
 
-        double t = m_player->position() / 1000.0;
-        Sentence& s = m_sentences[m_currentRow];
+        double t = m_engine->playhead();
+        Sentence& s = m_doc->sentences[m_currentRow];
         bool changed = false;
 
         if (isBegin) {
@@ -1158,13 +4851,14 @@ private:
             }
             updateRow(m_currentRow);
             m_waveform->setSelection(s.begin, s.end);
+            m_doc->sentenceChanged(m_currentRow, this);
         }
     }
 
     void setTimeFromEditor(bool isBegin)
     {
         if (m_currentRow < 0 ||
-            m_currentRow >= m_sentences.size())
+            m_currentRow >= m_doc->sentences.size())
             return;
 
         double t = parseTime(isBegin ?
@@ -1172,7 +4866,7 @@ private:
             : m_editEnd->text());
         if (t < 0.0) return;
 
-        Sentence& s = m_sentences[m_currentRow];
+        Sentence& s = m_doc->sentences[m_currentRow];
         bool changed = false;
 
         if (isBegin) {
@@ -1199,15 +4893,42 @@ private:
             }
             updateRow(m_currentRow);
             m_waveform->setSelection(s.begin, s.end);
+            m_doc->sentenceChanged(m_currentRow, this);
+        }
+    }
+
+    void setTimesFromWaveform(int row, double begin, double end)
+    {
+        if (row < 0 || row >= m_doc->sentences.size())
+            return;
+        Sentence& s = m_doc->sentences[row];
+        s.begin = begin;
+        s.end = end;
+
+        if (s.confirm) {
+            s.confirm = false;
+            if (auto* it = m_table->item(row, 4)) {
+                m_updatingTable = true;
+                it->setCheckState(Qt::Unchecked);
+                m_updatingTable = false;
+            }
+        }
+
+        if (row == m_currentRow) {
+            m_editBegin->setText(formatTime(s.begin));
+            m_editEnd->setText(formatTime(s.end));
+            m_waveform->setSelection(s.begin, s.end);
         }
+        updateRow(row);
+        m_doc->sentenceChanged(row, this);
     }
 
     void adjustTime(bool isBegin, double delta)
     {
         if (m_currentRow < 0 ||
-            m_currentRow >= m_sentences.size())
+            m_currentRow >= m_doc->sentences.size())
             return;
-        Sentence& s = m_sentences[m_currentRow];
+        Sentence& s = m_doc->sentences[m_currentRow];
         double* val = isBegin ? &s.begin : &s.end;
         if (*val < 0.0) *val = 0.0;
         *val += delta;
@@ -1229,57 +4950,37 @@ private:
 
         updateRow(m_currentRow);
         m_waveform->setSelection(s.begin, s.end);
+        m_doc->sentenceChanged(m_currentRow, this);
+
+        // nghe ngay mép mới, không cần bấm play lại
+        m_engine->scrub(*val);
     }
 
     void autoAssignTimesIfEmpty()
     {
-        // Thay cho Whisper: tạm gán Begin/End theo số từ
-        if (m_duration <= 0.0) return;
-        if (m_sentences.isEmpty()) return;
-
-        bool allUnset = true;
-        for (const Sentence& s : m_sentences) {
-            if (s.begin >= 0.0 && s.end > s.begin) {
-                allUnset = false;
-                break;
-            }
-        }
-        if (!allUnset) return;
-
-        int totalWords = 0;
-        QVector<int> wordCounts;
-        for (const Sentence& s : m_sentences) {
-            int c = countWords(s.text);
-            if (c <= 0) c = 1;
-            wordCounts.push_back(c);
-            totalWords += c;
-        }
-        if (totalWords <= 0) totalWords = m_sentences.size();
-
-        double t = 0.0;
-        for (int i = 0; i < m_sentences.size(); ++i) {
-            double frac =
-                double(wordCounts[i]) / double(totalWords);
-            double len = m_duration * frac;
-            m_sentences[i].begin = t;
-            m_sentences[i].end = t + len;
-            t += len;
+        if (!assignTimesByWordCount(m_doc->sentences, m_duration))
+            return;
+        // mọi câu vừa có thời gian mới: loudness cũ (nếu có) không còn đúng
+        for (Sentence& s : m_doc->sentences) {
+            s.loudness = std::numeric_limits<double>::quiet_NaN();
+            s.peakDb = std::numeric_limits<double>::quiet_NaN();
         }
+        m_doc->sentencesChanged(this);
         rebuildTable();
         if (m_currentRow >= 0 &&
-            m_currentRow < m_sentences.size()) {
+            m_currentRow < m_doc->sentences.size()) {
             m_waveform->setSelection(
-                m_sentences[m_currentRow].begin,
-                m_sentences[m_currentRow].end);
+                m_doc->sentences[m_currentRow].begin,
+                m_doc->sentences[m_currentRow].end);
         }
     }
 
     void rebuildTable()
     {
         m_updatingTable = true;
-        m_table->setRowCount(m_sentences.size());
-        for (int i = 0; i < m_sentences.size(); ++i) {
-            const Sentence& s = m_sentences[i];
+        m_table->setRowCount(m_doc->sentences.size());
+        for (int i = 0; i < m_doc->sentences.size(); ++i) {
+            const Sentence& s = m_doc->sentences[i];
 
             auto* noItem =
                 new QTableWidgetItem(
@@ -1309,8 +5010,8 @@ private:
 
     void updateRow(int row)
     {
-        if (row < 0 || row >= m_sentences.size()) return;
-        const Sentence& s = m_sentences[row];
+        if (row < 0 || row >= m_doc->sentences.size()) return;
+        const Sentence& s = m_doc->sentences[row];
         if (auto* it = m_table->item(row, 1)) {
             m_updatingTable = true;
             it->setText(formatTime(s.begin));
@@ -1329,18 +5030,30 @@ private:
 class PracticeTab : public QWidget
 {
 public:
-    explicit PracticeTab(QWidget* parent = nullptr)
-        : QWidget(parent)
+    PracticeTab(QSharedPointer<LessonDocument> doc, AudioEngine* engine,
+        QWidget* parent = nullptr)
+        : QWidget(parent), m_doc(std::move(doc)), m_engine(engine)
     {
         createUi();
         createConnections();
+        m_doc->addObserver(this, [this](LessonDocument::Change c, int row) {
+            onDocumentChanged(c, row);
+        });
+    }
+
+    ~PracticeTab() override
+    {
+        m_doc->removeObservers(this);
     }
 
+    WaveformWidget* waveform() const { return m_wave; }
+
 private:
     // UI
     QTableWidget* m_tblSent = nullptr;
     QTableWidget* m_tblVocab = nullptr;
     WaveformWidget* m_wave = nullptr;
+    OverviewWidget* m_overview = nullptr;
 
     QPushButton* m_btnOpen = nullptr;
     QPushButton* m_btnSaveSection = nullptr;
@@ -1354,6 +5067,17 @@ private:
     QPushButton* m_btnNext = nullptr;
     QPushButton* m_btnLoop = nullptr;
     QLabel* m_lblIdx = nullptr;
+    QLabel* m_lblText = nullptr;   // câu hiện tại, mỗi từ là link
+
+    // shadowing: thu giọng rồi so A (mẫu) / B (mình) / A+B (chồng nhau)
+    QPushButton* m_btnRec = nullptr;
+    QPushButton* m_btnA = nullptr;
+    QPushButton* m_btnB = nullptr;
+    QPushButton* m_btnAB = nullptr;
+    Recorder m_recorder;
+    quint32  m_recordKey = 0;   // câu đang thu (Sentence::key), 0 = không
+    QLabel*  m_lblScore = nullptr;     // kết quả so take ↔ mẫu
+    QHash<quint32, TakeScore> m_scores;     // theo Sentence::key như take
 
     QVector<QPushButton*> m_speedButtons;
     double m_playSpeed = 1.0;
@@ -1361,20 +5085,37 @@ private:
     QPushButton* m_btnZIn = nullptr;
     QPushButton* m_btnZOut = nullptr;
     QPushButton* m_btnFit = nullptr;
+    QPushButton* m_btnPitch = nullptr;
+    QPushButton* m_btnLevel = nullptr;     // chuẩn hoá loudness theo câu
+
+    // Hide: ẩn theo từ, layout dựng sẵn cho mọi câu
+    QComboBox*   m_cmbCloze = nullptr;
+    QSpinBox*    m_spinClozeN = nullptr;
+    QPushButton* m_btnHideAll = nullptr;
+    QVector<ClozeLayout> m_cloze;      // theo row
+    ClozeMode m_clozeMode = ClozeMode::AllWords;
+    int       m_clozeN = 3;
 
     // data
-    QVector<Sentence> m_sentences;
+    QSharedPointer<LessonDocument> m_doc;
     int   m_currentRow = -1;
+    int   m_playedRow = -1;     // câu của lần playSentence trước (trace)
     bool  m_loopSentence = false;
     bool  m_updatingTable = false;
 
-    // audio
-    QMediaPlayer* m_player = nullptr;
-    QAudioOutput* m_audioOut = nullptr;
-    double        m_duration = 0.0;
-    QString       m_audioPath;
-    QString       m_textPath;
-    QString       m_jsonPath;
+    // audio (engine dùng chung toàn ứng dụng)
+    AudioEngine* m_engine = nullptr;
+    double       m_duration = 0.0;
+
+    // drill: nghe câu, lặng để nhắc lại, câu kế tiếp...
+    QPushButton*    m_btnDrill = nullptr;
+    QDoubleSpinBox* m_spinGap = nullptr;    // lặng = hệ số × độ dài câu
+    QCheckBox*      m_chkChain = nullptr;   // hết lesson thì mở lesson kế
+    DrillScheduler  m_drill{ m_engine, m_doc.data() };
+    bool            m_drillOnLoad = false;  // drill nối lesson: chờ Reset
+
+    // tra từ → (câu, vị trí từ) để phát từng từ
+    QVector<WordOccurrence> m_wordIndex;
 
 private:
     void createUi()
@@ -1457,6 +5198,19 @@ private:
             b->setFixedSize(40, 40);
         }
 
+        m_btnRec = new QPushButton("Rec");
+        m_btnRec->setCheckable(true);
+        m_btnRec->setToolTip("Record yourself for this sentence");
+        m_btnA = new QPushButton("A");
+        m_btnA->setToolTip("Play the model");
+        m_btnB = new QPushButton("B");
+        m_btnB->setToolTip("Play your take");
+        m_btnAB = new QPushButton("A+B");
+        m_btnAB->setToolTip("Play model and take together");
+        for (QPushButton* b : { m_btnRec, m_btnA, m_btnB, m_btnAB }) {
+            b->setFixedSize(48, 40);
+        }
+
         QFont f = m_lblIdx->font();
         f.setPointSize(18);
         f.setBold(true);
@@ -1471,12 +5225,29 @@ private:
         sentCtrl->addSpacing(20);
         sentCtrl->addWidget(m_lblIdx);
         sentCtrl->addStretch();
+        sentCtrl->addWidget(m_btnRec);
+        sentCtrl->addWidget(m_btnA);
+        sentCtrl->addWidget(m_btnB);
+        sentCtrl->addWidget(m_btnAB);
 
         QWidget* sentBar = new QWidget;
         sentBar->setLayout(sentCtrl);
         sentBar->setStyleSheet(
             "background-color: #d8f5c0; border:1px solid gray;");
 
+        // Current sentence text: click a word to hear it
+        m_lblText = new QLabel;
+        m_lblText->setTextFormat(Qt::RichText);
+        m_lblText->setWordWrap(true);
+        m_lblText->setTextInteractionFlags(
+            Qt::LinksAccessibleByMouse);
+        QFont tf = m_lblText->font();
+        tf.setPointSize(14);
+        m_lblText->setFont(tf);
+
+        m_lblScore = new QLabel;
+        m_lblScore->setStyleSheet("color: #555;");
+
         // Speed buttons
         QHBoxLayout* speedLayout = new QHBoxLayout;
         QStringList speeds{ "0.5x", "0.75x", "1.0", "1.2x", "1.5x" };
@@ -1491,6 +5262,44 @@ private:
         }
         speedLayout->addStretch();
 
+        // Hide mode
+        m_cmbCloze = new QComboBox;
+        m_cmbCloze->addItem("All words", int(ClozeMode::AllWords));
+        m_cmbCloze->addItem("Every Nth word", int(ClozeMode::EveryNth));
+        m_cmbCloze->addItem("Vocab words", int(ClozeMode::ContentWords));
+        m_cmbCloze->addItem("Function words", int(ClozeMode::FunctionWords));
+        m_spinClozeN = new QSpinBox;
+        m_spinClozeN->setRange(2, 9);
+        m_spinClozeN->setValue(m_clozeN);
+        m_spinClozeN->setPrefix("N=");
+        m_spinClozeN->setEnabled(false);
+        m_btnHideAll = new QPushButton("Hide all");
+        m_btnHideAll->setCheckable(true);
+        speedLayout->addWidget(new QLabel("Hide:"));
+        speedLayout->addWidget(m_cmbCloze);
+        speedLayout->addWidget(m_spinClozeN);
+        speedLayout->addWidget(m_btnHideAll);
+
+        m_btnDrill = new QPushButton("Drill");
+        m_btnDrill->setCheckable(true);
+        m_btnDrill->setToolTip("Play every sentence from here, with a "
+            "silent gap after each one to repeat it");
+        m_spinGap = new QDoubleSpinBox;
+        m_spinGap->setRange(0.0, 3.0);
+        m_spinGap->setSingleStep(0.25);
+        m_spinGap->setValue(1.0);
+        m_spinGap->setPrefix("gap ");
+        m_spinGap->setSuffix("x");
+        m_spinGap->setToolTip("Gap length relative to the sentence "
+            "(at the current speed); 0 = no gap");
+        m_chkChain = new QCheckBox("Next lesson");
+        m_chkChain->setToolTip("When the lesson ends, open the next JSON "
+            "in the same folder and keep drilling");
+        speedLayout->addSpacing(12);
+        speedLayout->addWidget(m_btnDrill);
+        speedLayout->addWidget(m_spinGap);
+        speedLayout->addWidget(m_chkChain);
+
         // Zoom buttons
         m_btnZIn = new QPushButton("+");
         m_btnZOut = new QPushButton("-");
@@ -1498,52 +5307,46 @@ private:
         m_btnZIn->setFixedSize(40, 40);
         m_btnZOut->setFixedSize(40, 40);
         m_btnFit->setFixedSize(40, 40);
+        m_btnPitch = new QPushButton("F0");
+        m_btnPitch->setCheckable(true);
+        m_btnPitch->setChecked(true);
+        m_btnPitch->setToolTip("Pitch contour: model (yellow), you (pink)");
+        m_btnPitch->setFixedSize(40, 40);
+        m_btnLevel = new QPushButton("Lv");
+        m_btnLevel->setCheckable(true);
+        m_btnLevel->setChecked(true);
+        m_btnLevel->setToolTip(
+            "Even out loudness between sentences (EBU R128)");
+        m_btnLevel->setFixedSize(40, 40);
         QHBoxLayout* zoomLayout = new QHBoxLayout;
         zoomLayout->addStretch();
+        zoomLayout->addWidget(m_btnLevel);
+        zoomLayout->addWidget(m_btnPitch);
         zoomLayout->addWidget(m_btnZIn);
         zoomLayout->addWidget(m_btnZOut);
         zoomLayout->addWidget(m_btnFit);
 
         // waveform
         m_wave = new WaveformWidget;
+        m_wave->setEngine(m_engine);
+        m_wave->setDocument(m_doc);     // chỉ hiển thị, không kéo mép
+        m_wave->setPitchVisible(true);
+        m_overview = new OverviewWidget(m_doc);
 
         QVBoxLayout* rightCol = new QVBoxLayout;
         rightCol->addLayout(topRow, 3);
         rightCol->addWidget(sentBar);
+        rightCol->addWidget(m_lblText);
+        rightCol->addWidget(m_lblScore);
         rightCol->addLayout(speedLayout);
         rightCol->addLayout(zoomLayout);
+        rightCol->addWidget(m_overview);
         rightCol->addWidget(m_wave, 2);
 
         QHBoxLayout* main = new QHBoxLayout(this);
         main->addLayout(leftCol, 0);
         main->addLayout(rightCol, 1);
         setLayout(main);
-
-        // audio
-        m_player = new QMediaPlayer(this);
-        m_audioOut = new QAudioOutput(this);
-        m_player->setAudioOutput(m_audioOut);
-
-        connect(m_player, &QMediaPlayer::durationChanged,
-            this, [this](qint64 ms) {
-                m_duration = ms / 1000.0;
-                m_wave->setDuration(m_duration);
-            });
-        connect(m_player, &QMediaPlayer::positionChanged,
-            this, [this](qint64 posMs) {
-                if (!m_loopSentence) return;
-                if (m_currentRow < 0 ||
-                    m_currentRow >= m_sentences.size())
-                    return;
-                const Sentence& s = m_sentences[m_currentRow];
-                if (s.begin >= 0 && s.end > s.begin) {
-                    double pos = posMs / 1000.0;
-                    if (pos > s.end + 0.05) {
-                        m_player->setPosition(
-                            qint64(s.begin * 1000.0));
-                    }
-                }
-            });
     }
 
     void createConnections()
@@ -1573,6 +5376,41 @@ private:
                 selectSentence(row, true);
             });
 
+        connect(m_cmbCloze, &QComboBox::currentIndexChanged,
+            this, [this](int) {
+                m_clozeMode = ClozeMode(m_cmbCloze->currentData().toInt());
+                m_spinClozeN->setEnabled(m_clozeMode == ClozeMode::EveryNth);
+                remaskCloze();
+            });
+        connect(m_spinClozeN, &QSpinBox::valueChanged,
+            this, [this](int n) {
+                m_clozeN = n;
+                remaskCloze();
+            });
+        connect(m_btnHideAll, &QPushButton::toggled,
+            this, [this](bool on) {
+                m_tblSent->setUpdatesEnabled(false);
+                for (int i = 0; i < m_tblSent->rowCount(); ++i)
+                    setRowHidden(i, on);
+                m_tblSent->setUpdatesEnabled(true);
+                updateSentenceText();
+            });
+
+        // click từ → phát đúng lát của từ đó
+        connect(m_lblText, &QLabel::linkActivated,
+            this, [this](const QString& link) {
+                playWord(m_currentRow, link.toInt());
+            });
+        connect(m_tblVocab, &QTableWidget::cellClicked,
+            this, [this](int row, int) {
+                QTableWidgetItem* it = m_tblVocab->item(row, 1);
+                if (!it) return;
+                const WordOccurrence* occ =
+                    findWord(m_wordIndex, it->text());
+                if (occ)
+                    playWord(occ->row, occ->wordIdx);
+            });
+
         // sentence controls
         connect(m_btnPrev, &QPushButton::clicked,
             this, [this]() { selectSentence(
@@ -1583,13 +5421,33 @@ private:
         connect(m_btnPlayX, &QPushButton::clicked,
             this, [this]() { playSentence(); });
         connect(m_btnPause, &QPushButton::clicked,
-            this, [this]() { m_player->pause(); });
+            this, [this]() {
+                TraceFlow flow("ui.play");
+                m_engine->togglePause();
+            });
         connect(m_btnLoop, &QPushButton::clicked,
             this, [this]() {
                 m_loopSentence = !m_loopSentence;
                 m_btnLoop->setCheckable(true);
                 m_btnLoop->setChecked(m_loopSentence);
+                m_engine->setLoop(m_loopSentence);
+            });
+
+        // A/B shadowing
+        connect(m_btnRec, &QPushButton::toggled,
+            this, [this](bool on) {
+                if (on) startRecording();
+                else stopRecording();
+            });
+        connect(m_btnA, &QPushButton::clicked,
+            this, [this]() {
+                m_engine->stopTake();
+                playSentence();
             });
+        connect(m_btnB, &QPushButton::clicked,
+            this, [this]() { playTake(false); });
+        connect(m_btnAB, &QPushButton::clicked,
+            this, [this]() { playTake(true); });
 
         // speed
         for (QPushButton* b : m_speedButtons) {
@@ -1604,6 +5462,43 @@ private:
             this, [this]() { m_wave->zoomOut(); });
         connect(m_btnFit, &QPushButton::clicked,
             this, [this]() { m_wave->fitAll(); });
+        connect(m_btnPitch, &QPushButton::toggled,
+            this, [this](bool on) { m_wave->setPitchVisible(on); });
+        connect(m_btnLevel, &QPushButton::toggled,
+            this, [this](bool on) { m_engine->setNormalize(on); });
+
+        // drill
+        connect(m_btnDrill, &QPushButton::toggled,
+            this, [this](bool on) {
+                m_drillOnLoad = false;
+                if (on) startDrill(std::max(0, m_currentRow));
+                else m_drill.stop();
+            });
+        connect(m_spinGap, &QDoubleSpinBox::valueChanged,
+            this, [this](double v) { m_drill.setGapFactor(v); });
+        m_drill.setRowHandler([this](int row) { selectSentence(row, false); });
+        m_drill.setEndHandler([this](bool finished) {
+            if (finished && m_chkChain->isChecked()) {
+                // drill tiếp từ câu đầu khi lesson kế tiếp nạp xong (Reset;
+                // cùng file audio thì Reset tới ngay trong openNextLesson)
+                m_drillOnLoad = true;
+                if (openNextLesson()) return;
+                m_drillOnLoad = false;
+            }
+            QSignalBlocker block(m_btnDrill);
+            m_btnDrill->setChecked(false);
+        });
+
+        m_wave->setViewChangedHandler([this](double a, double b) {
+            m_overview->setView(a, b);
+        });
+        m_overview->setJumpHandler([this](double t) {
+            const int row = sentenceAt(m_doc->sentences, t);
+            if (row >= 0)
+                selectSentence(row, false);
+            else
+                m_wave->centerOn(t);
+        });
     }
 
     void onOpen()
@@ -1612,17 +5507,29 @@ private:
             this, "Open JSON section file", QString(),
             "JSON files (*.json);;All files (*.*)");
         if (jsonPath.isEmpty()) return;
+        loadLesson(jsonPath, true);
+    }
 
+    // interactive = báo lỗi/hỏi audio thay thế; không thì chỉ trả false
+    bool loadLesson(const QString& jsonPath, bool interactive)
+    {
         QString audio, text;
         double speed = 1.0;
         int lastSent = 0;
         QVector<Sentence> sents;
 
+        QString err;
         if (!loadLessonJson(jsonPath, audio, text,
-            sents, speed, lastSent))
-            return;
+            sents, speed, lastSent, &err)) {
+            if (interactive)
+                QMessageBox::warning(this, "Error", err);
+            return false;
+        }
+        if (!interactive && sents.isEmpty())
+            return false;
 
         if (!QFile::exists(audio)) {
+            if (!interactive) return false;
             QMessageBox::information(
                 this, "Audio missing",
                 "Audio file not found:\n" + audio +
@@ -1630,36 +5537,134 @@ private:
             QString newAudio = QFileDialog::getOpenFileName(
                 this, "Select audio file", QString(),
                 "Audio files (*.mp3 *.wav *.m4a *.flac);;All files (*.*)");
-            if (newAudio.isEmpty()) return;
+            if (newAudio.isEmpty()) return false;
             audio = newAudio;
         }
 
-        m_audioPath = audio;
-        m_textPath = text;
-        m_jsonPath = jsonPath;
-        m_playSpeed = speed;
-        m_sentences = sents;
+        m_doc->setLesson(audio, text, jsonPath, speed, lastSent, sents);
+        return true;
+    }
 
-        m_player->setSource(QUrl::fromLocalFile(m_audioPath));
-        m_player->setPlaybackRate(m_playSpeed);
-        m_player->stop();
+    // lesson kế tiếp (theo tên file) cùng thư mục với JSON đang mở; bỏ qua
+    // file không đọc được hoặc không có câu. Audio giải mã nền: lesson chỉ
+    // thay (Reset) khi xong.
+    bool openNextLesson()
+    {
+        if (m_doc->jsonPath.isEmpty()) return false;
+        const QFileInfo cur(m_doc->jsonPath);
+        const QDir dir = cur.dir();
+        const QStringList files = dir.entryList(QStringList{ "*.json" },
+            QDir::Files, QDir::Name);
+        for (int i = files.indexOf(cur.fileName()) + 1;
+            i > 0 && i < files.size(); ++i) {
+            if (loadLesson(dir.absoluteFilePath(files[i]), false))
+                return true;
+        }
+        return false;
+    }
 
-        rebuildSentenceTable();
-        rebuildVocabTable();
+    // drill từ row; nút nhả ra nếu không còn câu nào phát được
+    void startDrill(int row)
+    {
+        m_engine->setRate(m_playSpeed);
+        m_drill.setRate(m_playSpeed);
+        m_drill.setGapFactor(m_spinGap->value());
+        if (!m_engine->hasSource() || !m_drill.start(row)) {
+            QSignalBlocker block(m_btnDrill);
+            m_btnDrill->setChecked(false);
+        }
+    }
 
-        if (!m_sentences.isEmpty()) {
-            if (lastSent < 0 || lastSent >= m_sentences.size())
-                lastSent = 0;
-            selectSentence(lastSent, false);
+    void onDocumentChanged(LessonDocument::Change change, int row)
+    {
+        switch (change) {
+        case LessonDocument::Change::Reset: {
+            const bool chained = m_drillOnLoad;
+            m_drillOnLoad = false;
+            if (m_drill.isActive()) {
+                m_drill.stop();
+                QSignalBlocker block(m_btnDrill);
+                m_btnDrill->setChecked(false);
+            }
+            m_engine->setSource(m_doc->pcm);
+            m_engine->stop();
+            m_playSpeed = m_doc->playSpeed;
+            m_wave->setPeaks(m_doc->peaks);
+            m_duration = m_doc->duration();
+            m_wave->setDuration(m_duration);
+
+            rebuildSentenceTable();
+            rebuildVocabTable();
+            m_btnRec->setChecked(false);
+            m_scores.clear();
+            m_currentRow = -1;
+            updateTakeView();
+            if (!m_doc->sentences.isEmpty()) {
+                int lastSent = m_doc->lastSentence;
+                if (lastSent < 0 || lastSent >= m_doc->sentences.size())
+                    lastSent = 0;
+                selectSentence(lastSent, false);
+            }
+            if (chained)
+                startDrill(0);
+            break;
+        }
+        case LessonDocument::Change::Sentences:
+            // lịch drill giữ chỉ số dòng cũ: dừng như khi đổi lesson
+            if (m_drill.isActive()) {
+                m_drill.stop();
+                QSignalBlocker block(m_btnDrill);
+                m_btnDrill->setChecked(false);
+            }
+            // take và điểm đi theo Sentence::key; chỉ bỏ của câu đã xoá
+            m_btnRec->setChecked(false);
+            m_scores.removeIf([this](const auto& it) {
+                return !m_doc->takes.contains(it.key());
+            });
+            rebuildSentenceTable();
+            rebuildVocabTable();
+            updateTakeView();
+            if (m_currentRow >= m_doc->sentences.size())
+                m_currentRow = m_doc->sentences.size() - 1;
+            if (m_currentRow >= 0)
+                selectSentence(m_currentRow, false);
+            else
+                updateSentenceText();
+            break;
+        case LessonDocument::Change::Gains:
+            break;
+        case LessonDocument::Change::Sentence: {
+            if (row < m_cloze.size()) {
+                m_cloze[row] = buildClozeLayout(m_doc->sentences[row].text);
+                applyClozeMask(m_cloze[row], m_clozeMode, m_clozeN);
+            }
+            m_updatingTable = true;
+            if (auto* content = m_tblSent->item(row, 1)) {
+                content->setText(isRowHidden(row)
+                    ? m_cloze[row].maskedText : m_doc->sentences[row].text);
+            }
+            m_updatingTable = false;
+            rebuildVocabTable();
+            if (row == m_currentRow) {
+                const Sentence& s = m_doc->sentences[row];
+                updateSentenceText();
+                m_wave->setSelection(s.begin, s.end);
+            }
+            break;
+        }
         }
     }
 
     void rebuildSentenceTable()
     {
+        rebuildCloze();
+        QSignalBlocker block(m_btnHideAll);
+        m_btnHideAll->setChecked(false);
+
         m_updatingTable = true;
-        m_tblSent->setRowCount(m_sentences.size());
-        for (int i = 0; i < m_sentences.size(); ++i) {
-            const Sentence& s = m_sentences[i];
+        m_tblSent->setRowCount(m_doc->sentences.size());
+        for (int i = 0; i < m_doc->sentences.size(); ++i) {
+            const Sentence& s = m_doc->sentences[i];
 
             auto* noItem =
                 new QTableWidgetItem(
@@ -1687,22 +5692,13 @@ private:
 
     void rebuildVocabTable()
     {
-        // tạo list từ đơn giản (unique, lower case)
-        QSet<QString> wordSet;
-        for (const Sentence& s : m_sentences) {
-            QString tmp = s.text;
-            tmp.replace(QRegularExpression("[^A-Za-z']"), " ");
-            QStringList words = tmp.split(
-                QRegularExpression("\\s+"),
-                Qt::SkipEmptyParts);
-            for (QString w : words) {
-                w = w.toLower();
-                if (!w.isEmpty())
-                    wordSet.insert(w);
-            }
+        // list từ (unique, lower case) lấy từ chỉ mục đã sắp xếp
+        m_wordIndex = buildWordIndex(m_doc->sentences);
+        QStringList wordList;
+        for (const WordOccurrence& o : m_wordIndex) {
+            if (wordList.isEmpty() || wordList.last() != o.word)
+                wordList.push_back(o.word);
         }
-        QStringList wordList = QStringList(wordSet.begin(), wordSet.end());
-        std::sort(wordList.begin(), wordList.end());
 
         m_tblVocab->setRowCount(wordList.size());
         for (int i = 0; i < wordList.size(); ++i) {
@@ -1720,7 +5716,7 @@ private:
 
     void selectSentence(int row, bool play)
     {
-        if (row < 0 || row >= m_sentences.size())
+        if (row < 0 || row >= m_doc->sentences.size())
             return;
         m_currentRow = row;
 
@@ -1730,8 +5726,10 @@ private:
         m_updatingTable = false;
 
         m_lblIdx->setText(QString("Câu %1").arg(row + 1));
+        updateSentenceText();
+        updateTakeView();
 
-        const Sentence& s = m_sentences[row];
+        const Sentence& s = m_doc->sentences[row];
         m_wave->setSelection(s.begin, s.end);
         if (s.begin >= 0 && s.end > s.begin)
             m_wave->autoZoomToSegment(s.begin, s.end);
@@ -1742,44 +5740,192 @@ private:
 
     void playSentence()
     {
+        if (!m_engine->hasSource()) {
+            QMessageBox::warning(this, "Audio",
+                "Audio file not found. "
+                "Please reconfigure the lesson in Setup.");
+            return;
+        }
+        TraceFlow flow(playTraceName(m_playedRow, m_currentRow,
+            m_loopSentence));
+        m_playedRow = m_currentRow;
+        m_engine->setRate(m_playSpeed);
         if (m_currentRow < 0 ||
-            m_currentRow >= m_sentences.size()) {
-            m_player->play();
+            m_currentRow >= m_doc->sentences.size()) {
+            m_engine->play();
             return;
         }
-        const Sentence& s = m_sentences[m_currentRow];
-        if (s.begin >= 0.0)
-            m_player->setPosition(
-                qint64(s.begin * 1000.0));
-        m_player->setPlaybackRate(m_playSpeed);
-        m_player->play();
+        const Sentence& s = m_doc->sentences[m_currentRow];
+        if (s.begin >= 0.0 && s.end > s.begin) {
+            m_engine->playRange(s.begin, s.end, m_loopSentence);
+        }
+        else {
+            QMessageBox::information(this, "Info",
+                "This sentence has no valid Begin/End. "
+                "Please configure it in the Setup tab.");
+        }
     }
 
-    void handleHideShowClicked(int row, int col)
+    void updateSentenceText()
     {
-        if (row < 0 || row >= m_tblSent->rowCount())
+        if (m_currentRow < 0 || m_currentRow >= m_doc->sentences.size()) {
+            m_lblText->clear();
             return;
-        if (col != 2 && col != 3) return;
+        }
+        if (m_currentRow >= m_cloze.size()) return;
+        const ClozeLayout& c = m_cloze[m_currentRow];
+        m_lblText->setText(isRowHidden(m_currentRow)
+            ? c.maskedHtml : c.plainHtml);
+    }
+
+    // tách từ + cờ hư từ cho mọi câu (chạy khi document đổi, không phải
+    // khi bật/tắt Hide)
+    void rebuildCloze()
+    {
+        const QVector<Sentence>& sents = m_doc->sentences;
+        m_cloze.resize(sents.size());
+        ClozeLayout* out = m_cloze.data();
+        const ClozeMode mode = m_clozeMode;
+        const int n = m_clozeN;
+        TaskPool::instance().parallelFor(int(sents.size()),
+            [&sents, out, mode, n](int i) {
+                out[i] = buildClozeLayout(sents[i].text);
+                applyClozeMask(out[i], mode, n);
+            });
+    }
 
+    // đổi kiểu ẩn: chỉ dựng lại chuỗi ẩn từ các từ đã tách
+    void remaskCloze()
+    {
+        for (ClozeLayout& c : m_cloze)
+            applyClozeMask(c, m_clozeMode, m_clozeN);
         m_updatingTable = true;
+        for (int i = 0; i < m_cloze.size() && i < m_tblSent->rowCount(); ++i) {
+            if (!isRowHidden(i)) continue;
+            if (auto* content = m_tblSent->item(i, 1))
+                content->setText(m_cloze[i].maskedText);
+        }
+        m_updatingTable = false;
+        updateSentenceText();
+    }
+
+    bool isRowHidden(int row) const
+    {
+        const QTableWidgetItem* hideItem = m_tblSent->item(row, 2);
+        return hideItem && hideItem->checkState() == Qt::Checked;
+    }
+
+    void setRowHidden(int row, bool hidden)
+    {
         QTableWidgetItem* hideItem = m_tblSent->item(row, 2);
         QTableWidgetItem* showItem = m_tblSent->item(row, 3);
+        if (!hideItem || !showItem || row >= m_cloze.size()) return;
 
-        if (col == 2) {
-            hideItem->setCheckState(Qt::Checked);
-            showItem->setCheckState(Qt::Unchecked);
-            if (auto* content = m_tblSent->item(row, 1)) {
-                content->setText("_________________________");
+        m_updatingTable = true;
+        hideItem->setCheckState(hidden ? Qt::Checked : Qt::Unchecked);
+        showItem->setCheckState(hidden ? Qt::Unchecked : Qt::Checked);
+        if (auto* content = m_tblSent->item(row, 1)) {
+            content->setText(hidden ? m_cloze[row].maskedText
+                                    : m_doc->sentences[row].text);
+        }
+        m_updatingTable = false;
+    }
+
+    void playWord(int row, int wordIdx)
+    {
+        if (row < 0 || row >= m_doc->sentences.size())
+            return;
+        double b = 0.0, e = 0.0;
+        if (!wordRange(m_doc->sentences[row], wordIdx, b, e))
+            return;
+        m_engine->setRate(m_playSpeed);
+        m_engine->playRange(b, e);
+    }
+
+    void handleHideShowClicked(int row, int col)
+    {
+        if (row < 0 || row >= m_tblSent->rowCount())
+            return;
+        if (col != 2 && col != 3) return;
+
+        setRowHidden(row, col == 2);
+        if (row == m_currentRow)
+            updateSentenceText();
+    }
+
+    void startRecording()
+    {
+        if (m_currentRow < 0 || m_currentRow >= m_doc->sentences.size()
+            || !m_recorder.start(m_doc->pcm ? m_doc->pcm->sampleRate : 0)) {
+            QSignalBlocker block(m_btnRec);
+            m_btnRec->setChecked(false);
+            QMessageBox::warning(this, "Record",
+                "No microphone available, or no sentence selected.");
+            return;
+        }
+        m_recordKey = m_doc->sentences[m_currentRow].key;
+        m_btnRec->setStyleSheet("background-color: #ff8080;");
+    }
+
+    void stopRecording()
+    {
+        m_btnRec->setStyleSheet("");
+        QSharedPointer<const PcmData> take = m_recorder.stop();
+        // câu có thể đã dời dòng (Setup thêm/xoá) trong lúc thu
+        const int row = m_doc->rowOfKey(m_recordKey);
+        if (take && !take->isEmpty() && m_recordKey != 0 && row >= 0) {
+            m_doc->setTake(row, take);
+            m_doc->takePitch(row);      // xếp lịch ngay
+            if (m_doc->pcm) {
+                m_scores.insert(m_recordKey, scoreTake(*m_doc->pcm,
+                    m_doc->sentences[row], *take));
             }
         }
+        m_recordKey = 0;
+        updateTakeView();
+    }
+
+    // overlap = A+B: đường mẫu và take bắt đầu cùng một mẫu
+    void playTake(bool overlap)
+    {
+        const auto take = m_doc->take(m_currentRow);
+        if (!take) return;
+        if (overlap) {
+            playSentence();
+        }
         else {
-            hideItem->setCheckState(Qt::Unchecked);
-            showItem->setCheckState(Qt::Checked);
-            if (auto* content = m_tblSent->item(row, 1)) {
-                content->setText(m_sentences[row].text);
-            }
+            m_engine->stop();
         }
-        m_updatingTable = false;
+        m_engine->playTake(take);
+    }
+
+    void updateTakeView()
+    {
+        const bool has = !m_doc->take(m_currentRow).isNull();
+        m_btnB->setEnabled(has);
+        m_btnAB->setEnabled(has);
+
+        const TakeScore sc = has
+            ? m_scores.value(m_doc->sentences[m_currentRow].key) : TakeScore();
+        if (!has || !sc.valid) {
+            m_lblScore->setText(has ? "Take: no speech detected" : QString());
+            return;
+        }
+        QString text = QString("Tempo %1%  ·  rhythm ±%2 ms")
+            .arg(qRound(sc.tempo * 100.0))
+            .arg(qRound(sc.rhythmMs));
+        const QStringList words =
+            sentenceWords(m_doc->sentences[m_currentRow].text);
+        if (sc.worstWord >= 0 && sc.worstWord < words.size()) {
+            text += QString("  ·  \"%1\" %2 ms %3")
+                .arg(words[sc.worstWord])
+                .arg(qRound(std::abs(sc.worstMs)))
+                .arg(sc.worstMs > 0 ? "late" : "early");
+        }
+        text += QString("  ·  match %1").arg(sc.distance, 0, 'f', 1);
+        m_lblScore->setText(text);
+        m_lblScore->setToolTip(QString("Scored in %1 ms")
+            .arg(sc.elapsedMs, 0, 'f', 1));
     }
 
     void onSpeedButton(QPushButton* btn)
@@ -1793,7 +5939,8 @@ private:
             return;
 
         m_playSpeed = v;
-        m_player->setPlaybackRate(m_playSpeed);
+        m_engine->setRate(m_playSpeed);
+        m_drill.setRate(m_playSpeed);
 
         // highlight button
         for (QPushButton* b : m_speedButtons) {
@@ -1805,22 +5952,225 @@ private:
     }
 };
 
+//===================== Performance HUD =====================
+
+// Lớp phủ bán trong suốt ở góc trên phải (Ctrl+Shift+P): thời gian vẽ
+// waveform, underrun của sink, tốc độ giải mã, tỉ lệ trúng cache và bộ
+// nhớ lesson, cập nhật 4 lần/giây. Dòng underrun chuyển đỏ vài giây mỗi
+// khi có lần vấp mới để thấy ngay lúc đang lặp câu.
+class PerfHud : public QWidget
+{
+public:
+    using WaveformSource = std::function<WaveformWidget*()>;
+
+    PerfHud(AudioEngine* engine, QSharedPointer<LessonDocument> doc,
+        WaveformSource waveform, QWidget* parent)
+        : QWidget(parent), m_engine(engine), m_doc(std::move(doc)),
+          m_waveform(std::move(waveform))
+    {
+        setAttribute(Qt::WA_TransparentForMouseEvents);
+        QFont f("monospace");
+        f.setStyleHint(QFont::TypeWriter);
+        f.setPointSizeF(font().pointSizeF() * 0.9);
+        setFont(f);
+
+        m_timer = new QTimer(this);
+        m_timer->setInterval(kRefreshMs);
+        connect(m_timer, &QTimer::timeout, this, [this]() { refresh(); });
+        hide();
+    }
+
+    void toggle()
+    {
+        if (isVisible()) {
+            m_timer->stop();
+            hide();
+            return;
+        }
+        refresh();
+        show();
+        raise();
+        m_timer->start();
+    }
+
+protected:
+    void paintEvent(QPaintEvent*) override
+    {
+        QPainter p(this);
+        p.fillRect(rect(), QColor(0, 0, 0, 170));
+        const QFontMetrics fm(font());
+        int y = kPad + fm.ascent();
+        for (int i = 0; i < m_lines.size(); ++i) {
+            const bool alert = (i == m_underrunLine)
+                && steadyNowNs() < m_alertUntilNs;
+            p.setPen(alert ? QColor(255, 90, 90) : QColor(230, 230, 230));
+            p.drawText(kPad, y, m_lines[i]);
+            y += fm.lineSpacing();
+        }
+    }
+
+private:
+    static QString mb(qint64 bytes)
+    {
+        return QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + " MB";
+    }
+
+    static QString ratio(qint64 hits, qint64 misses)
+    {
+        const qint64 n = hits + misses;
+        return n > 0 ? QString("%1%").arg(100.0 * hits / n, 0, 'f', 1)
+                     : QString("-");
+    }
+
+    void refresh()
+    {
+        QStringList lines;
+
+        WaveformWidget* wave = m_waveform ? m_waveform() : nullptr;
+        if (wave) {
+            const WaveformWidget::PaintStats ps = wave->takePaintStats();
+            const qint64 frames = ps.frames - m_lastFrames;
+            m_lastFrames = ps.frames;
+            lines << QString("paint   %1 ms avg  %2 ms max  %3 fps")
+                .arg(ps.avgMs, 0, 'f', 2).arg(ps.maxMs, 0, 'f', 2)
+                .arg(frames * 1000 / kRefreshMs);
+        }
+
+        const AudioEngine::Stats as = m_engine->takeStats();
+        if (as.underruns > m_lastUnderruns)
+            m_alertUntilNs = steadyNowNs() + kAlertNs;
+        m_lastUnderruns = as.underruns;
+        m_underrunLine = lines.size();
+        lines << QString("audio   %1 underruns  buffer %2 ms")
+            .arg(as.underruns).arg(as.bufferMs);
+        lines << QString("        callback gap %1 ms max  render %2 ms max")
+            .arg(as.maxGapMs, 0, 'f', 1).arg(as.maxRenderMs, 0, 'f', 2);
+
+        const DecodeStats ds = lastDecodeStats();
+        if (ds.files > 0 && ds.wallSec > 0.0) {
+            lines << QString("decode  %1 s audio in %2 s (%3x)")
+                .arg(ds.audioSec, 0, 'f', 0).arg(ds.wallSec, 0, 'f', 2)
+                .arg(ds.audioSec / ds.wallSec, 0, 'f', 0);
+        }
+
+        SpectrogramCache::Stats ss;
+        if (wave && wave->spectrogramStats(ss)) {
+            lines << QString("spectro hit %1  %2 tiles %3 KB  disk %4  fft %5")
+                .arg(ratio(ss.hits, ss.misses)).arg(ss.tiles).arg(ss.kb)
+                .arg(ss.diskLoads).arg(ss.computed);
+        }
+        const PitchCache::Stats pc = m_doc->pitch.stats();
+        lines << QString("pitch   hit %1  %2 contours")
+            .arg(ratio(pc.hits, pc.misses)).arg(pc.contours);
+
+        const LessonDocument::Memory mem = m_doc->memory();
+        lines << QString("lesson  %1  (pcm %2, peaks %3, takes %4)")
+            .arg(mb(mem.total())).arg(mb(mem.pcm)).arg(mb(mem.peaks))
+            .arg(mb(mem.takes));
+        if (mem.pcmMapped > 0)
+            lines << QString("        + %1 pcm mapped from file")
+                .arg(mb(mem.pcmMapped));
+
+        const TaskPool::Stats ts = TaskPool::instance().stats();
+        lines << QString("pool    %1/%2 busy  %3 queued  wait %4 ms avg")
+            .arg(ts.running).arg(ts.threads).arg(ts.queued)
+            .arg(ts.avgWaitMs, 0, 'f', 1);
+
+        m_lines = lines;
+        const QFontMetrics fm(font());
+        int w = 0;
+        for (const QString& l : m_lines)
+            w = std::max(w, fm.horizontalAdvance(l));
+        resize(w + 2 * kPad, m_lines.size() * fm.lineSpacing() + 2 * kPad);
+        if (parentWidget())
+            move(parentWidget()->width() - width() - kMargin, kMargin);
+        update();
+    }
+
+    static constexpr int    kRefreshMs = 250;
+    static constexpr int    kPad = 6;
+    static constexpr int    kMargin = 8;
+    static constexpr qint64 kAlertNs = 3'000'000'000;
+
+    AudioEngine* m_engine;
+    QSharedPointer<LessonDocument> m_doc;
+    WaveformSource m_waveform;
+    QTimer* m_timer = nullptr;
+    QStringList m_lines;
+    int     m_underrunLine = -1;
+    qint64  m_lastUnderruns = 0;
+    qint64  m_alertUntilNs = 0;
+    qint64  m_lastFrames = 0;
+};
+
 //===================== Main Window =====================
 
 class MainWindow : public QMainWindow
 {
 public:
-    explicit MainWindow(QWidget* parent = nullptr)
+    explicit MainWindow(AudioEngine* engine, QWidget* parent = nullptr)
         : QMainWindow(parent)
     {
         setWindowTitle("Shadowing English");
 
+        // một lesson dùng chung cho cả hai tab
+        auto doc = QSharedPointer<LessonDocument>::create();
+
         QTabWidget* tabs = new QTabWidget;
-        tabs->addTab(new SetupTab, "Setup");
-        tabs->addTab(new PracticeTab, "Practice");
+        SetupTab* setup = new SetupTab(doc, engine);
+        PracticeTab* practice = new PracticeTab(doc, engine);
+        tabs->addTab(setup, "Setup");
+        tabs->addTab(practice, "Practice");
 
         setCentralWidget(tabs);
         resize(1280, 720);
+
+        // bảng gain theo câu đi theo mọi thay đổi của lesson (các tab đã
+        // setSource trong observer của chúng, đăng ký trước)
+        LessonDocument* d = doc.data();
+        doc->addObserver(this, [engine, d](LessonDocument::Change, int) {
+            engine->setGains(d->gains);
+        });
+
+        // Ctrl+Shift+T: bật trace; bấm lần nữa thì dừng, lưu Chrome trace
+        // và hiện báo cáo độ trễ
+        QAction* trace = new QAction(this);
+        trace->setShortcut(QKeySequence("Ctrl+Shift+T"));
+        addAction(trace);
+        connect(trace, &QAction::triggered, this, [this]() { toggleTrace(); });
+
+        // Ctrl+Shift+P: HUD hiệu năng, số liệu waveform lấy theo tab đang mở
+        PerfHud* hud = new PerfHud(engine, doc,
+            [tabs, setup, practice]() -> WaveformWidget* {
+                return tabs->currentWidget() == setup
+                    ? setup->waveform() : practice->waveform();
+            }, tabs);
+        QAction* hudAction = new QAction(this);
+        hudAction->setShortcut(QKeySequence("Ctrl+Shift+P"));
+        addAction(hudAction);
+        connect(hudAction, &QAction::triggered, hud, &PerfHud::toggle);
+    }
+
+private:
+    void toggleTrace()
+    {
+        if (!Trace::enabled()) {
+            Trace::setEnabled(true);
+            setWindowTitle("Shadowing English [tracing]");
+            return;
+        }
+        Trace::setEnabled(false);
+        setWindowTitle("Shadowing English");
+
+        const QString path = QFileDialog::getSaveFileName(this,
+            "Save trace", "shadowing_trace.json", "Chrome trace (*.json)");
+        QString err;
+        if (!path.isEmpty() && !Trace::exportChrome(path, &err))
+            QMessageBox::warning(this, "Error", err);
+        QMessageBox box(QMessageBox::Information, "Latency",
+            Trace::latencyReport(), QMessageBox::Ok, this);
+        box.setStyleSheet("QLabel { font-family: monospace; }");
+        box.exec();
     }
 };
 
@@ -1829,7 +6179,22 @@ public:
 int main(int argc, char* argv[])
 {
     QApplication app(argc, argv);
-    MainWindow w;
+
+    // SHADOWING_TRACE=<file.json>: trace từ lúc mở, ghi khi thoát
+    const QString tracePath = qEnvironmentVariable("SHADOWING_TRACE");
+    if (!tracePath.isEmpty())
+        Trace::setEnabled(true);
+
+    AudioEngine engine;     // sống lâu hơn MainWindow, chết trước app
+    MainWindow w(&engine);
     w.show();
-    return app.exec();
+    const int rc = app.exec();
+
+    if (!tracePath.isEmpty()) {
+        QString err;
+        if (!Trace::exportChrome(tracePath, &err))
+            qWarning("%s", qPrintable(err));
+        qInfo("%s", qPrintable(Trace::latencyReport()));
+    }
+    return rc;
 }
@@ -0,0 +1,496 @@
+﻿// Microbenchmark cho các đường nóng của lõi (shadowing_core): định dạng
+// thời gian, đếm từ, tách câu, JSON lesson và dựng danh sách từ vựng như
+// PracticeTab::rebuildVocabTable. Corpus tổng hợp, cố định theo seed, ở
+// 1k / 10k / 100k câu. Thêm Resampler: throughput (ns mỗi mẫu ra) và chất
+// lượng THD+N với sóng sin ở vài cặp rate; analyzeLoudness trên 10 phút
+// audio tổng hợp (nhân 6 ra thời gian cho file 1 giờ).
+//
+//   shadowing_bench [--sizes 1000,10000,100000] [--filter <chuỗi>]
+//                   [--min-time <giây>] [--json]
+//
+// --json in một object JSON (mỗi case: tên, số phần tử + đơn vị, số lần
+// lặp, median/min ns mỗi lần và ns mỗi phần tử; THD+N trong "quality") để
+// CI so với lần chạy trước. Trước khi đo, kiểm tra compressPcm nén rồi đọc
+// lại đúng từng mẫu; sai thì thoát mã 2.
+// Target shadowing_bench trong CMakeLists.txt (cạnh thư viện shadowing_core);
+// build Release để số đo có nghĩa.
+
+#include "shadowing_core.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+namespace {
+
+struct Corpus
+{
+    QString           text;        // cả script, như file .txt
+    QVector<Sentence> sentences;
+    QStringList       times;       // formatTime của mỗi begin
+};
+
+// Câu 5–40 từ từ một từ điển nhỏ có lặp (giống văn nói), thỉnh thoảng có
+// dấu phẩy và từ nối để splitTextIntoSentencesAdvanced phải cắt câu dài.
+Corpus makeCorpus(int sentences)
+{
+    static const char* const kWords[] = {
+        "the", "a", "to", "and", "but", "because", "so", "however", "we",
+        "you", "they", "people", "really", "think", "about", "learning",
+        "English", "every", "morning", "listen", "carefully", "repeat",
+        "sentence", "rhythm", "intonation", "practice", "today", "teacher",
+        "student's", "don't", "important", "remember", "conversation",
+        "shadowing", "quickly", "slowly", "between", "during", "weekend",
+        "language", "pronunciation", "vocabulary", "exactly", "natural"
+    };
+    constexpr int kWordCount = int(sizeof(kWords) / sizeof(kWords[0]));
+    static const char kEnds[] = { '.', '.', '.', '?', '!' };
+
+    std::mt19937 rng(12345u + unsigned(sentences));
+    std::uniform_int_distribution<int> len(5, 40);
+    std::uniform_int_distribution<int> word(0, kWordCount - 1);
+    std::uniform_int_distribution<int> pct(0, 99);
+
+    Corpus c;
+    c.sentences.reserve(sentences);
+    QStringList parts;
+    double t = 0.0;
+    for (int i = 0; i < sentences; ++i) {
+        QStringList words;
+        const int n = len(rng);
+        for (int k = 0; k < n; ++k) {
+            QString w = QString::fromLatin1(kWords[word(rng)]);
+            if (k == 0) w[0] = w[0].toUpper();
+            if (k + 1 < n && pct(rng) < 8) w += QLatin1Char(',');
+            words << w;
+        }
+        QString s = words.join(' ') + QLatin1Char(kEnds[i % 5]);
+
+        Sentence sent;
+        sent.id = i + 1;
+        sent.begin = t;
+        sent.end = t + n * 0.3;
+        sent.text = s;
+        sent.confirm = (i % 3 == 0);
+        t = sent.end + 0.2;
+        c.sentences.push_back(sent);
+        c.times << formatTime(sent.begin);
+        parts << s;
+    }
+    c.text = parts.join(' ');
+    return c;
+}
+
+// như PracticeTab::rebuildVocabTable, bỏ phần QTableWidget
+QStringList vocabList(const QVector<Sentence>& sentences)
+{
+    const QVector<WordOccurrence> index = buildWordIndex(sentences);
+    QStringList wordList;
+    for (const WordOccurrence& o : index) {
+        if (wordList.isEmpty() || wordList.last() != o.word)
+            wordList.push_back(o.word);
+    }
+    return wordList;
+}
+
+// 2 s sóng sin biên độ -6 dBFS qua Resampler (float, không lượng tử hoá),
+// khớp lại sin cùng tần số bằng bình phương tối thiểu; phần dư so với sin
+// là nhiễu + méo (dB). Bỏ 0.2 s hai đầu (đáp ứng quá độ của filter).
+double resampleThdN(int inRate, int outRate, double hz)
+{
+    Resampler r;
+    r.configure(inRate, outRate);
+    const int n = inRate * 2;
+    std::vector<float> x(size_t(n), 0.0f);
+    for (int i = 0; i < n; ++i)
+        x[size_t(i)] = float(0.5 * std::sin(2.0 * M_PI * hz * i / inRate));
+    std::vector<float> y(size_t(r.maxOutputFor(n)), 0.0f);
+    y.resize(size_t(r.process(x.data(), n, y.data())));
+
+    const int from = outRate / 5;
+    const int to = int(y.size()) - outRate / 5;
+    double cc = 0, cs = 0, ss = 0, yc = 0, ys = 0;
+    for (int i = from; i < to; ++i) {
+        const double c = std::cos(2.0 * M_PI * hz * i / outRate);
+        const double s = std::sin(2.0 * M_PI * hz * i / outRate);
+        cc += c * c; cs += c * s; ss += s * s;
+        yc += y[size_t(i)] * c; ys += y[size_t(i)] * s;
+    }
+    const double det = cc * ss - cs * cs;
+    const double ka = (yc * ss - ys * cs) / det;
+    const double kb = (ys * cc - yc * cs) / det;
+    double noise = 0.0, signal = 0.0;
+    for (int i = from; i < to; ++i) {
+        const double fit = ka * std::cos(2.0 * M_PI * hz * i / outRate)
+            + kb * std::sin(2.0 * M_PI * hz * i / outRate);
+        noise += (y[size_t(i)] - fit) * (y[size_t(i)] - fit);
+        signal += fit * fit;
+    }
+    return 10.0 * std::log10(std::max(noise, 1e-30) / signal);
+}
+
+// compressPcm phải lossless: nén rồi đọc lại qua readBlock, readFrames,
+// PcmSlice (đoạn cắt ngang mép khối) và PcmCursor phải ra đúng từng mẫu.
+// Trả mô tả lỗi đầu tiên, rỗng nếu mọi case đều đúng.
+QString checkPcmRoundTrip()
+{
+    std::mt19937 rng(99u);
+    std::uniform_int_distribution<int> full(-32768, 32767);
+    std::uniform_int_distribution<int> small(-40, 40);
+    std::uniform_int_distribution<int> pick(0, 2);
+    const qint64 kBlock = kPcmBlockFrames;
+
+    struct Case
+    {
+        QString name;
+        QVector<qint16> x;
+    };
+    QVector<Case> cases;
+    auto add = [&](const QString& name, qint64 n,
+        const std::function<int(qint64)>& f) {
+        Case c{ name, QVector<qint16>(n) };
+        for (qint64 i = 0; i < n; ++i)
+            c.x[i] = qint16(std::clamp(f(i), -32768, 32767));
+        cases.push_back(std::move(c));
+    };
+
+    // nhiễu toàn dải: phần dư rộng nhất, khối cuối lẻ
+    add("random", 3 * kBlock + 12345, [&](qint64) { return full(rng); });
+    // nhảy giữa hai cực: phần dư bậc 1 là ±65535, bậc 2 còn lớn hơn
+    add("extremes", 2 * kBlock + 7, [&](qint64) {
+        static const int kV[] = { -32768, 32767, 0 };
+        return kV[pick(rng)];
+    });
+    add("alternating", kBlock + 1, [](qint64 i) {
+        return (i & 1) ? 32767 : -32768;
+    });
+    add("clipped", kBlock + 300, [](qint64 i) {
+        return (i / 300) % 2 ? 32767 : -32768;
+    });
+    // lặng và đoạn thẳng (phần dư 0, nhóm w = 0) xen giọng nói
+    add("speech", 2 * kBlock + 999, [&](qint64 i) {
+        const qint64 k = i % 20000;
+        if (k < 3000) return 0;
+        if (k < 6000) return int(k - 3000) * 10 - 15000;
+        return int(12000.0 * std::sin(double(i) * 0.031)
+            * std::sin(double(i) * 0.0007)) + small(rng);
+    });
+    // khối và nhóm lẻ: 1 mẫu, đúng một nhóm + 1, thiếu/thừa một mẫu
+    for (qint64 n : { qint64(1), qint64(2), qint64(257), kBlock - 1, kBlock,
+                      kBlock + 1 })
+        add(QString("length %1").arg(n), n, [&](qint64) { return full(rng); });
+
+    for (const Case& c : cases) {
+        PcmData ref;
+        ref.sampleRate = 44100;
+        ref.samples = c.x;
+        PcmData packed = ref;
+        if (!compressPcm(packed) || !packed.isCompressed()
+            || packed.frames() != ref.frames())
+            return c.name + ": compressPcm failed";
+        const qint64 n = ref.frames();
+        const qint16* want = ref.data();
+
+        auto mismatch = [&](const char* how, const qint16* got, qint64 f0,
+            qint64 len) -> QString {
+            for (qint64 i = 0; i < len; ++i) {
+                if (got[i] != want[f0 + i])
+                    return QString("%1: %2 frame %3: %4 != %5").arg(c.name)
+                        .arg(how).arg(f0 + i).arg(got[i]).arg(want[f0 + i]);
+            }
+            return {};
+        };
+
+        std::vector<qint16> buf(kBlock);
+        for (qint64 b = 0; (b << kPcmBlockShift) < n; ++b) {
+            const qint64 f0 = b << kPcmBlockShift;
+            packed.readBlock(b, buf.data());
+            const QString err = mismatch("readBlock", buf.data(), f0,
+                std::min(kBlock, n - f0));
+            if (!err.isEmpty()) return err;
+        }
+
+        std::vector<qint16> all(n);
+        packed.readFrames(0, n, all.data());
+        QString err = mismatch("readFrames", all.data(), 0, n);
+        if (!err.isEmpty()) return err;
+
+        // đoạn ngẫu nhiên, và đoạn cố ý cắt ngang mép khối
+        std::uniform_int_distribution<qint64> pos(0, n);
+        for (int k = 0; k < 200; ++k) {
+            qint64 f0 = pos(rng), f1 = pos(rng);
+            if (k % 2 && n > kBlock) {
+                const qint64 edge = kBlock * (1 + k % (n / kBlock));
+                f0 = std::max<qint64>(0, edge - 1 - k);
+                f1 = std::min(n, edge + 1 + k * 3);
+            }
+            if (f1 < f0) std::swap(f0, f1);
+            const PcmSlice slice(packed, f0, f1);
+            err = mismatch("PcmSlice", slice.data(), f0, f1 - f0);
+            if (!err.isEmpty()) return err;
+        }
+
+        PcmCursor cursor;
+        cursor.reset(&packed);
+        std::uniform_int_distribution<qint64> at(0, n - 1);
+        for (int k = 0; k < 2000; ++k) {
+            const qint64 f = k % 4 ? at(rng) : std::min(n - 1, qint64(k));
+            const qint16 v = cursor.at(f);
+            err = mismatch("PcmCursor", &v, f, 1);
+            if (!err.isEmpty()) return err;
+        }
+    }
+    return {};
+}
+
+struct Result
+{
+    QString name;
+    int     items = 0;
+    QString unit;               // "sentence", "sample"
+    int     iterations = 0;
+    double  medianNs = 0.0;
+    double  minNs = 0.0;
+};
+
+// lặp tới khi đủ minTime (ít nhất 3 lần); sink chặn compiler bỏ phép tính
+Result measure(const QString& name, int items, const QString& unit,
+    double minTime, const std::function<qint64()>& body)
+{
+    QVector<double> samples;
+    volatile qint64 sink = 0;
+    const qint64 start = steadyNowNs();
+    while (samples.size() < 3
+        || (steadyNowNs() - start) / 1e9 < minTime) {
+        const qint64 t0 = steadyNowNs();
+        sink = sink + body();
+        samples.push_back(double(steadyNowNs() - t0));
+        if (samples.size() >= 1000) break;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    Result r;
+    r.name = name;
+    r.items = items;
+    r.unit = unit;
+    r.iterations = samples.size();
+    r.medianNs = samples[samples.size() / 2];
+    r.minNs = samples.first();
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("shadowing_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Microbenchmarks for the Shadowing English core hot paths.");
+    parser.addHelpOption();
+    const QCommandLineOption sizesOpt("sizes",
+        "Comma-separated corpus sizes in sentences.", "list",
+        "1000,10000,100000");
+    const QCommandLineOption filterOpt("filter",
+        "Only run cases whose name contains <text>.", "text");
+    const QCommandLineOption minTimeOpt("min-time",
+        "Minimum seconds per case (default 0.3).", "sec", "0.3");
+    const QCommandLineOption jsonOpt("json", "Machine-readable output.");
+    parser.addOptions({ sizesOpt, filterOpt, minTimeOpt, jsonOpt });
+    parser.process(app);
+
+    QVector<int> sizes;
+    for (const QString& s : parser.value(sizesOpt).split(',')) {
+        const int n = s.trimmed().toInt();
+        if (n > 0) sizes << n;
+    }
+    const QString filter = parser.value(filterOpt);
+    const double minTime = std::max(0.0, parser.value(minTimeOpt).toDouble());
+
+    QTemporaryDir tmp;
+    if (!tmp.isValid()) {
+        std::fprintf(stderr, "Cannot create a temporary directory\n");
+        return 1;
+    }
+
+    // kiểm tra trước khi đo: codec PCM nén là nơi lưu audio của lesson
+    const QString pcmError = checkPcmRoundTrip();
+    if (!pcmError.isEmpty()) {
+        std::fprintf(stderr, "PCM round-trip FAILED: %s\n",
+            qPrintable(pcmError));
+        return 2;
+    }
+    if (!parser.isSet(jsonOpt))
+        std::printf("pcm round-trip: ok\n");
+
+    QVector<Result> results;
+    auto runItems = [&](const QString& name, int n, const QString& unit,
+        const std::function<qint64()>& body) {
+        if (!filter.isEmpty() && !name.contains(filter)) return;
+        results << measure(name, n, unit, minTime, body);
+        if (!parser.isSet(jsonOpt)) {
+            const Result& r = results.last();
+            std::printf("%-30s %7d  %12.3f ms  %9.1f ns/%s  (%d it)\n",
+                qPrintable(r.name), r.items, r.medianNs / 1e6,
+                r.medianNs / std::max(1, r.items), qPrintable(r.unit),
+                r.iterations);
+            std::fflush(stdout);
+        }
+    };
+    auto run = [&](const QString& name, int n,
+        const std::function<qint64()>& body) {
+        runItems(name, n, "sentence", body);
+    };
+
+    for (int n : sizes) {
+        const Corpus c = makeCorpus(n);
+        const QString jsonPath = tmp.filePath(QString("lesson_%1.json").arg(n));
+
+        run("formatTime", n, [&]() {
+            qint64 acc = 0;
+            for (const Sentence& s : c.sentences)
+                acc += formatTime(s.begin).size();
+            return acc;
+        });
+        run("parseTime", n, [&]() {
+            double acc = 0.0;
+            for (const QString& t : c.times)
+                acc += parseTime(t);
+            return qint64(acc);
+        });
+        run("countWords", n, [&]() {
+            qint64 acc = 0;
+            for (const Sentence& s : c.sentences)
+                acc += countWords(s.text);
+            return acc;
+        });
+        run("baseSplitSentences", n, [&]() {
+            return qint64(baseSplitSentences(c.text).size());
+        });
+        run("splitTextIntoSentencesAdvanced", n, [&]() {
+            return qint64(splitTextIntoSentencesAdvanced(c.text).size());
+        });
+        run("saveLessonJson", n, [&]() {
+            return qint64(saveLessonJson(jsonPath, "audio.mp3", "script.txt",
+                c.sentences, 1.0, 0));
+        });
+        run("loadLessonJson", n, [&]() {
+            QString audio, text;
+            QVector<Sentence> sents;
+            double speed = 1.0;
+            int last = 0;
+            loadLessonJson(jsonPath, audio, text, sents, speed, last);
+            return qint64(sents.size());
+        });
+        run("vocabList", n, [&]() {
+            return qint64(vocabList(c.sentences).size());
+        });
+    }
+
+    // Resampler: 10 s nhiễu trắng, nạp từng khối 1024 mẫu như Recorder
+    static const int kRatePairs[][2] = {
+        { 44100, 48000 }, { 48000, 44100 }, { 22050, 48000 }, { 16000, 44100 }
+    };
+    for (const auto& pair : kRatePairs) {
+        const int inRate = pair[0], outRate = pair[1];
+        std::mt19937 rng(7u);
+        std::uniform_real_distribution<float> noise(-16384.0f, 16384.0f);
+        std::vector<float> in(size_t(inRate) * 10);
+        for (float& v : in) v = noise(rng);
+        Resampler r;
+        r.configure(inRate, outRate);
+        std::vector<float> out(size_t(r.maxOutputFor(1024)));
+        const int outFrames = int(qint64(in.size()) * outRate / inRate);
+        runItems(QString("resample %1->%2").arg(inRate).arg(outRate),
+            outFrames, "sample", [&]() {
+            qint64 produced = 0;
+            for (size_t i = 0; i < in.size(); i += 1024) {
+                const int k = int(std::min<size_t>(1024, in.size() - i));
+                produced += r.process(in.data() + i, k, out.data());
+            }
+            return produced;
+        });
+    }
+
+    // loudness: 10 phút nhiễu điều biên theo âm tiết, câu ~4 s
+    {
+        PcmData pcm;
+        pcm.sampleRate = 44100;
+        pcm.samples.resize(pcm.sampleRate * 600);
+        std::mt19937 rng(11u);
+        std::uniform_int_distribution<int> noise(-8000, 8000);
+        for (qsizetype i = 0; i < pcm.samples.size(); ++i) {
+            const double env = 0.5 + 0.5 * std::sin(2.0 * M_PI * 4.0 * i
+                / pcm.sampleRate);
+            pcm.samples[i] = qint16(noise(rng) * env);
+        }
+        QVector<Sentence> sents;
+        for (double t = 0.0; t + 4.0 <= 600.0; t += 4.0) {
+            Sentence s;
+            s.id = int(sents.size()) + 1;
+            s.begin = t;
+            s.end = t + 3.8;
+            sents.push_back(s);
+        }
+        runItems("analyzeLoudness 600s", int(pcm.frames()), "sample", [&]() {
+            return qint64(analyzeLoudness(sents, pcm));
+        });
+    }
+
+    struct Quality { int inRate, outRate; double hz, db; };
+    QVector<Quality> quality;
+    if (filter.isEmpty() || QString("resample thdn").contains(filter)) {
+        for (const auto& pair : kRatePairs) {
+            for (double hz : { 100.0, 1000.0, 5000.0 }) {
+                const Quality q{ pair[0], pair[1], hz,
+                    resampleThdN(pair[0], pair[1], hz) };
+                quality << q;
+                if (!parser.isSet(jsonOpt))
+                    std::printf("resample thdn %5d->%5d %6.0f Hz  %7.1f dB\n",
+                        q.inRate, q.outRate, q.hz, q.db);
+            }
+        }
+    }
+
+    if (parser.isSet(jsonOpt)) {
+        QJsonArray arr;
+        for (const Result& r : results) {
+            QJsonObject o;
+            o["name"] = r.name;
+            o["items"] = r.items;
+            o["unit"] = r.unit;
+            o["iterations"] = r.iterations;
+            o["median_ns"] = r.medianNs;
+            o["min_ns"] = r.minNs;
+            o["ns_per_item"] = r.medianNs / std::max(1, r.items);
+            arr.push_back(o);
+        }
+        QJsonArray qarr;
+        for (const Quality& q : quality) {
+            QJsonObject o;
+            o["in_rate"] = q.inRate;
+            o["out_rate"] = q.outRate;
+            o["hz"] = q.hz;
+            o["thdn_db"] = q.db;
+            qarr.push_back(o);
+        }
+        QJsonObject root;
+        root["benchmark"] = "shadowing_core";
+        root["threads"] = TaskPool::instance().threadCount();
+        root["pcm_roundtrip"] = "ok";
+        root["results"] = arr;
+        root["quality"] = qarr;
+        QTextStream(stdout) << QJsonDocument(root).toJson(QJsonDocument::Indented);
+    }
+    return 0;
+}
@@ -0,0 +1,252 @@
+﻿// Công cụ dòng lệnh xử lý lesson hàng loạt, không cần GUI.
+//
+// Mỗi lesson là một thư mục có một file audio và một file script .txt
+// (hoặc đã có lesson.json). Với từng lesson: tách câu từ script, giải mã
+// audio, gán Begin/End theo số từ rồi dời ranh giới về khoảng lặng, đo
+// loudness từng câu, kiểm tra, ghi lesson.json (+ lesson.srt nếu cần). Các lesson chạy song song
+// trên TaskPool, mỗi lesson một task.
+//
+//   shadowing_cli [-j N] [-r] [--force] [--no-align] [--srt]
+//                 [--validate-only] <dir>...
+//
+// Target shadowing_cli trong CMakeLists.txt (link thư viện shadowing_core).
+
+#include "shadowing_core.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+
+#include <cstdio>
+
+namespace {
+
+const QStringList kAudioFilters{ "*.mp3", "*.wav", "*.m4a", "*.aac",
+                                 "*.ogg", "*.flac", "*.opus" };
+const QString kLessonJson = "lesson.json";
+const QString kLessonSrt = "lesson.srt";
+
+struct Options
+{
+    bool force = false;         // tách/gán lại dù đã có lesson.json
+    bool align = true;          // dời ranh giới câu về khoảng lặng
+    bool srt = false;
+    bool validateOnly = false;
+};
+
+struct LessonResult
+{
+    QString dir;
+    bool    ok = false;
+    int     sentences = 0;
+    QString note;               // lỗi hoặc tóm tắt việc đã làm
+    QStringList issues;         // từ validateLesson
+    double  elapsedMs = 0.0;
+};
+
+QString firstFile(const QDir& dir, const QStringList& filters)
+{
+    const QStringList files = dir.entryList(filters,
+        QDir::Files | QDir::Readable, QDir::Name);
+    return files.isEmpty() ? QString() : dir.filePath(files.first());
+}
+
+bool isLessonDir(const QDir& dir)
+{
+    return dir.exists(kLessonJson)
+        || (!firstFile(dir, kAudioFilters).isEmpty()
+            && !firstFile(dir, { "*.txt" }).isEmpty());
+}
+
+QStringList findLessonDirs(const QStringList& roots, bool recursive)
+{
+    QStringList out;
+    for (const QString& root : roots) {
+        const QDir rootDir(root);
+        if (isLessonDir(rootDir))
+            out << rootDir.absolutePath();
+        if (!recursive) continue;
+        QDirIterator it(root, QDir::Dirs | QDir::NoDotAndDotDot,
+            QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            const QDir d(it.next());
+            if (isLessonDir(d))
+                out << d.absolutePath();
+        }
+    }
+    out.removeDuplicates();
+    return out;
+}
+
+LessonResult processLesson(const QString& dirPath, const Options& opt)
+{
+    LessonResult r;
+    r.dir = dirPath;
+    const qint64 t0 = steadyNowNs();
+    const QDir dir(dirPath);
+    const QString jsonPath = dir.filePath(kLessonJson);
+
+    QString audioPath, textPath, err;
+    QVector<Sentence> sents;
+    double speed = 1.0;
+    int lastSent = 0;
+    QStringList done;
+
+    const bool haveJson = QFile::exists(jsonPath);
+    if (haveJson && (!opt.force || opt.validateOnly)) {
+        if (!loadLessonJson(jsonPath, audioPath, textPath, sents, speed,
+            lastSent, &err)) {
+            r.note = err;
+            return r;
+        }
+    }
+    else if (opt.validateOnly) {
+        r.note = "no " + kLessonJson;
+        return r;
+    }
+    else {
+        audioPath = firstFile(dir, kAudioFilters);
+        textPath = firstFile(dir, { "*.txt" });
+        QFile f(textPath);
+        if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            r.note = "cannot read script " + textPath;
+            return r;
+        }
+        const QVector<QString> parts =
+            splitTextIntoSentencesAdvanced(QString::fromUtf8(f.readAll()));
+        for (int i = 0; i < parts.size(); ++i) {
+            Sentence s;
+            s.id = i + 1;
+            s.text = parts[i];
+            sents.push_back(s);
+        }
+        done << QString("split %1").arg(sents.size());
+    }
+
+    PcmData pcm;
+    if (!decodeAudioFile(audioPath, pcm)) {
+        r.note = "cannot decode audio " + audioPath;
+        return r;
+    }
+    const double duration = double(pcm.frames()) / pcm.sampleRate;
+
+    if (!opt.validateOnly && assignTimesByWordCount(sents, duration)) {
+        done << "assigned";
+        if (opt.align) {
+            snapBoundariesToPauses(sents, pcm);
+            done << "aligned";
+        }
+    }
+
+    // câu đã đổi thời gian thì đo lại hết, không thì chỉ đo câu còn thiếu
+    if (!opt.validateOnly) {
+        const int measured = analyzeLoudness(sents, pcm, done.isEmpty());
+        if (measured > 0)
+            done << QString("loudness %1").arg(measured);
+    }
+
+    r.sentences = sents.size();
+    r.issues = validateLesson(sents, duration);
+
+    if (!opt.validateOnly && !done.isEmpty()) {
+        if (!saveLessonJson(jsonPath, audioPath, textPath, sents, speed,
+            lastSent, &err)) {
+            r.note = err;
+            return r;
+        }
+        done << kLessonJson;
+    }
+    if (!opt.validateOnly && opt.srt) {
+        if (!saveLessonSrt(dir.filePath(kLessonSrt), sents, &err)) {
+            r.note = err;
+            return r;
+        }
+        done << kLessonSrt;
+    }
+
+    r.ok = true;
+    r.note = done.isEmpty() ? "checked" : done.join(", ");
+    r.elapsedMs = (steadyNowNs() - t0) / 1e6;
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("shadowing_cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Batch-prepare Shadowing English lessons: split the script, "
+        "align it to the audio, validate and export.");
+    parser.addHelpOption();
+    const QCommandLineOption jobsOpt({ "j", "jobs" },
+        "Process <n> lessons in parallel (default: all cores).", "n");
+    const QCommandLineOption recursiveOpt({ "r", "recursive" },
+        "Search subdirectories for lessons.");
+    const QCommandLineOption forceOpt("force",
+        "Re-split and re-align even if lesson.json exists.");
+    const QCommandLineOption noAlignOpt("no-align",
+        "Keep word-count timing; do not snap boundaries to pauses.");
+    const QCommandLineOption srtOpt("srt", "Also write lesson.srt.");
+    const QCommandLineOption validateOpt("validate-only",
+        "Only check existing lesson.json files; write nothing.");
+    parser.addOptions({ jobsOpt, recursiveOpt, forceOpt, noAlignOpt,
+                        srtOpt, validateOpt });
+    parser.addPositionalArgument("dirs", "Lesson directories.", "<dir>...");
+    parser.process(app);
+
+    if (parser.positionalArguments().isEmpty())
+        parser.showHelp(1);
+
+    Options opt;
+    opt.force = parser.isSet(forceOpt);
+    opt.align = !parser.isSet(noAlignOpt);
+    opt.srt = parser.isSet(srtOpt);
+    opt.validateOnly = parser.isSet(validateOpt);
+
+    const QStringList dirs = findLessonDirs(parser.positionalArguments(),
+        parser.isSet(recursiveOpt));
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    if (dirs.isEmpty()) {
+        err << "No lesson directories found.\n";
+        return 1;
+    }
+
+    // pool riêng để -j có hiệu lực; mỗi lesson một phần tử parallelFor
+    TaskPool pool(parser.value(jobsOpt).toInt());
+    QVector<LessonResult> results(dirs.size());
+    LessonResult* res = results.data();
+    const qint64 t0 = steadyNowNs();
+    pool.parallelFor(int(dirs.size()), [&](int i) {
+        res[i] = processLesson(dirs[i], opt);
+    });
+    const double totalSec = (steadyNowNs() - t0) / 1e9;
+
+    int failed = 0, withIssues = 0;
+    for (const LessonResult& r : results) {
+        if (!r.ok) {
+            ++failed;
+            err << "FAIL  " << r.dir << ": " << r.note << "\n";
+            continue;
+        }
+        if (!r.issues.isEmpty()) ++withIssues;
+        out << (r.issues.isEmpty() ? "OK    " : "WARN  ") << r.dir
+            << "  (" << r.sentences << " sentences; " << r.note << "; "
+            << qRound(r.elapsedMs) << " ms)\n";
+        for (const QString& issue : r.issues)
+            out << "        " << issue << "\n";
+    }
+    out << QString("%1 lessons, %2 failed, %3 with issues, %4 s on %5 "
+        "threads\n").arg(results.size()).arg(failed).arg(withIssues)
+        .arg(totalSec, 0, 'f', 1).arg(pool.threadCount());
+    out.flush();
+    return failed > 0 ? 2 : (withIssues > 0 ? 1 : 0);
+}
@@ -0,0 +1,1520 @@
+﻿#include "shadowing_core.h"
+
+#include <QAudioBuffer>
+#include <QAudioDecoder>
+#include <QAudioFormat>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QRegularExpression>
+#include <QSysInfo>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QUrl>
+#include <QtEndian>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+
+//===================== Helpers =====================
+
+QString formatTime(double sec)
+{
+    if (sec < 0) return QString();
+    int msec = int(std::round(sec * 1000.0));
+    int minutes = msec / 60000;
+    msec -= minutes * 60000;
+    int seconds = msec / 1000;
+    msec -= seconds * 1000;
+    return QString("%1:%2.%3")
+        .arg(minutes, 2, 10, QLatin1Char('0'))
+        .arg(seconds, 2, 10, QLatin1Char('0'))
+        .arg(msec, 3, 10, QLatin1Char('0'));
+}
+
+double parseTime(const QString& s)
+{
+    QString t = s.trimmed();
+    if (t.isEmpty()) return -1.0;
+    QStringList parts = t.split(':');
+    if (parts.size() != 2) return -1.0;
+
+    bool ok1 = false, ok2 = false;
+    int minutes = parts[0].toInt(&ok1);
+    double secFloat = parts[1].toDouble(&ok2);
+    if (!ok1 || !ok2) return -1.0;
+
+    return minutes * 60.0 + secFloat;
+}
+
+int countWords(const QString& s)
+{
+    QStringList words =
+        s.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+    return words.size();
+}
+
+// Simple base splitter: split by . ? ! then trim.
+QVector<QString> baseSplitSentences(const QString& text)
+{
+    QVector<QString> result;
+    QRegularExpression re(R"(([^.!?]+[.!?]))");
+    auto it = re.globalMatch(text);
+    while (it.hasNext()) {
+        auto m = it.next();
+        QString s = m.captured(1).trimmed();
+        if (!s.isEmpty())
+            result.push_back(s);
+    }
+    if (result.isEmpty()) {
+        QString s = text.trimmed();
+        if (!s.isEmpty())
+            result.push_back(s);
+    }
+    return result;
+}
+
+// Slightly “smarter” splitter following spec (chỉ ở mức đơn giản)
+QVector<QString> splitTextIntoSentencesAdvanced(const QString& text)
+{
+    QVector<QString> base = baseSplitSentences(text);
+    QVector<QString> out;
+
+    const int MAX_WORDS = 25;   // ~2–4s, tuỳ tốc độ đọc
+
+    for (QString s : base) {
+        s = s.trimmed();
+        if (s.isEmpty()) continue;
+
+        QStringList words =
+            s.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+
+        if (words.size() <= MAX_WORDS) {
+            out.push_back(s);
+            continue;
+        }
+
+        int start = 0;
+        for (int i = 0; i < words.size(); ++i) {
+            bool shouldSplit = false;
+            if (i - start >= MAX_WORDS / 2) {
+                QString w = words[i].toLower();
+                if (w == "and" || w == "but" || w == "because"
+                    || w == "so" || w == "however"
+                    || words[i].endsWith(',')) {
+                    shouldSplit = true;
+                }
+            }
+            if (shouldSplit) {
+                QString seg = words.mid(start, i - start + 1).join(" ");
+                out.push_back(seg.trimmed());
+                start = i + 1;
+            }
+        }
+        if (start < words.size()) {
+            QString seg = words.mid(start).join(" ");
+            out.push_back(seg.trimmed());
+        }
+    }
+
+    if (out.isEmpty())
+        out = base;
+
+    return out;
+}
+
+// JSON helpers – chung cho Setup, Practice và CLI
+bool loadLessonJson(const QString& jsonPath,
+    QString& audioPath,
+    QString& textPath,
+    QVector<Sentence>& sentences,
+    double& playSpeed,
+    int& lastSentence,
+    QString* error)
+{
+    QFile f(jsonPath);
+    if (!f.open(QIODevice::ReadOnly)) {
+        if (error) *error = "Cannot open JSON file:\n" + jsonPath;
+        return false;
+    }
+    QByteArray data = f.readAll();
+    f.close();
+
+    QJsonParseError err;
+    QJsonDocument doc = QJsonDocument::fromJson(data, &err);
+    if (err.error != QJsonParseError::NoError || !doc.isObject()) {
+        if (error) *error = "Invalid JSON format:\n" + jsonPath;
+        return false;
+    }
+
+    QJsonObject root = doc.object();
+    audioPath = root["audio_path"].toString();
+    textPath = root["text_path"].toString();
+    playSpeed = root["play_speed"].toDouble(1.0);
+    lastSentence = root["last_selected_sentence"].toInt(0);
+
+    sentences.clear();
+    QJsonArray arr = root["sentences"].toArray();
+    for (int i = 0; i < arr.size(); ++i) {
+        QJsonObject o = arr[i].toObject();
+        Sentence s;
+        s.id = o["id"].toInt(i + 1);
+        s.begin = o["begin"].toDouble(-1.0);
+        s.end = o["end"].toDouble(-1.0);
+        s.text = o["text"].toString();
+        s.confirm = o["confirmed"].toBool(false);
+        s.loudness = o["loudness"].toDouble(s.loudness);
+        s.peakDb = o["peak_db"].toDouble(s.peakDb);
+        sentences.push_back(s);
+    }
+    return true;
+}
+
+bool saveLessonJson(const QString& jsonPath,
+    const QString& audioPath,
+    const QString& textPath,
+    const QVector<Sentence>& sentences,
+    double playSpeed,
+    int lastSentence,
+    QString* error)
+{
+    QJsonObject root;
+    root["audio_path"] = audioPath;
+    root["text_path"] = textPath;
+    root["play_speed"] = playSpeed;
+    root["last_selected_sentence"] = lastSentence;
+
+    QJsonArray arr;
+    for (const Sentence& s : sentences) {
+        QJsonObject o;
+        o["id"] = s.id;
+        o["begin"] = s.begin;
+        o["end"] = s.end;
+        o["text"] = s.text;
+        o["confirmed"] = s.confirm;
+        // JSON không có NaN: câu chưa đo thì bỏ trường
+        if (!std::isnan(s.loudness))
+            o["loudness"] = std::round(s.loudness * 100.0) / 100.0;
+        if (!std::isnan(s.peakDb))
+            o["peak_db"] = std::round(s.peakDb * 100.0) / 100.0;
+        arr.push_back(o);
+    }
+    root["sentences"] = arr;
+
+    QJsonDocument doc(root);
+    QByteArray data = doc.toJson(QJsonDocument::Indented);
+
+    QFile f(jsonPath);
+    if (!f.open(QIODevice::WriteOnly)) {
+        if (error) *error = "Cannot write JSON file:\n" + jsonPath;
+        return false;
+    }
+    f.write(data);
+    f.close();
+    return true;
+}
+
+//===================== Tracing =====================
+
+namespace {
+
+constexpr int kTraceRingSize = 1 << 14;    // ~4 phút sự kiện của luồng audio
+
+// Ring của một luồng: chỉ luồng đó ghi; collect() đọc bản sao và bỏ các ô
+// có thể đã bị ghi đè trong lúc chép. Ring không bao giờ được giải phóng
+// để sự kiện của luồng đã kết thúc vẫn xuất được.
+struct TraceRing
+{
+    std::array<TraceEvent, kTraceRingSize> events;
+    std::atomic<quint64> head{ 0 };
+    QString name;
+};
+
+std::mutex g_traceMutex;
+std::vector<std::unique_ptr<TraceRing>> g_traceRings;
+std::atomic<qint64> g_traceStartNs{ 0 };
+thread_local TraceRing* t_traceRing = nullptr;
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0.0;
+    const size_t k = size_t(std::ceil(p * double(sorted.size()))) - 1;
+    return sorted[std::min(k, sorted.size() - 1)];
+}
+
+} // namespace
+
+void Trace::setEnabled(bool on)
+{
+    if (on && !enabled())
+        g_traceStartNs.store(steadyNowNs(), std::memory_order_relaxed);
+    s_enabled.store(on, std::memory_order_relaxed);
+}
+
+static TraceRing* attachTraceRing(const QString& name)
+{
+    auto ring = std::make_unique<TraceRing>();
+    ring->name = name;
+    TraceRing* r = ring.get();
+    std::lock_guard<std::mutex> lock(g_traceMutex);
+    g_traceRings.push_back(std::move(ring));
+    t_traceRing = r;
+    return r;
+}
+
+void Trace::registerThread(const char* name)
+{
+    if (!t_traceRing)
+        attachTraceRing(QString::fromLatin1(name));
+}
+
+void Trace::record(const char* name, quint32 flow, qint64 arg)
+{
+    TraceRing* r = t_traceRing;
+    if (!r) {
+        // luồng chưa đăng ký: lấy nhóm của sự kiện đầu tiên làm tên
+        const char* dot = std::strchr(name, '.');
+        r = attachTraceRing(QString::fromLatin1(name,
+            dot ? int(dot - name) : -1));
+    }
+    const quint64 h = r->head.load(std::memory_order_relaxed);
+    TraceEvent& e = r->events[h % kTraceRingSize];
+    e.ns = steadyNowNs();
+    e.name = name;
+    e.flow = flow;
+    e.arg = arg;
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+QVector<TraceThread> Trace::collect()
+{
+    std::vector<TraceRing*> rings;
+    {
+        std::lock_guard<std::mutex> lock(g_traceMutex);
+        for (const auto& r : g_traceRings) rings.push_back(r.get());
+    }
+    const qint64 startNs = g_traceStartNs.load(std::memory_order_relaxed);
+
+    QVector<TraceThread> out;
+    for (TraceRing* r : rings) {
+        const quint64 h = r->head.load(std::memory_order_acquire);
+        const quint64 first = h > kTraceRingSize ? h - kTraceRingSize : 0;
+        std::vector<TraceEvent> copy;
+        copy.reserve(size_t(h - first));
+        for (quint64 i = first; i < h; ++i)
+            copy.push_back(r->events[i % kTraceRingSize]);
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // các ô writer đã kịp ghi đè trong lúc chép
+        const quint64 h2 = r->head.load(std::memory_order_relaxed);
+        const quint64 valid = h2 > kTraceRingSize ? h2 - kTraceRingSize : 0;
+        const size_t skip = size_t(std::min(h, std::max(first, valid)) - first);
+
+        TraceThread t;
+        t.name = r->name;
+        for (size_t i = skip; i < copy.size(); ++i) {
+            if (copy[i].ns >= startNs) t.events.push_back(copy[i]);
+        }
+        if (!t.events.empty()) out.push_back(std::move(t));
+    }
+    return out;
+}
+
+bool Trace::exportChrome(const QString& path, QString* error)
+{
+    const QVector<TraceThread> threads = collect();
+    const qint64 t0 = g_traceStartNs.load(std::memory_order_relaxed);
+    auto us = [t0](qint64 ns) { return double(ns - t0) / 1000.0; };
+
+    QJsonArray events;
+    QHash<quint32, QPair<const TraceEvent*, int>> uiByFlow;
+    for (int tid = 0; tid < threads.size(); ++tid) {
+        QJsonObject meta;
+        meta["name"] = "thread_name";
+        meta["ph"] = "M";
+        meta["pid"] = 1;
+        meta["tid"] = tid;
+        meta["args"] = QJsonObject{ { "name", threads[tid].name } };
+        events.append(meta);
+
+        for (const TraceEvent& e : threads[tid].events) {
+            QJsonObject o;
+            o["name"] = QString::fromLatin1(e.name);
+            o["ph"] = "i";
+            o["s"] = "t";
+            o["ts"] = us(e.ns);
+            o["pid"] = 1;
+            o["tid"] = tid;
+            o["args"] = QJsonObject{ { "flow", qint64(e.flow) },
+                                     { "arg", e.arg } };
+            events.append(o);
+            if (e.flow && std::strncmp(e.name, "ui.", 3) == 0)
+                uiByFlow.insert(e.flow, { &e, tid });
+        }
+    }
+
+    // mỗi thao tác UI có tiếng ra loa thành một khoảng async bấm → loa
+    for (const TraceThread& t : threads) {
+        for (const TraceEvent& e : t.events) {
+            if (std::strcmp(e.name, "audio.out") != 0) continue;
+            const auto it = uiByFlow.constFind(e.flow);
+            if (it == uiByFlow.constEnd()) continue;
+            QJsonObject b;
+            b["name"] = QString::fromLatin1(it->first->name);
+            b["cat"] = "latency";
+            b["ph"] = "b";
+            b["id"] = qint64(e.flow);
+            b["ts"] = us(it->first->ns);
+            b["pid"] = 1;
+            b["tid"] = it->second;
+            events.append(b);
+            QJsonObject en = b;
+            en["ph"] = "e";
+            en["ts"] = us(e.ns + e.arg);
+            events.append(en);
+        }
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (error) *error = "Cannot write file:\n" + path;
+        return false;
+    }
+    f.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return true;
+}
+
+QString Trace::latencyReport()
+{
+    const QVector<TraceThread> threads = collect();
+
+    // "audio.out": ns = lúc render, arg = phần còn phải chờ trong buffer sink
+    QHash<quint32, qint64> audibleNs;
+    for (const TraceThread& t : threads) {
+        for (const TraceEvent& e : t.events) {
+            if (e.flow && std::strcmp(e.name, "audio.out") == 0
+                && !audibleNs.contains(e.flow))
+                audibleNs.insert(e.flow, e.ns + e.arg);
+        }
+    }
+
+    QMap<QString, std::vector<double>> byKind;
+    QMap<QString, int> silent;
+    for (const TraceThread& t : threads) {
+        for (const TraceEvent& e : t.events) {
+            if (!e.flow || std::strncmp(e.name, "ui.", 3) != 0) continue;
+            const QString kind = QString::fromLatin1(e.name + 3);
+            const auto it = audibleNs.constFind(e.flow);
+            if (it == audibleNs.constEnd())
+                ++silent[kind];     // pause, seek khi đang dừng...
+            else
+                byKind[kind].push_back((*it - e.ns) / 1e6);
+        }
+    }
+
+    QString out;
+    QTextStream ts(&out);
+    ts << "Latency from UI event to first audible sample (ms)\n";
+    ts << QString("%1 %2 %3 %4 %5 %6\n").arg("kind", -10).arg("n", 6)
+        .arg("p50", 8).arg("p95", 8).arg("p99", 8).arg("max", 8);
+    for (auto it = byKind.begin(); it != byKind.end(); ++it) {
+        std::vector<double>& v = it.value();
+        std::sort(v.begin(), v.end());
+        ts << QString("%1 %2 %3 %4 %5 %6\n").arg(it.key(), -10)
+            .arg(int(v.size()), 6)
+            .arg(percentile(v, 0.50), 8, 'f', 1)
+            .arg(percentile(v, 0.95), 8, 'f', 1)
+            .arg(percentile(v, 0.99), 8, 'f', 1)
+            .arg(v.back(), 8, 'f', 1);
+    }
+    if (byKind.isEmpty())
+        ts << "(no playback recorded)\n";
+    for (auto it = silent.begin(); it != silent.end(); ++it)
+        ts << it.key() << ": " << it.value() << " without sound\n";
+    return out;
+}
+
+//===================== Audio decode (PCM cache) =====================
+
+// Vùng PCM int16 map từ file, giữ file mở suốt đời mapping. File tạm
+// (QTemporaryFile) tự xoá khi mapping cuối cùng được thả.
+class PcmMapping
+{
+public:
+    static std::shared_ptr<const PcmMapping> create(
+        std::unique_ptr<QFile> file, qint64 offset, qint64 frames)
+    {
+        if (frames <= 0 || (offset & 1)) return {};
+        uchar* base = file->map(offset, frames * qint64(sizeof(qint16)));
+        if (!base) return {};
+        auto m = std::shared_ptr<PcmMapping>(new PcmMapping);
+        m->m_file = std::move(file);
+        m->m_base = base;
+        m->data = reinterpret_cast<const qint16*>(base);
+        m->frames = frames;
+        return m;
+    }
+
+    ~PcmMapping()
+    {
+        if (m_base) m_file->unmap(m_base);
+    }
+
+    const qint16* data = nullptr;
+    qint64 frames = 0;
+
+private:
+    PcmMapping() = default;
+
+    std::unique_ptr<QFile> m_file;
+    uchar* m_base = nullptr;
+};
+
+// WAV PCM 16 bit mono: trỏ thẳng vào chunk data của file gốc, không giải
+// mã và không copy. Định dạng khác (stereo, 24 bit, float) đi đường
+// QAudioDecoder vì cần downmix/đổi kiểu.
+static bool mapWavFile(const QString& path, PcmData& out)
+{
+    if (QSysInfo::ByteOrder != QSysInfo::LittleEndian
+        || !path.endsWith(".wav", Qt::CaseInsensitive))
+        return false;
+    auto file = std::make_unique<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly)) return false;
+    const QByteArray riff = file->read(12);
+    if (riff.size() < 12 || !riff.startsWith("RIFF")
+        || riff.mid(8, 4) != "WAVE")
+        return false;
+
+    bool pcm16mono = false;
+    int rate = 0;
+    for (;;) {
+        const QByteArray h = file->read(8);
+        if (h.size() < 8) return false;
+        const quint32 size = qFromLittleEndian<quint32>(h.constData() + 4);
+        const qint64 next = file->pos() + qint64(size) + (size & 1);
+        if (h.startsWith("fmt ")) {
+            const QByteArray f = file->read(std::min<quint32>(size, 40));
+            if (f.size() < 16) return false;
+            const char* d = f.constData();
+            const quint16 tag = qFromLittleEndian<quint16>(d);
+            const bool isPcm = tag == 1 || (tag == 0xFFFE && f.size() >= 26
+                && qFromLittleEndian<quint16>(d + 24) == 1);
+            rate = int(qFromLittleEndian<quint32>(d + 4));
+            pcm16mono = isPcm && qFromLittleEndian<quint16>(d + 2) == 1
+                && qFromLittleEndian<quint16>(d + 14) == 16;
+        }
+        else if (h.startsWith("data")) {
+            if (!pcm16mono || rate <= 0) return false;
+            const qint64 offset = file->pos();
+            // WAV ghi dở có size 0/0xFFFFFFFF: lấy tới cuối file
+            const qint64 avail = file->size() - offset;
+            const qint64 bytes = (size == 0 || size == 0xFFFFFFFFu)
+                ? avail : std::min<qint64>(size, avail);
+            auto m = PcmMapping::create(std::move(file), offset,
+                bytes / qint64(sizeof(qint16)));
+            if (!m) return false;
+            out.sampleRate = rate;
+            out.setMapped(m, m->data, m->frames);
+            return true;
+        }
+        if (!file->seek(next)) return false;
+    }
+}
+
+static void appendAudioBuffer(const QAudioBuffer& buf, PcmData& out)
+{
+    if (!buf.isValid()) return;
+    const QAudioFormat fmt = buf.format();
+    const int ch = fmt.channelCount();
+    const qsizetype frames = buf.frameCount();
+    if (ch <= 0 || frames <= 0) return;
+    if (out.sampleRate == 0)
+        out.sampleRate = fmt.sampleRate();
+
+    const qsizetype base = out.samples.size();
+    out.samples.resize(base + frames);
+    qint16* dst = out.samples.data() + base;
+
+    // downmix về mono
+    switch (fmt.sampleFormat()) {
+    case QAudioFormat::Int16: {
+        const qint16* src = buf.constData<qint16>();
+        for (qsizetype i = 0; i < frames; ++i) {
+            int acc = 0;
+            for (int c = 0; c < ch; ++c) acc += src[i * ch + c];
+            dst[i] = qint16(acc / ch);
+        }
+        break;
+    }
+    case QAudioFormat::Int32: {
+        const qint32* src = buf.constData<qint32>();
+        for (qsizetype i = 0; i < frames; ++i) {
+            qint64 acc = 0;
+            for (int c = 0; c < ch; ++c) acc += src[i * ch + c] >> 16;
+            dst[i] = qint16(acc / ch);
+        }
+        break;
+    }
+    case QAudioFormat::Float: {
+        const float* src = buf.constData<float>();
+        for (qsizetype i = 0; i < frames; ++i) {
+            float acc = 0.0f;
+            for (int c = 0; c < ch; ++c) acc += src[i * ch + c];
+            acc = std::clamp(acc / ch, -1.0f, 1.0f);
+            dst[i] = qint16(std::lround(acc * 32767.0f));
+        }
+        break;
+    }
+    case QAudioFormat::UInt8: {
+        const quint8* src = buf.constData<quint8>();
+        for (qsizetype i = 0; i < frames; ++i) {
+            int acc = 0;
+            for (int c = 0; c < ch; ++c) acc += (int(src[i * ch + c]) - 128) << 8;
+            dst[i] = qint16(acc / ch);
+        }
+        break;
+    }
+    default:
+        std::fill(dst, dst + frames, qint16(0));
+        break;
+    }
+}
+
+// QAudioDecoder → out.samples. Vượt kPcmSpillSamples thì đổ khối đang
+// đệm ra file tạm và đọc tiếp, cuối cùng map cả file (RAM chỉ giữ một
+// khối). Không tạo được file tạm thì giữ tất cả trong RAM như cũ.
+static bool decodeToPcm(const QString& path, PcmData& out)
+{
+    QAudioDecoder decoder;
+    decoder.setSource(QUrl::fromLocalFile(path));
+
+    std::unique_ptr<QTemporaryFile> spill;
+    bool noSpill = false;
+    bool failed = false;
+    QEventLoop loop;
+
+    // false nếu ghi lỗi (đĩa đầy...) – phần đã đổ ra không lấy lại được
+    auto flushSpill = [&]() {
+        if (!spill) {
+            spill = std::make_unique<QTemporaryFile>(
+                QDir::tempPath() + "/shadowing_pcm_XXXXXX.raw");
+            if (!spill->open()) {
+                spill.reset();
+                noSpill = true;
+                return true;
+            }
+        }
+        const qint64 bytes = out.samples.size() * qint64(sizeof(qint16));
+        if (spill->write(reinterpret_cast<const char*>(
+            out.samples.constData()), bytes) != bytes)
+            return false;
+        out.samples.resize(0);      // giữ capacity cho khối sau
+        return true;
+    };
+
+    QObject::connect(&decoder, &QAudioDecoder::bufferReady,
+        &loop, [&]() {
+            const qsizetype before = out.samples.size();
+            appendAudioBuffer(decoder.read(), out);
+            Trace::instant("decode.buffer", 0, out.samples.size() - before);
+            if (!noSpill && out.samples.size() >= kPcmSpillSamples
+                && !flushSpill()) {
+                failed = true;
+                decoder.stop();
+                loop.quit();
+            }
+        });
+    QObject::connect(&decoder, &QAudioDecoder::finished,
+        &loop, &QEventLoop::quit);
+    QObject::connect(&decoder,
+        QOverload<QAudioDecoder::Error>::of(&QAudioDecoder::error),
+        &loop, [&](QAudioDecoder::Error) {
+            failed = true;
+            loop.quit();
+        });
+
+    decoder.start();
+    if (!failed && decoder.isDecoding())
+        loop.exec(QEventLoop::ExcludeUserInputEvents);
+    if (failed || out.sampleRate <= 0)
+        return false;
+
+    if (!spill) {
+        out.samples.squeeze();
+        return !out.isEmpty();
+    }
+    if (!out.samples.isEmpty() && !flushSpill())
+        return false;
+    if (!spill->flush())
+        return false;
+    const qint64 frames = spill->size() / qint64(sizeof(qint16));
+    auto m = PcmMapping::create(std::move(spill), 0, frames);
+    if (!m) return false;
+    out.setMapped(m, m->data, m->frames);
+    return true;
+}
+
+namespace {
+std::mutex g_decodeMutex;
+DecodeStats g_decodeStats;
+} // namespace
+
+DecodeStats lastDecodeStats()
+{
+    std::lock_guard<std::mutex> lock(g_decodeMutex);
+    return g_decodeStats;
+}
+
+// Giải mã toàn bộ file thành PCM mono (event loop cục bộ, chặn input).
+// Mỗi lời gọi có QAudioDecoder riêng nên chạy song song được trên worker.
+bool decodeAudioFile(const QString& path, PcmData& out)
+{
+    const qint64 t0 = steadyNowNs();
+    out = PcmData();
+    if (path.isEmpty() || !QFile::exists(path))
+        return false;
+
+    if (!mapWavFile(path, out)) {
+        out = PcmData();
+        if (!decodeToPcm(path, out)) {
+            out = PcmData();
+            return false;
+        }
+    }
+    Trace::instant("decode.done", 0, out.frames());
+
+    std::lock_guard<std::mutex> lock(g_decodeMutex);
+    ++g_decodeStats.files;
+    g_decodeStats.audioSec = double(out.frames()) / out.sampleRate;
+    g_decodeStats.wallSec = (steadyNowNs() - t0) / 1e9;
+    return true;
+}
+
+//===================== Compressed PCM blocks =====================
+
+namespace {
+
+constexpr int kPcmGroup = 256;      // mẫu mỗi nhóm (chung bậc dự đoán + số bit)
+
+// ghi bit LSB trước
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+    void put(uint32_t v, int bits)
+    {
+        m_acc |= uint64_t(v) << m_bits;
+        m_bits += bits;
+        while (m_bits >= 8) {
+            m_out.push_back(uint8_t(m_acc));
+            m_acc >>= 8;
+            m_bits -= 8;
+        }
+    }
+
+    void flush()
+    {
+        if (m_bits > 0) m_out.push_back(uint8_t(m_acc));
+        m_acc = 0;
+        m_bits = 0;
+    }
+
+private:
+    std::vector<uint8_t>& m_out;
+    uint64_t m_acc = 0;
+    int m_bits = 0;
+};
+
+// đọc 8 byte một lần; buffer phải có 8 byte đệm sau dữ liệu
+class BitReader
+{
+public:
+    explicit BitReader(const uint8_t* p) : m_p(p) {}
+
+    uint32_t get(int bits)
+    {
+        if (m_bits < bits) refill();
+        const uint32_t v = uint32_t(m_acc & ((uint64_t(1) << bits) - 1));
+        m_acc >>= bits;
+        m_bits -= bits;
+        return v;
+    }
+
+private:
+    void refill()
+    {
+        uint64_t w;
+        std::memcpy(&w, m_p, sizeof(w));
+        m_acc |= w << m_bits;
+        m_p += (63 - m_bits) >> 3;
+        m_bits |= 56;
+    }
+
+    const uint8_t* m_p;
+    uint64_t m_acc = 0;
+    int m_bits = 0;
+};
+
+inline uint32_t zigzag(int32_t r) { return (uint32_t(r) << 1) ^ uint32_t(r >> 31); }
+inline int32_t unzigzag(uint32_t z) { return int32_t(z >> 1) ^ -int32_t(z & 1); }
+
+inline int bitWidth(uint32_t v)
+{
+    int w = 0;
+    for (; v; v >>= 1) ++w;
+    return w;
+}
+
+// Khối: mẫu đầu 16 bit thô, sau đó từng nhóm kPcmGroup mẫu gồm 1 bit bậc
+// dự đoán (0: x[n-1], 1: 2x[n-1] - x[n-2]), 5 bit độ rộng w rồi các phần
+// dư zigzag, mỗi cái w bit (w = 0: nhóm lặng hoặc tuyến tính hoàn toàn).
+void encodePcmBlock(const qint16* x, int n, std::vector<uint8_t>& out)
+{
+    BitWriter bw(out);
+    bw.put(uint16_t(x[0]), 16);
+    int32_t p1 = x[0], p2 = x[0];
+    uint32_t z1[kPcmGroup], z2[kPcmGroup];
+    for (int g = 1; g < n; g += kPcmGroup) {
+        const int m = std::min(kPcmGroup, n - g);
+        uint32_t or1 = 0, or2 = 0;
+        int32_t a = p1, b = p2;
+        for (int i = 0; i < m; ++i) {
+            const int32_t v = x[g + i];
+            z1[i] = zigzag(v - a);
+            z2[i] = zigzag(v - (2 * a - b));
+            or1 |= z1[i];
+            or2 |= z2[i];
+            b = a;
+            a = v;
+        }
+        const int w1 = bitWidth(or1), w2 = bitWidth(or2);
+        const bool second = w2 < w1;
+        const int w = second ? w2 : w1;
+        const uint32_t* z = second ? z2 : z1;
+        bw.put(second ? 1u : 0u, 1);
+        bw.put(uint32_t(w), 5);
+        if (w > 0) {
+            for (int i = 0; i < m; ++i) bw.put(z[i], w);
+        }
+        p1 = a;
+        p2 = b;
+    }
+    bw.flush();
+}
+
+void decodePcmBlock(const uint8_t* p, int n, qint16* dst)
+{
+    BitReader br(p);
+    int32_t p1 = int16_t(uint16_t(br.get(16)));
+    int32_t p2 = p1;
+    dst[0] = qint16(p1);
+    for (int g = 1; g < n; g += kPcmGroup) {
+        const int m = std::min(kPcmGroup, n - g);
+        const bool second = br.get(1) != 0;
+        const int w = int(br.get(5));
+        qint16* d = dst + g;
+        if (second) {
+            for (int i = 0; i < m; ++i) {
+                const int32_t v = 2 * p1 - p2 + (w ? unzigzag(br.get(w)) : 0);
+                d[i] = qint16(v);
+                p2 = p1;
+                p1 = v;
+            }
+        }
+        else {
+            for (int i = 0; i < m; ++i) {
+                const int32_t v = p1 + (w ? unzigzag(br.get(w)) : 0);
+                d[i] = qint16(v);
+                p2 = p1;
+                p1 = v;
+            }
+        }
+    }
+}
+
+} // namespace
+
+struct PcmBlocks
+{
+    std::vector<uint8_t> bytes;     // các khối nối nhau + 8 byte đệm
+    std::vector<qint64>  offsets;   // đầu mỗi khối trong bytes
+};
+
+qint64 PcmData::storedBytes() const
+{
+    if (m_blocks)
+        return qint64(m_blocks->bytes.size())
+            + qint64(m_blocks->offsets.size() * sizeof(qint64));
+    return m_mapping ? 0 : samples.size() * qint64(sizeof(qint16));
+}
+
+void PcmData::readBlock(qint64 block, qint16* dst) const
+{
+    const qint64 f0 = block << kPcmBlockShift;
+    const int n = int(std::min(kPcmBlockFrames, frames() - f0));
+    if (n <= 0) return;
+    if (const qint16* raw = data()) {
+        std::copy(raw + f0, raw + f0 + n, dst);
+        return;
+    }
+    decodePcmBlock(m_blocks->bytes.data() + m_blocks->offsets[size_t(block)],
+        n, dst);
+}
+
+void PcmData::readFrames(qint64 f0, qint64 n, qint16* dst) const
+{
+    if (n <= 0) return;
+    if (const qint16* raw = data()) {
+        std::copy(raw + f0, raw + f0 + n, dst);
+        return;
+    }
+    // khối nằm trọn trong đoạn giải nén thẳng vào dst, hai khối mép qua
+    // buffer tạm
+    std::vector<qint16> edge;
+    const qint64 f1 = f0 + n;
+    for (qint64 b = f0 >> kPcmBlockShift; (b << kPcmBlockShift) < f1; ++b) {
+        const qint64 b0 = b << kPcmBlockShift;
+        const qint64 b1 = std::min(b0 + kPcmBlockFrames, frames());
+        if (b0 >= f0 && b1 <= f1) {
+            readBlock(b, dst + (b0 - f0));
+            continue;
+        }
+        edge.resize(size_t(kPcmBlockFrames));
+        readBlock(b, edge.data());
+        const qint64 c0 = std::max(b0, f0), c1 = std::min(b1, f1);
+        std::copy(edge.data() + (c0 - b0), edge.data() + (c1 - b0),
+            dst + (c0 - f0));
+    }
+}
+
+bool compressPcm(PcmData& pcm)
+{
+    if (pcm.isEmpty()) return false;
+    if (pcm.isCompressed()) return true;
+
+    const qint64 frames = pcm.frames();
+    const int blocks = int((frames + kPcmBlockFrames - 1) / kPcmBlockFrames);
+    std::vector<std::vector<uint8_t>> parts(blocks);
+    const qint16* x = pcm.data();
+    TaskPool::instance().parallelFor(blocks, [&](int b) {
+        const qint64 f0 = qint64(b) << kPcmBlockShift;
+        const int n = int(std::min(kPcmBlockFrames, frames - f0));
+        parts[size_t(b)].reserve(size_t(n) * sizeof(qint16) / 2);
+        encodePcmBlock(x + f0, n, parts[size_t(b)]);
+    });
+
+    auto out = std::make_shared<PcmBlocks>();
+    size_t total = 0;
+    for (const auto& p : parts) total += p.size();
+    out->bytes.reserve(total + 8);
+    out->offsets.reserve(size_t(blocks));
+    for (const auto& p : parts) {
+        out->offsets.push_back(qint64(out->bytes.size()));
+        out->bytes.insert(out->bytes.end(), p.begin(), p.end());
+    }
+    out->bytes.resize(out->bytes.size() + 8, 0);    // BitReader đọc 8 byte
+    pcm.setCompressed(std::move(out), frames);
+    return true;
+}
+
+//===================== Resampler =====================
+
+namespace {
+
+constexpr int    kResampleTaps = 64;        // khi tăng rate / giữ nguyên
+constexpr int    kResampleMaxRows = 1024;   // L lớn hơn: làm tròn về hàng gần nhất
+constexpr int    kResampleBufFrames = 4096;
+constexpr double kResamplePassband = 0.9;   // cutoff / Nyquist (của rate thấp hơn)
+constexpr double kResampleBeta = 10.0;      // Kaiser, ~100 dB chặn dải
+
+double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+} // namespace
+
+void Resampler::configure(int inRate, int outRate)
+{
+    m_inRate = inRate;
+    m_outRate = outRate;
+    const int g = std::gcd(std::max(1, inRate), std::max(1, outRate));
+    m_L = std::max(1, outRate / g);
+    m_M = std::max(1, inRate / g);
+    m_bank.clear();
+    m_buf.clear();
+    m_taps = 0;
+    m_rows = 0;
+    reset();
+    if (isPassthrough()) return;
+
+    // cutoff theo Nyquist của rate thấp hơn, tính bằng chu kỳ / mẫu vào
+    const double scale = std::min(1.0, double(m_L) / m_M);
+    const double fc = 0.5 * kResamplePassband * scale;
+    m_taps = (int(std::ceil(kResampleTaps / scale)) + 7) / 8 * 8;
+    m_rows = std::min(m_L, kResampleMaxRows);
+    m_bank.resize(size_t(m_rows + 1) * m_taps);
+
+    // hàng p: mẫu ra ở vị trí taps/2 - 1 + p/rows trong cửa sổ. Thêm hàng
+    // p = rows (lệch đúng một mẫu) để pha làm tròn lên không phải đổi cửa
+    // sổ: tap rơi ra ngoài cửa sổ nằm ở mép Kaiser, vốn bằng 0.
+    const double half = m_taps / 2.0;
+    const double i0Beta = besselI0(kResampleBeta);
+    for (int p = 0; p <= m_rows; ++p) {
+        float* h = m_bank.data() + size_t(p) * m_taps;
+        double sum = 0.0;
+        for (int j = 0; j < m_taps; ++j) {
+            const double t = (m_taps / 2 - 1 - j) + double(p) / m_rows;
+            const double x = 2.0 * fc * t;
+            const double sinc = std::abs(x) < 1e-12
+                ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+            const double r = t / half;
+            const double w = std::abs(r) >= 1.0
+                ? 0.0 : besselI0(kResampleBeta * std::sqrt(1.0 - r * r)) / i0Beta;
+            h[j] = float(2.0 * fc * sinc * w);
+            sum += h[j];
+        }
+        // mọi pha có hệ số DC đúng 1: không gợn theo pha
+        for (int j = 0; j < m_taps; ++j)
+            h[j] = float(h[j] / sum);
+    }
+    m_buf.assign(size_t(m_taps) + kResampleBufFrames, 0.0f);
+    reset();
+}
+
+void Resampler::reset()
+{
+    // cửa sổ đầu toàn 0 (nửa trước là quá khứ im lặng)
+    m_len = m_taps > 0 ? m_taps - 1 : 0;
+    std::fill(m_buf.begin(), m_buf.end(), 0.0f);
+    m_pos = 0;
+    m_phase = 0;
+}
+
+float Resampler::next()
+{
+    const float* x = m_buf.data() + m_pos;
+    // hàng gần nhất với pha (sai lệch tối đa nửa hàng); rows == L thì
+    // đúng bằng m_phase
+    const int row = int((qint64(m_phase) * m_rows + m_L / 2) / m_L);
+    const float* h = m_bank.data() + size_t(row) * m_taps;
+
+    // 8 tổng riêng rồi cộng dạng cây: vector hoá được mà không cần
+    // -ffast-math
+    float acc[8] = {};
+    for (int j = 0; j < m_taps; j += 8) {
+        for (int k = 0; k < 8; ++k)
+            acc[k] += x[j + k] * h[j + k];
+    }
+    const float y = ((acc[0] + acc[1]) + (acc[2] + acc[3]))
+        + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+
+    m_phase += m_M;
+    m_pos += m_phase / m_L;
+    m_phase %= m_L;
+    return y;
+}
+
+void Resampler::compact()
+{
+    if (m_pos == 0) return;
+    std::copy(m_buf.begin() + m_pos, m_buf.begin() + m_len, m_buf.begin());
+    m_len -= m_pos;
+    m_pos = 0;
+}
+
+int Resampler::process(const float* in, int nIn, float* out)
+{
+    int produced = 0;
+    while (nIn > 0) {
+        compact();
+        const int k = std::min(nIn, int(m_buf.size()) - m_len);
+        std::copy(in, in + k, m_buf.begin() + m_len);
+        m_len += k;
+        in += k;
+        nIn -= k;
+        while (m_pos + m_taps <= m_len)
+            out[produced++] = next();
+    }
+    return produced;
+}
+
+//===================== Word timing =====================
+
+QStringList sentenceWords(const QString& text)
+{
+    return text.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+}
+
+// Đếm âm tiết thô: số nhóm nguyên âm, bỏ "e" câm cuối từ
+static int countSyllables(const QString& word)
+{
+    int count = 0;
+    int letters = 0;
+    bool prevVowel = false;
+    QChar last, beforeLast;
+    for (QChar c : word) {
+        c = c.toLower();
+        if (c < QLatin1Char('a') || c > QLatin1Char('z'))
+            continue;
+        bool vowel = QStringLiteral("aeiouy").contains(c);
+        if (vowel && !prevVowel) ++count;
+        prevVowel = vowel;
+        beforeLast = last;
+        last = c;
+        ++letters;
+    }
+    if (letters > 2 && last == QLatin1Char('e')
+        && beforeLast != QLatin1Char('l') && count > 1)
+        --count;
+    return std::max(1, count);
+}
+
+// Năng lượng RMS theo khung hop mẫu trong [f0, f1)
+static QVector<float> frameEnergy(const PcmData& pcm,
+    qint64 f0, qint64 f1, int hop)
+{
+    QVector<float> energy;
+    f0 = std::max<qint64>(0, f0);
+    f1 = std::min(pcm.frames(), f1);
+    if (hop <= 0 || f1 <= f0) return energy;
+
+    const PcmSlice slice(pcm, f0, f1);
+    const qint16* x = slice.data();
+    energy.reserve(int((f1 - f0) / hop) + 1);
+    for (qint64 f = f0; f < f1; f += hop) {
+        const qint64 stop = std::min(f1, f + hop);
+        double acc = 0.0;
+        for (qint64 i = f - f0; i < stop - f0; ++i)
+            acc += double(x[i]) * x[i];
+        energy.push_back(float(std::sqrt(acc / double(stop - f))));
+    }
+    return energy;
+}
+
+// Chia [begin,end] theo số âm tiết, rồi dời mỗi ranh giới về
+// cực tiểu năng lượng gần nhất (nếu đã có PCM).
+void estimateWordTimes(Sentence& s, const PcmData* pcm)
+{
+    s.wordStartMs.clear();
+    if (s.begin < 0.0 || s.end <= s.begin) return;
+
+    const QStringList words = sentenceWords(s.text);
+    const int n = words.size();
+    if (n == 0) return;
+
+    QVector<int> syl(n);
+    int total = 0;
+    for (int i = 0; i < n; ++i) {
+        syl[i] = countSyllables(words[i]);
+        total += syl[i];
+    }
+
+    const double len = s.end - s.begin;
+    QVector<double> bounds(n + 1);
+    int acc = 0;
+    for (int i = 0; i <= n; ++i) {
+        bounds[i] = s.begin + len * double(acc) / double(total);
+        if (i < n) acc += syl[i];
+    }
+
+    if (pcm && !pcm->isEmpty() && n > 1) {
+        const int hop = std::max(1, pcm->sampleRate / 100); // 10 ms
+        const double frameSec = double(hop) / pcm->sampleRate;
+        const qint64 f0 = qint64(s.begin * pcm->sampleRate);
+        const qint64 f1 = qint64(s.end * pcm->sampleRate);
+        const QVector<float> energy = frameEnergy(*pcm, f0, f1, hop);
+        const double minGap = 0.02;
+
+        for (int i = 1; i < n && !energy.isEmpty(); ++i) {
+            double radius = 0.3 * std::min(bounds[i] - bounds[i - 1],
+                bounds[i + 1] - bounds[i]);
+            double lo = std::max(bounds[i] - radius, bounds[i - 1] + minGap);
+            double hi = std::min(bounds[i] + radius, bounds[i + 1] - minGap);
+            if (hi <= lo) continue;
+
+            int k0 = std::max(0, int((lo - s.begin) / frameSec));
+            int k1 = std::min(int(energy.size()) - 1,
+                int((hi - s.begin) / frameSec));
+            int best = -1;
+            for (int k = k0; k <= k1; ++k) {
+                if (best < 0 || energy[k] < energy[best])
+                    best = k;
+            }
+            if (best >= 0)
+                bounds[i] = s.begin + (best + 0.5) * frameSec;
+        }
+    }
+
+    s.wordStartMs.resize(n);
+    for (int i = 0; i < n; ++i) {
+        double ms = std::round((bounds[i] - s.begin) * 1000.0);
+        s.wordStartMs[i] = quint32(std::clamp(ms, 0.0,
+            double(std::numeric_limits<quint32>::max())));
+    }
+}
+
+bool wordRange(const Sentence& s, int wordIdx,
+    double& begin, double& end)
+{
+    if (wordIdx < 0 || wordIdx >= s.wordStartMs.size())
+        return false;
+    begin = s.begin + s.wordStartMs[wordIdx] / 1000.0;
+    end = (wordIdx + 1 < s.wordStartMs.size())
+        ? s.begin + s.wordStartMs[wordIdx + 1] / 1000.0
+        : s.end;
+    return end > begin;
+}
+
+// câu đầu tiên có [begin, end) chứa t, -1 nếu t nằm ngoài mọi câu
+int sentenceAt(const QVector<Sentence>& sentences, double t)
+{
+    for (int i = 0; i < sentences.size(); ++i) {
+        const Sentence& s = sentences[i];
+        if (s.begin >= 0.0 && t >= s.begin && t < s.end)
+            return i;
+    }
+    return -1;
+}
+
+// Từ vựng: tách từ từng câu song song rồi gộp + sắp xếp
+QVector<WordOccurrence> buildWordIndex(
+    const QVector<Sentence>& sentences)
+{
+    QVector<QVector<WordOccurrence>> perRow(sentences.size());
+    QVector<WordOccurrence>* rows = perRow.data();
+    TaskPool::instance().parallelFor(int(sentences.size()), [&](int r) {
+        // tương đương thay [^A-Za-z'] bằng ' ' rồi tách
+        const QStringList words = sentenceWords(sentences[r].text);
+        for (int i = 0; i < words.size(); ++i) {
+            QString cur;
+            for (QChar c : words[i]) {
+                const bool letter = (c >= QLatin1Char('a') && c <= QLatin1Char('z'))
+                    || (c >= QLatin1Char('A') && c <= QLatin1Char('Z'))
+                    || c == QLatin1Char('\'');
+                if (letter) {
+                    cur += c;
+                }
+                else if (!cur.isEmpty()) {
+                    rows[r].push_back({ cur.toLower(), r, i });
+                    cur.clear();
+                }
+            }
+            if (!cur.isEmpty())
+                rows[r].push_back({ cur.toLower(), r, i });
+        }
+    });
+
+    QVector<WordOccurrence> index;
+    for (const QVector<WordOccurrence>& row : perRow)
+        index += row;
+    std::sort(index.begin(), index.end());
+    return index;
+}
+
+const WordOccurrence* findWord(
+    const QVector<WordOccurrence>& index, const QString& word)
+{
+    WordOccurrence key{ word.toLower(), -1, -1 };
+    auto it = std::lower_bound(index.begin(), index.end(), key);
+    if (it == index.end() || it->word != key.word)
+        return nullptr;
+    return &*it;
+}
+
+//===================== Lesson preparation =====================
+
+bool assignTimesByWordCount(QVector<Sentence>& sentences, double duration)
+{
+    // Thay cho Whisper: tạm gán Begin/End theo số từ
+    if (duration <= 0.0 || sentences.isEmpty()) return false;
+    for (const Sentence& s : sentences) {
+        if (s.begin >= 0.0 && s.end > s.begin)
+            return false;
+    }
+
+    int totalWords = 0;
+    QVector<int> wordCounts;
+    for (const Sentence& s : sentences) {
+        int c = countWords(s.text);
+        if (c <= 0) c = 1;
+        wordCounts.push_back(c);
+        totalWords += c;
+    }
+    if (totalWords <= 0) totalWords = sentences.size();
+
+    double t = 0.0;
+    for (int i = 0; i < sentences.size(); ++i) {
+        double frac =
+            double(wordCounts[i]) / double(totalWords);
+        double len = duration * frac;
+        sentences[i].begin = t;
+        sentences[i].end = t + len;
+        t += len;
+    }
+    return true;
+}
+
+// Ranh giới chung giữa hai câu liền nhau (end trước == begin sau) dời về
+// chỗ lặng nhất trong ±radiusSec, mỗi câu giữ tối thiểu kMinSentenceSec.
+// Năng lượng 10 ms làm mượt 50 ms để không bắt nhầm khe giữa hai âm tiết.
+void snapBoundariesToPauses(QVector<Sentence>& sentences,
+    const PcmData& pcm, double radiusSec)
+{
+    if (pcm.isEmpty()) return;
+    constexpr double kMinSentenceSec = 0.3;
+    constexpr int kSmooth = 5;
+    const int hop = std::max(1, pcm.sampleRate / 100);
+    const double frameSec = double(hop) / pcm.sampleRate;
+
+    for (int i = 1; i < sentences.size(); ++i) {
+        Sentence& prev = sentences[i - 1];
+        Sentence& cur = sentences[i];
+        if (prev.begin < 0.0 || cur.end <= cur.begin
+            || std::abs(prev.end - cur.begin) > 1e-6)
+            continue;
+
+        const double lo = std::max(cur.begin - radiusSec,
+            prev.begin + kMinSentenceSec);
+        const double hi = std::min(cur.begin + radiusSec,
+            cur.end - kMinSentenceSec);
+        if (hi <= lo) continue;
+
+        const qint64 f0 = qint64(lo * pcm.sampleRate);
+        const QVector<float> energy = frameEnergy(pcm, f0,
+            qint64(hi * pcm.sampleRate), hop);
+        if (energy.size() <= kSmooth) continue;
+
+        int best = -1;
+        double bestSum = 0.0;
+        for (int k = 0; k + kSmooth <= energy.size(); ++k) {
+            double sum = 0.0;
+            for (int j = 0; j < kSmooth; ++j) sum += energy[k + j];
+            if (best < 0 || sum < bestSum) {
+                best = k;
+                bestSum = sum;
+            }
+        }
+        const double t = double(f0) / pcm.sampleRate
+            + (best + kSmooth * 0.5) * frameSec;
+        prev.end = t;
+        cur.begin = t;
+    }
+}
+
+QStringList validateLesson(const QVector<Sentence>& sentences,
+    double duration)
+{
+    QStringList issues;
+    double lastEnd = -1.0;
+    for (int i = 0; i < sentences.size(); ++i) {
+        const Sentence& s = sentences[i];
+        const QString tag = QString("Sentence %1: ").arg(i + 1);
+        if (s.text.trimmed().isEmpty())
+            issues << tag + "empty text";
+        if (s.begin < 0.0 || s.end < 0.0) {
+            issues << tag + "missing Begin/End";
+            continue;
+        }
+        if (s.end <= s.begin)
+            issues << tag + QString("End %1 is not after Begin %2")
+                .arg(formatTime(s.end), formatTime(s.begin));
+        if (duration > 0.0 && s.end > duration + 0.05)
+            issues << tag + QString("End %1 is past the audio (%2)")
+                .arg(formatTime(s.end), formatTime(duration));
+        if (s.begin < lastEnd - 1e-3)
+            issues << tag + QString("overlaps the previous sentence "
+                "(Begin %1 < %2)").arg(formatTime(s.begin),
+                formatTime(lastEnd));
+        lastEnd = std::max(lastEnd, s.end);
+    }
+    return issues;
+}
+
+bool saveLessonSrt(const QString& path,
+    const QVector<Sentence>& sentences, QString* error)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (error) *error = "Cannot write SRT file:\n" + path;
+        return false;
+    }
+    auto stamp = [](double sec) {
+        const qint64 ms = qRound64(sec * 1000.0);
+        return QString("%1:%2:%3,%4")
+            .arg(ms / 3600000, 2, 10, QLatin1Char('0'))
+            .arg(ms / 60000 % 60, 2, 10, QLatin1Char('0'))
+            .arg(ms / 1000 % 60, 2, 10, QLatin1Char('0'))
+            .arg(ms % 1000, 3, 10, QLatin1Char('0'));
+    };
+
+    QTextStream out(&f);
+    int n = 0;
+    for (const Sentence& s : sentences) {
+        if (s.begin < 0.0 || s.end <= s.begin) continue;
+        out << ++n << "\n"
+            << stamp(s.begin) << " --> " << stamp(s.end) << "\n"
+            << s.text.trimmed() << "\n\n";
+    }
+    return true;
+}
+
+//===================== Loudness =====================
+
+namespace {
+
+// biquad dạng chuyển vị II; double vì cực của high-pass 38 Hz nằm rất sát 1
+struct Biquad
+{
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+    double z1 = 0.0, z2 = 0.0;
+
+    double run(double x)
+    {
+        const double y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        return y;
+    }
+};
+
+// K-weighting của BS.1770 cho sample rate bất kỳ: shelf cao ~+4 dB rồi
+// high-pass ~38 Hz (hệ số tính lại theo rate thay vì bảng 48 kHz)
+void kWeighting(int sampleRate, Biquad& shelf, Biquad& highPass)
+{
+    double f0 = 1681.974450955533;
+    double q = 0.7071752369554196;
+    double k = std::tan(M_PI * f0 / sampleRate);
+    const double vh = std::pow(10.0, 3.999843853973347 / 20.0);
+    const double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    shelf.b1 = 2.0 * (k * k - vh) / a0;
+    shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(M_PI * f0 / sampleRate);
+    a0 = 1.0 + k / q + k * k;
+    highPass.b0 = 1.0;
+    highPass.b1 = -2.0;
+    highPass.b2 = 1.0;
+    highPass.a1 = 2.0 * (k * k - 1.0) / a0;
+    highPass.a2 = (1.0 - k / q + k * k) / a0;
+}
+
+} // namespace
+
+bool analyzeLoudness(Sentence& s, const PcmData& pcm)
+{
+    constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+    s.loudness = kNaN;
+    s.peakDb = kNaN;
+    if (pcm.isEmpty() || s.begin < 0.0 || s.end <= s.begin) return false;
+
+    const int sr = pcm.sampleRate;
+    const qint64 frames = pcm.frames();
+    const qint64 f0 = std::clamp<qint64>(qint64(s.begin * sr), 0, frames);
+    const qint64 f1 = std::clamp<qint64>(qint64(s.end * sr), f0, frames);
+    const qint64 step = std::max(1, sr / 10);      // 100 ms
+    if (f1 - f0 < step / 10) return false;
+
+    // 100 ms trước câu chỉ để filter qua quá độ, không tính vào kết quả
+    const qint64 w0 = std::max<qint64>(0, f0 - step);
+    const PcmSlice slice(pcm, w0, f1);
+    const qint16* x = slice.data();
+    Biquad shelf, highPass;
+    kWeighting(sr, shelf, highPass);
+    for (qint64 i = w0; i < f0; ++i)
+        highPass.run(shelf.run(x[i - w0] / 32768.0));
+
+    // năng lượng từng bước 100 ms; khối 400 ms (chồng 75%) = 4 bước liền
+    std::vector<double> steps;
+    steps.reserve(size_t((f1 - f0) / step));
+    double acc = 0.0, total = 0.0;
+    qint64 inStep = 0;
+    int peak = 0;
+    for (qint64 i = f0; i < f1; ++i) {
+        const int v = x[i - w0];
+        peak = std::max(peak, std::abs(v));
+        const double y = highPass.run(shelf.run(v / 32768.0));
+        acc += y * y;
+        if (++inStep == step) {
+            steps.push_back(acc / double(step));
+            total += acc;
+            acc = 0.0;
+            inStep = 0;
+        }
+    }
+    total += acc;
+
+    double meanSquare = total / double(f1 - f0);   // câu ngắn hơn một khối
+    if (steps.size() >= 4) {
+        std::vector<double> blocks(steps.size() - 3);
+        for (size_t k = 0; k < blocks.size(); ++k)
+            blocks[k] = (steps[k] + steps[k + 1] + steps[k + 2]
+                + steps[k + 3]) / 4.0;
+        // cổng tuyệt đối -70 LUFS, rồi cổng tương đối -10 LU dưới mức
+        // trung bình của các khối đã qua cổng tuyệt đối
+        const auto gatedMean = [&blocks](double gate) {
+            double sum = 0.0;
+            int n = 0;
+            for (double b : blocks) {
+                if (b > gate) { sum += b; ++n; }
+            }
+            return n > 0 ? sum / n : 0.0;
+        };
+        const double absGate = std::pow(10.0, (-70.0 + 0.691) / 10.0);
+        const double relGate = gatedMean(absGate) * 0.1;
+        meanSquare = gatedMean(std::max(absGate, relGate));
+    }
+
+    s.loudness = std::max(kLoudnessFloorLufs,
+        -0.691 + 10.0 * std::log10(std::max(meanSquare, 1e-20)));
+    s.peakDb = 20.0 * std::log10(std::max(peak, 1) / 32768.0);
+    return true;
+}
+
+int analyzeLoudness(QVector<Sentence>& sentences, const PcmData& pcm,
+    bool missingOnly)
+{
+    if (pcm.isEmpty()) return 0;
+    Sentence* sents = sentences.data();     // detach trước khi chia luồng
+    std::atomic<int> analyzed{ 0 };
+    TaskPool::instance().parallelFor(int(sentences.size()), [&](int i) {
+        if (missingOnly && !std::isnan(sents[i].loudness)) return;
+        if (analyzeLoudness(sents[i], pcm))
+            analyzed.fetch_add(1, std::memory_order_relaxed);
+    });
+    return analyzed.load();
+}
+
+double loudnessGain(const Sentence& s)
+{
+    if (std::isnan(s.loudness)) return 1.0;
+    double db = std::clamp(kLoudnessTargetLufs - s.loudness,
+        -kLoudnessMaxGainDb, kLoudnessMaxGainDb);
+    if (!std::isnan(s.peakDb))
+        db = std::min(db, kLoudnessPeakCeilingDb - s.peakDb);
+    return std::pow(10.0, db / 20.0);
+}
@@ -0,0 +1,742 @@
+﻿// Lõi không GUI của Shadowing English: mô hình dữ liệu, tách câu, JSON
+// lesson, giải mã audio, word timing, chuẩn bị lesson, TaskPool và trace. Dùng
+// chung cho app (Shadowing_English_2025_11_24_R0.cpp) và công cụ dòng lệnh
+// (shadowing_cli.cpp); chỉ cần QtCore + QtMultimedia.
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//===================== Data model =====================
+
+struct Sentence
+{
+    int     id = 0;
+    double  begin = -1.0;    // seconds, <0 = undefined
+    double  end = -1.0;
+    QString text;
+    bool    confirm = false;
+
+    // loudness BS.1770 của [begin, end) (LUFS) và peak (dBFS); NaN = chưa
+    // đo (xem analyzeLoudness)
+    double  loudness = std::numeric_limits<double>::quiet_NaN();
+    double  peakDb = std::numeric_limits<double>::quiet_NaN();
+
+    // onset của từng từ (ms, tính từ begin) – ước lượng, không lưu JSON.
+    // quint32: câu dài tới ~49 ngày (quint16 chỉ được 65,5 s, câu chưa tách
+    // hay độc thoại dài bị dồn mọi từ sau về cùng một chỗ)
+    QVector<quint32> wordStartMs;
+
+    // khoá runtime đi theo câu khi thêm/xoá dòng (id thì đánh số lại);
+    // LessonDocument gán, 0 = chưa gán, không lưu JSON
+    quint32 key = 0;
+};
+
+class PcmMapping;
+struct PcmBlocks;
+
+// Khối nén độc lập (xem compressPcm): giải nén một khối ~50 µs
+constexpr int    kPcmBlockShift = 15;
+constexpr qint64 kPcmBlockFrames = qint64(1) << kPcmBlockShift; // ~0.7 s ở 44.1 kHz
+
+// PCM đã giải mã: mono int16. Mẫu nằm ở một trong ba nơi:
+//  - samples (RAM: take, audio ngắn),
+//  - vùng map từ file (WAV gốc, hoặc file tạm khi audio giải mã quá dài –
+//    xem decodeAudioFile),
+//  - khối nén trong RAM (compressPcm, cho máy ít RAM).
+// Hai dạng đầu đọc thẳng qua data() không copy; dạng nén thì data() là
+// null và phải đọc qua PcmSlice (một đoạn liền) hoặc PcmCursor (truy cập
+// ngẫu nhiên, một khối đệm), hai lớp này cũng đi thẳng khi không nén.
+struct PcmData
+{
+    int sampleRate = 0;
+    QVector<qint16> samples;
+
+    // null nếu đang nén
+    const qint16* data() const
+    {
+        if (m_blocks) return nullptr;
+        return m_mapping ? m_mappedData : samples.constData();
+    }
+    qint64 frames() const
+    {
+        return (m_mapping || m_blocks) ? m_frames : samples.size();
+    }
+    bool isEmpty() const { return sampleRate <= 0 || frames() == 0; }
+    bool isMapped() const { return bool(m_mapping); }
+    bool isCompressed() const { return bool(m_blocks); }
+
+    // byte thực giữ trong RAM (vùng map không tính)
+    qint64 storedBytes() const;
+
+    // chép [f0, f0 + n) ra dst, mọi dạng lưu
+    void readFrames(qint64 f0, qint64 n, qint16* dst) const;
+
+    // giải nén (hoặc chép) khối block – kPcmBlockFrames mẫu, khối cuối
+    // có thể ngắn hơn – vào dst
+    void readBlock(qint64 block, qint16* dst) const;
+
+    // thay samples bằng vùng map; owner giữ file + mapping sống
+    void setMapped(std::shared_ptr<const PcmMapping> owner,
+        const qint16* data, qint64 frames)
+    {
+        samples = QVector<qint16>();
+        m_blocks.reset();
+        m_mapping = std::move(owner);
+        m_mappedData = data;
+        m_frames = frames;
+    }
+
+    void setCompressed(std::shared_ptr<const PcmBlocks> blocks, qint64 frames)
+    {
+        samples = QVector<qint16>();
+        m_mapping.reset();
+        m_mappedData = nullptr;
+        m_blocks = std::move(blocks);
+        m_frames = frames;
+    }
+
+private:
+    std::shared_ptr<const PcmMapping> m_mapping;
+    std::shared_ptr<const PcmBlocks>  m_blocks;
+    const qint16* m_mappedData = nullptr;
+    qint64 m_frames = 0;
+};
+
+// Nén PCM (RAM hoặc map) thành các khối kPcmBlockFrames độc lập, lossless:
+// dự đoán tuyến tính bậc 1/2 theo từng nhóm 256 mẫu, phần dư đóng gói theo
+// số bit lớn nhất của nhóm. Giọng nói còn khoảng một nửa int16. Các khối
+// nén song song trên TaskPool. false nếu rỗng.
+bool compressPcm(PcmData& pcm);
+
+// [f0, f1) dưới dạng mảng liền: trỏ thẳng vào PCM khi không nén, ngược
+// lại giải nén các khối phủ đoạn vào buffer riêng
+class PcmSlice
+{
+public:
+    PcmSlice(const PcmData& pcm, qint64 f0, qint64 f1)
+    {
+        f0 = std::clamp<qint64>(f0, 0, pcm.frames());
+        f1 = std::clamp<qint64>(f1, f0, pcm.frames());
+        if (const qint16* raw = pcm.data()) {
+            m_data = raw + f0;
+            return;
+        }
+        m_buf.resize(size_t(f1 - f0));
+        pcm.readFrames(f0, f1 - f0, m_buf.data());
+        m_data = m_buf.data();
+    }
+
+    const qint16* data() const { return m_data; }
+
+private:
+    std::vector<qint16> m_buf;
+    const qint16* m_data = nullptr;
+};
+
+// Truy cập ngẫu nhiên từng mẫu, giữ một khối đã giải nén. Không cấp phát
+// sau reset() nên dùng được trong callback audio; đổi khối chỉ tốn một lần
+// giải nén (nhỏ hơn nhiều so với một chu kỳ audio).
+class PcmCursor
+{
+public:
+    // gọi khi chưa có luồng nào đang đọc (cấp phát buffer ở đây)
+    void reset(const PcmData* pcm)
+    {
+        m_pcm = pcm;
+        m_raw = pcm ? pcm->data() : nullptr;
+        m_block = -1;
+        if (pcm && pcm->isCompressed())
+            m_buf.resize(size_t(kPcmBlockFrames));
+        else
+            m_buf = std::vector<qint16>();
+    }
+
+    qint16 at(qint64 f)
+    {
+        if (m_raw) return m_raw[f];
+        const qint64 b = f >> kPcmBlockShift;
+        if (b != m_block) {
+            m_pcm->readBlock(b, m_buf.data());
+            m_block = b;
+        }
+        return m_buf[size_t(f & (kPcmBlockFrames - 1))];
+    }
+
+private:
+    const PcmData* m_pcm = nullptr;
+    const qint16* m_raw = nullptr;
+    qint64 m_block = -1;
+    std::vector<qint16> m_buf;
+};
+
+//===================== Helpers =====================
+
+QString formatTime(double sec);            // "mm:ss.mmm", "" nếu sec < 0
+double  parseTime(const QString& s);       // ngược lại; -1 nếu sai dạng
+int     countWords(const QString& s);
+
+QVector<QString> baseSplitSentences(const QString& text);
+QVector<QString> splitTextIntoSentencesAdvanced(const QString& text);
+
+// JSON lesson (section file). Lỗi trả qua *error; người gọi tự báo
+// (hộp thoại ở GUI, stderr ở CLI).
+bool loadLessonJson(const QString& jsonPath,
+    QString& audioPath,
+    QString& textPath,
+    QVector<Sentence>& sentences,
+    double& playSpeed,
+    int& lastSentence,
+    QString* error = nullptr);
+
+bool saveLessonJson(const QString& jsonPath,
+    const QString& audioPath,
+    const QString& textPath,
+    const QVector<Sentence>& sentences,
+    double playSpeed,
+    int lastSentence,
+    QString* error = nullptr);
+
+//===================== Task pool =====================
+
+inline qint64 steadyNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Cờ huỷ dùng chung giữa nơi gửi task và task. Token con bị coi là đã huỷ
+// khi cha bị huỷ: lesson giữ token gốc, mỗi nơi dùng (cache spectrogram...)
+// lấy token con để huỷ riêng phần của mình.
+class CancelToken
+{
+public:
+    CancelToken() = default;
+
+    static CancelToken create(const CancelToken& parent = CancelToken())
+    {
+        CancelToken t;
+        t.m_state = std::make_shared<State>();
+        t.m_state->parent = parent.m_state;
+        return t;
+    }
+
+    void cancel() const
+    {
+        if (m_state) m_state->flag.store(true, std::memory_order_relaxed);
+    }
+
+    bool isCancelled() const
+    {
+        for (const State* s = m_state.get(); s; s = s->parent.get()) {
+            if (s->flag.load(std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    struct State
+    {
+        std::atomic<bool> flag{ false };
+        std::shared_ptr<State> parent;
+    };
+    std::shared_ptr<State> m_state;
+};
+
+// Pool dùng chung cho mọi phân tích (peaks, word timing, từ vựng, tile
+// spectrogram). Mỗi worker có một deque cho mỗi mức ưu tiên: worker lấy
+// task của mình từ cuối (LIFO, nóng cache), hết thì lấy trộm từ đầu deque
+// của worker khác; mức Visible luôn được xét trên mọi worker trước Normal.
+class TaskPool
+{
+public:
+    enum Priority { Visible, Normal, Background, PriorityCount };
+
+    struct Stats
+    {
+        int    threads = 0;
+        int    queued = 0;          // đang chờ trong các deque
+        int    running = 0;
+        qint64 completed = 0;
+        qint64 cancelled = 0;       // bỏ qua vì token đã huỷ
+        qint64 stolen = 0;
+        double avgWaitMs = 0.0;     // từ submit tới lúc bắt đầu chạy
+        double maxWaitMs = 0.0;
+        double avgRunMs = 0.0;
+    };
+
+    static TaskPool& instance()
+    {
+        static TaskPool pool;
+        return pool;
+    }
+
+    explicit TaskPool(int threads = 0)
+    {
+        if (threads <= 0)
+            threads = std::max(1, int(std::thread::hardware_concurrency()));
+        for (int i = 0; i < threads; ++i)
+            m_workers.push_back(std::make_unique<Worker>());
+        for (int i = 0; i < threads; ++i)
+            m_workers[i]->thread = std::thread([this, i]() { run(i); });
+    }
+
+    ~TaskPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+        for (auto& w : m_workers)
+            w->thread.join();
+    }
+
+    int threadCount() const { return int(m_workers.size()); }
+
+    // Gửi từ worker → vào deque của chính nó; từ luồng khác → xoay vòng
+    void submit(std::function<void()> fn, Priority prio = Normal,
+        CancelToken token = CancelToken())
+    {
+        Task t{ std::move(fn), std::move(token), steadyNowNs() };
+        const int self = (s_pool == this) ? s_index : -1;
+        const int target = self >= 0 ? self
+            : int(m_nextWorker.fetch_add(1, std::memory_order_relaxed)
+                % m_workers.size());
+        {
+            Worker& w = *m_workers[target];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            w.queues[prio].push_back(std::move(t));
+        }
+        m_queued.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+        }
+        m_wake.notify_one();
+    }
+
+    // Chia [0, n) thành khối chạy trên pool; luồng gọi cùng làm rồi chờ
+    // xong (gọi lồng từ trong task vẫn an toàn, không deadlock).
+    void parallelFor(int n, const std::function<void(int)>& fn,
+        Priority prio = Visible)
+    {
+        if (n <= 0) return;
+        const int chunks = std::min(n, threadCount() * 4);
+        if (chunks <= 1) {
+            for (int i = 0; i < n; ++i) fn(i);
+            return;
+        }
+
+        struct Latch
+        {
+            std::atomic<int> next{ 0 };
+            std::atomic<int> left{ 0 };
+            std::mutex mutex;
+            std::condition_variable done;
+        };
+        auto latch = std::make_shared<Latch>();
+        latch->left.store(chunks, std::memory_order_relaxed);
+        const std::function<void(int)>* body = &fn;
+
+        // fn chỉ được chạm khi còn khối chưa xong → còn sống trên stack
+        auto work = [latch, body, n, chunks]() {
+            for (;;) {
+                const int c = latch->next.fetch_add(1);
+                if (c >= chunks) return;
+                const int b = int(qint64(n) * c / chunks);
+                const int e = int(qint64(n) * (c + 1) / chunks);
+                for (int i = b; i < e; ++i) (*body)(i);
+                if (latch->left.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(latch->mutex);
+                    latch->done.notify_all();
+                }
+            }
+        };
+        for (int h = 1; h < std::min(chunks, threadCount()); ++h)
+            submit(work, prio);
+        work();
+
+        std::unique_lock<std::mutex> lock(latch->mutex);
+        latch->done.wait(lock, [&latch]() {
+            return latch->left.load() == 0;
+        });
+    }
+
+    Stats stats() const
+    {
+        Stats s;
+        s.threads = threadCount();
+        s.queued = m_queued.load(std::memory_order_relaxed);
+        s.running = m_running.load(std::memory_order_relaxed);
+        s.completed = m_completed.load(std::memory_order_relaxed);
+        s.cancelled = m_cancelled.load(std::memory_order_relaxed);
+        s.stolen = m_stolen.load(std::memory_order_relaxed);
+        const qint64 ran = s.completed + s.cancelled;
+        if (ran > 0) {
+            s.avgWaitMs = m_waitNs.load(std::memory_order_relaxed) / 1e6 / ran;
+            s.avgRunMs = m_runNs.load(std::memory_order_relaxed) / 1e6 / ran;
+        }
+        s.maxWaitMs = m_maxWaitNs.load(std::memory_order_relaxed) / 1e6;
+        return s;
+    }
+
+private:
+    struct Task
+    {
+        std::function<void()> fn;
+        CancelToken token;
+        qint64 submitNs = 0;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::array<std::deque<Task>, PriorityCount> queues;
+        std::thread thread;
+    };
+
+    bool take(int self, Task& out)
+    {
+        const int n = threadCount();
+        for (int prio = 0; prio < PriorityCount; ++prio) {
+            {
+                Worker& w = *m_workers[self];
+                std::lock_guard<std::mutex> lock(w.mutex);
+                if (!w.queues[prio].empty()) {
+                    out = std::move(w.queues[prio].back());
+                    w.queues[prio].pop_back();
+                    return true;
+                }
+            }
+            for (int k = 1; k < n; ++k) {
+                Worker& v = *m_workers[(self + k) % n];
+                std::lock_guard<std::mutex> lock(v.mutex);
+                if (!v.queues[prio].empty()) {
+                    out = std::move(v.queues[prio].front());
+                    v.queues[prio].pop_front();
+                    m_stolen.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void run(int self)
+    {
+        s_pool = this;
+        s_index = self;
+        for (;;) {
+            Task t;
+            if (!take(self, t)) {
+                std::unique_lock<std::mutex> lock(m_sleepMutex);
+                m_wake.wait(lock, [this]() {
+                    return m_quit
+                        || m_queued.load(std::memory_order_acquire) > 0;
+                });
+                if (m_quit) return;
+                continue;
+            }
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            m_running.fetch_add(1, std::memory_order_relaxed);
+
+            const qint64 start = steadyNowNs();
+            const qint64 wait = start - t.submitNs;
+            if (t.token.isCancelled()) {
+                m_cancelled.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                t.fn();
+                m_completed.fetch_add(1, std::memory_order_relaxed);
+            }
+            m_waitNs.fetch_add(wait, std::memory_order_relaxed);
+            m_runNs.fetch_add(steadyNowNs() - start,
+                std::memory_order_relaxed);
+            qint64 prev = m_maxWaitNs.load(std::memory_order_relaxed);
+            while (wait > prev && !m_maxWaitNs.compare_exchange_weak(
+                prev, wait, std::memory_order_relaxed)) {}
+            m_running.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    inline static thread_local TaskPool* s_pool = nullptr;
+    inline static thread_local int s_index = -1;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<unsigned> m_nextWorker{ 0 };
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    bool m_quit = false;
+
+    std::atomic<int>    m_queued{ 0 };
+    std::atomic<int>    m_running{ 0 };
+    std::atomic<qint64> m_completed{ 0 };
+    std::atomic<qint64> m_cancelled{ 0 };
+    std::atomic<qint64> m_stolen{ 0 };
+    std::atomic<qint64> m_waitNs{ 0 };
+    std::atomic<qint64> m_runNs{ 0 };
+    std::atomic<qint64> m_maxWaitNs{ 0 };
+};
+
+//===================== Tracing =====================
+
+// Trace nhẹ để đo độ trễ đầu-cuối (bấm nút → tiếng ra loa). Mỗi luồng ghi
+// vào ring riêng của nó (một writer, không khoá). Ring được cấp phát ở sự
+// kiện đầu tiên của luồng, trừ khi luồng đã registerThread() trước – luồng
+// realtime (callback audio) phải đăng ký lúc khởi động để record() không
+// bao giờ cấp phát hay khoá ở đó. Khi tắt, mỗi điểm đo chỉ tốn một load
+// atomic.
+struct TraceEvent
+{
+    qint64      ns = 0;             // steadyNowNs()
+    const char* name = nullptr;     // chuỗi literal "nhóm.tên"
+    quint32     flow = 0;           // nối các sự kiện của cùng một thao tác
+    qint64      arg = 0;
+};
+
+struct TraceThread
+{
+    QString name;                   // tên đăng ký hoặc nhóm của sự kiện đầu tiên
+    std::vector<TraceEvent> events; // theo thời gian
+};
+
+class Trace
+{
+public:
+    static bool enabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    // bật lại là bắt đầu phiên mới: sự kiện cũ bị bỏ qua khi xuất
+    static void setEnabled(bool on);
+
+    // cấp ring cho luồng hiện tại (gọi ngoài đường realtime); tên hiện
+    // trong Chrome trace. Gọi lại trên cùng luồng thì không làm gì.
+    static void registerThread(const char* name);
+
+    static void instant(const char* name, quint32 flow = 0, qint64 arg = 0)
+    {
+        if (enabled()) record(name, flow, arg);
+    }
+
+    // thao tác UI đang xử lý trên luồng này (0 = không có), xem TraceFlow
+    static quint32 currentFlow() { return t_flow; }
+
+    // sự kiện của phiên hiện tại, mỗi luồng một phần tử
+    static QVector<TraceThread> collect();
+
+    // Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+    static bool exportChrome(const QString& path, QString* error = nullptr);
+
+    // p50/p95/p99 từ sự kiện "ui.*" tới lúc mẫu đầu tiên ra loa
+    static QString latencyReport();
+
+private:
+    friend class TraceFlow;
+    static void record(const char* name, quint32 flow, qint64 arg);
+
+    inline static std::atomic<bool>    s_enabled{ false };
+    inline static std::atomic<quint32> s_nextFlow{ 0 };
+    inline static thread_local quint32 t_flow = 0;
+};
+
+// Đánh dấu một thao tác UI (ui.play, ui.sentence...): mọi lệnh gửi tới
+// AudioEngine trong phạm vi này mang cùng flow, nên báo cáo nối được lúc
+// bấm với lúc tiếng ra loa. Lồng nhau thì thao tác ngoài cùng thắng.
+class TraceFlow
+{
+public:
+    explicit TraceFlow(const char* uiName) : m_prev(Trace::t_flow)
+    {
+        if (!Trace::enabled() || m_prev != 0) return;
+        quint32 id = Trace::s_nextFlow.fetch_add(1,
+            std::memory_order_relaxed) + 1;
+        if (id == 0) id = 1;
+        Trace::t_flow = id;
+        Trace::record(uiName, id, 0);
+    }
+    ~TraceFlow() { Trace::t_flow = m_prev; }
+
+    TraceFlow(const TraceFlow&) = delete;
+    TraceFlow& operator=(const TraceFlow&) = delete;
+
+private:
+    quint32 m_prev;
+};
+
+//===================== Audio decode (PCM cache) =====================
+
+// Giải mã toàn bộ file thành PCM mono; false nếu không đọc được. WAV
+// 16 bit mono được map thẳng; audio dài hơn kPcmSpillSamples được ghi ra
+// file tạm rồi map, nên RAM chỉ giữ một khối đệm trong lúc giải mã.
+constexpr qint64 kPcmSpillSamples = 32 * 1024 * 1024;  // 64 MB, ~12 phút 44.1 kHz
+bool decodeAudioFile(const QString& path, PcmData& out);
+
+// lần giải mã thành công gần nhất (HUD): audio bao nhiêu giây, mất bao lâu
+struct DecodeStats
+{
+    qint64 files = 0;           // tổng số file đã giải mã
+    double audioSec = 0.0;
+    double wallSec = 0.0;
+};
+DecodeStats lastDecodeStats();
+
+//===================== Resampler =====================
+
+// Đổi sample rate theo tỉ lệ cố định (lesson 44.1 kHz → thiết bị 48 kHz,
+// micro → rate của lesson). Bank đa pha windowed-sinc (Kaiser): tỉ lệ rút
+// gọn L/M, mỗi pha một hàng kResampleTaps hệ số liền nhau nên tích vô
+// hướng ở vòng trong compiler tự vector hoá (SSE/AVX/NEON). Hạ rate thì
+// cutoff hạ theo và filter dài ra tương ứng. Chạy theo luồng: giữ lịch sử
+// giữa các lần gọi, không cấp phát sau configure().
+class Resampler
+{
+public:
+    // cấp phát bank + buffer; gọi khi chưa luồng nào đang dùng
+    void configure(int inRate, int outRate);
+
+    bool isPassthrough() const { return m_L == m_M; }
+    int  inRate() const { return m_inRate; }
+    int  outRate() const { return m_outRate; }
+
+    // trễ nhóm của filter, tính bằng mẫu vào
+    int  delayInputFrames() const { return m_taps / 2; }
+
+    // bỏ lịch sử (lần phát sau bắt đầu từ im lặng)
+    void reset();
+
+    // Pull (luồng audio): ghi đúng n mẫu ra vào out, lấy thêm mẫu vào bằng
+    // fill(dst, k) – chỉ xin đúng số mẫu cần nên nguồn không chạy trước.
+    template <typename Fill>
+    void pull(float* out, int n, Fill&& fill)
+    {
+        for (int i = 0; i < n;) {
+            if (m_pos + m_taps <= m_len) {
+                out[i++] = next();
+                continue;
+            }
+            compact();
+            const int want = int(std::min<qint64>(inputFor(n - i),
+                qint64(m_buf.size()) - m_len));
+            fill(m_buf.data() + m_len, want);
+            m_len += want;
+        }
+    }
+
+    // Push (recorder): nạp nIn mẫu, ghi mọi mẫu ra đã đủ dữ liệu; out cần
+    // chỗ cho maxOutputFor(nIn) mẫu. Trả số mẫu đã ghi.
+    int process(const float* in, int nIn, float* out);
+    int maxOutputFor(int inFrames) const
+    {
+        return int(qint64(inFrames) * m_L / m_M) + 2;
+    }
+
+private:
+    // số mẫu vào còn thiếu để ra thêm n mẫu
+    qint64 inputFor(int n) const
+    {
+        const qint64 last = m_pos + (m_phase + qint64(n - 1) * m_M) / m_L;
+        return std::max<qint64>(0, last + m_taps - m_len);
+    }
+
+    float next();
+    void compact();
+
+    int m_inRate = 0;
+    int m_outRate = 0;
+    int m_L = 1;            // pha trên một mẫu vào (rate ra / ƯCLN)
+    int m_M = 1;            // bước mỗi mẫu ra, tính bằng 1/L mẫu vào
+    int m_taps = 0;         // bội của 8
+    int m_rows = 0;         // hàng pha (= L, tối đa kMaxRows); bank có rows + 1
+    std::vector<float> m_bank;
+    std::vector<float> m_buf;
+    int m_len = 0;          // mẫu hợp lệ trong m_buf
+    int m_pos = 0;          // mẫu đầu của cửa sổ cho mẫu ra kế tiếp
+    int m_phase = 0;        // 0..L-1
+};
+
+//===================== Word timing =====================
+
+QStringList sentenceWords(const QString& text);
+
+// onset từng từ: chia theo âm tiết rồi dời về cực tiểu năng lượng (nếu có PCM)
+void estimateWordTimes(Sentence& s, const PcmData* pcm);
+bool wordRange(const Sentence& s, int wordIdx, double& begin, double& end);
+
+// câu đầu tiên có [begin, end) chứa t, -1 nếu t nằm ngoài mọi câu
+int sentenceAt(const QVector<Sentence>& sentences, double t);
+
+// Chỉ mục (từ → câu, vị trí từ) sắp xếp để tra bằng lower_bound
+struct WordOccurrence
+{
+    QString word;   // lower case, chỉ chữ cái và '
+    int     row = 0;
+    int     wordIdx = 0;
+
+    bool operator<(const WordOccurrence& o) const
+    {
+        if (word != o.word) return word < o.word;
+        if (row != o.row) return row < o.row;
+        return wordIdx < o.wordIdx;
+    }
+};
+
+QVector<WordOccurrence> buildWordIndex(const QVector<Sentence>& sentences);
+const WordOccurrence* findWord(
+    const QVector<WordOccurrence>& index, const QString& word);
+
+//===================== Lesson preparation =====================
+
+// Begin/End tạm theo tỉ lệ số từ; chỉ khi mọi câu đều chưa có thời gian.
+// true nếu đã gán.
+bool assignTimesByWordCount(QVector<Sentence>& sentences, double duration);
+
+// dời ranh giới giữa các câu liền nhau về khoảng lặng gần nhất
+void snapBoundariesToPauses(QVector<Sentence>& sentences,
+    const PcmData& pcm, double radiusSec = 1.5);
+
+// thiếu/ngược thời gian, chồng câu, vượt độ dài audio, câu rỗng
+QStringList validateLesson(const QVector<Sentence>& sentences,
+    double duration);
+
+// phụ đề SRT cho các câu có thời gian hợp lệ
+bool saveLessonSrt(const QString& path,
+    const QVector<Sentence>& sentences, QString* error = nullptr);
+
+//===================== Loudness =====================
+
+constexpr double kLoudnessTargetLufs = -20.0;
+constexpr double kLoudnessMaxGainDb = 12.0;     // mỗi chiều
+constexpr double kLoudnessPeakCeilingDb = -1.0;
+constexpr double kLoudnessFloorLufs = -70.0;    // câu im lặng
+
+// Loudness EBU R128 / BS.1770 của một câu: K-weighting, khối 400 ms chồng
+// 75%, cổng tuyệt đối -70 LUFS và tương đối -10 LU; câu ngắn hơn một khối
+// lấy trung bình cả câu. Ghi s.loudness và s.peakDb; false nếu câu chưa
+// có thời gian hợp lệ.
+bool analyzeLoudness(Sentence& s, const PcmData& pcm);
+
+// mọi câu (hoặc chỉ câu chưa đo) song song trên TaskPool; trả số câu đã đo
+int analyzeLoudness(QVector<Sentence>& sentences, const PcmData& pcm,
+    bool missingOnly = false);
+
+// gain tuyến tính đưa câu về kLoudnessTargetLufs, giới hạn
+// ±kLoudnessMaxGainDb và không đẩy peak quá kLoudnessPeakCeilingDb;
+// 1 nếu câu chưa đo
+double loudnessGain(const Sentence& s);